@@ -0,0 +1,65 @@
+"""Per-call overhead of the IdentityDict methods and Memoizer misses.
+
+Each case is timed as the best of several runs of a loop over the same
+few keys, so the table stays in cache and what's left is mostly the cost
+of getting the arguments into the method.  d[key] is the floor: a slot
+call, with no argument parsing at all.
+
+Build in place first, then:
+
+    python3 bench/call.py
+"""
+
+import sys
+import timeit
+
+sys.path.insert(0, '.')
+
+from b.collections import IdentityDict
+from b.types import Memoizer
+
+NUMBER = 200000
+REPEAT = 15
+
+keys = [object() for _ in range(8)]
+absent = object()
+
+d = IdentityDict()
+for i, key in enumerate(keys):
+    d[key] = i
+
+def identity(key):
+    return key
+
+class Key:
+    pass
+
+memo_keys = [Key() for _ in range(NUMBER)]
+
+CASES = [
+    ('d[key]',                  'd[k0]'),
+    ('d.get(key)',              'd.get(k0)'),
+    ('d.get(key, default)',     'd.get(absent, None)'),
+    ('d.setdefault(key, v)',    'd.setdefault(k0, 0)'),
+    ('d.pop(key, default)',     'd.pop(absent, None)'),
+]
+
+def run(stmt, setup='pass', number=NUMBER):
+    namespace = dict(globals(), k0=keys[0])
+    times = timeit.repeat(stmt, setup, repeat=REPEAT, number=number, globals=namespace)
+    return min(times) / number * 1e9
+
+def main():
+    for label, stmt in CASES:
+        try:
+            print('%-24s %6.1f ns/call' % (label, run(stmt)))
+        except NotImplementedError:
+            # Comparing against a build from before it was implemented
+            print('%-24s    n/a' % label)
+
+    # Every call misses, so each one calls through to the function.
+    miss = run('for key in memo_keys: memo[key]', 'memo = Memoizer(identity)', number=1) / NUMBER
+    print('%-24s %6.1f ns/call' % ('Memoizer miss', miss))
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,286 @@
+/* Compare the probing engines of IdentityDict, see src/collections.c.
+
+   For each engine, at each count of keys: ns per insert, per lookup that
+   hits and per lookup that misses, and the mean slots or groups probed,
+   at the default 2/3 load.  Then again for misses after churn, once half
+   the keys have been deleted and as many new ones inserted, which is
+   where CTRL_DELETED slots build up for the groups.
+
+   The tables are stripped down to the probing: keys sit in the slots,
+   without the index and entries of IdentityDict.  Keys are stand-in
+   object addresses, 16 bytes apart, so 10**8 of them fit; that count
+   takes about 2.5GB.
+
+   cc -O2 -Iinclude $(python3-config --includes) bench/engine.c \
+       $(python3-config --ldflags --embed) -o /tmp/bench-engine
+   /tmp/bench-engine [count ...]
+*/
+
+#include "Python.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "hash.h"
+
+#define KEY(i) ((void *)(0x7f0000000000ULL + 16 * (size_t)(i)))
+
+/* Robin Hood, as ENGINE_ROBIN_HOOD, distances saturating alike */
+#define RH_MAX_DISTANCE 127
+#define RH_DISTANCE(distance) \
+    ((int8_t)((distance) < RH_MAX_DISTANCE ? (distance) : RH_MAX_DISTANCE))
+
+typedef struct {
+    size_t size;
+    int8_t *ctrl;
+    void **keys;
+    size_t probes;
+} Table;
+
+static double
+now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/* Groups */
+
+static void
+groups_insert(Table *table, void *key)
+{
+    Py_hash_t h = hash_int(key);
+    size_t gmask = table->size / GROUP_WIDTH - 1;
+    size_t group = H1(h) & gmask;
+    size_t step, i;
+    Bitmask match;
+
+    for (step = 1; ; step++) {
+        match = group_match_free(&table->ctrl[group * GROUP_WIDTH]);
+        if (match) {
+            i = group * GROUP_WIDTH + bitmask_lowest(match);
+            table->ctrl[i] = H2(h);
+            table->keys[i] = key;
+            return;
+        }
+        group = NEXT_GROUP(group, step, gmask);
+    }
+}
+
+/* Slot of `key`, else -1 */
+static Py_ssize_t
+groups_lookup(Table *table, void *key)
+{
+    Py_hash_t h = hash_int(key);
+    size_t gmask = table->size / GROUP_WIDTH - 1;
+    size_t group = H1(h) & gmask;
+    size_t step, i;
+    Bitmask match;
+
+    for (step = 1; ; step++) {
+        for (match = group_match(&table->ctrl[group * GROUP_WIDTH], H2(h)); match; match = BITMASK_NEXT(match)) {
+            i = group * GROUP_WIDTH + bitmask_lowest(match);
+            if (table->keys[i] == key) {
+                table->probes += step;
+                return i;
+            }
+        }
+
+        if (group_match_empty(&table->ctrl[group * GROUP_WIDTH])) {
+            table->probes += step;
+            return -1;
+        }
+
+        group = NEXT_GROUP(group, step, gmask);
+    }
+}
+
+static void
+groups_delete(Table *table, void *key)
+{
+    table->ctrl[groups_lookup(table, key)] = CTRL_DELETED;
+}
+
+/* Robin Hood */
+
+static size_t
+rh_home_distance(Table *table, size_t slot)
+{
+    if (table->ctrl[slot] < RH_MAX_DISTANCE)
+        return table->ctrl[slot];
+
+    return (slot - H1(hash_int(table->keys[slot]))) & (table->size - 1);
+}
+
+static void
+rh_insert(Table *table, void *key)
+{
+    size_t mask = table->size - 1;
+    size_t slot = H1(hash_int(key)) & mask;
+    size_t distance = 0, other_distance;
+    void *other;
+
+    for (;;) {
+        if (table->ctrl[slot] == CTRL_EMPTY) {
+            table->ctrl[slot] = RH_DISTANCE(distance);
+            table->keys[slot] = key;
+            return;
+        }
+
+        other_distance = distance > RH_MAX_DISTANCE
+            ? rh_home_distance(table, slot)
+            : (size_t)table->ctrl[slot];
+
+        if (other_distance < distance) {
+            other = table->keys[slot];
+            table->ctrl[slot] = RH_DISTANCE(distance);
+            table->keys[slot] = key;
+            distance = other_distance;
+            key = other;
+        }
+
+        slot = (slot + 1) & mask;
+        distance++;
+    }
+}
+
+static Py_ssize_t
+rh_lookup(Table *table, void *key)
+{
+    size_t mask = table->size - 1;
+    size_t i = H1(hash_int(key)) & mask;
+    size_t step;
+
+    for (step = 0; ; step++) {
+        if (table->ctrl[i] == RH_DISTANCE(step)) {
+            if (table->keys[i] == key) {
+                table->probes += step + 1;
+                return i;
+            }
+        } else if (table->ctrl[i] < RH_DISTANCE(step)) {
+            table->probes += step + 1;
+            return -1;
+        }
+
+        i = (i + 1) & mask;
+    }
+}
+
+static void
+rh_delete(Table *table, void *key)
+{
+    size_t mask = table->size - 1;
+    size_t slot = rh_lookup(table, key);
+    size_t next;
+
+    for (next = (slot + 1) & mask; table->ctrl[next] > 0; next = (next + 1) & mask) {
+        table->ctrl[slot] = RH_DISTANCE(rh_home_distance(table, next) - 1);
+        table->keys[slot] = table->keys[next];
+        slot = next;
+    }
+
+    table->ctrl[slot] = CTRL_EMPTY;
+}
+
+static const struct {
+    const char *name;
+    const char *unit;
+    void (*insert)(Table *, void *);
+    Py_ssize_t (*lookup)(Table *, void *);
+    void (*delete)(Table *, void *);
+} engines[] = {
+    {"groups",     "groups", groups_insert, groups_lookup, groups_delete},
+    {"robin hood", "slots",  rh_insert,     rh_lookup,     rh_delete},
+};
+
+#define NUM_ENGINES (sizeof(engines) / sizeof(engines[0]))
+
+/* ns per lookup of keys [first, first + count), and mean probe length */
+static void
+time_lookups(Table *table, int e, size_t first, size_t count, const char *label)
+{
+    volatile Py_ssize_t sink = 0;
+    double start;
+    size_t i;
+
+    table->probes = 0;
+
+    start = now();
+    for (i = first; i < first + count; i++)
+        sink += engines[e].lookup(table, KEY(i));
+    start = now() - start;
+
+    (void)sink;
+
+    printf("    %-12s %7.1f ns  %.3f %s\n", label, start / count,
+           (double)table->probes / count, engines[e].unit);
+}
+
+static int
+run(size_t count)
+{
+    Table table;
+    double start;
+    size_t e, i;
+
+    for (table.size = GROUP_WIDTH; (size_t)USABLE(table.size) < count; table.size *= 2)
+        ;
+
+    table.ctrl = malloc(table.size);
+    table.keys = malloc(table.size * sizeof(void *));
+    if (table.ctrl == NULL || table.keys == NULL) {
+        fprintf(stderr, "no memory for %zu keys\n", count);
+        return -1;
+    }
+
+    printf("%zu keys, %zu slots (load %.2f)\n",
+           count, table.size, (double)count / table.size);
+
+    for (e = 0; e < NUM_ENGINES; e++) {
+        memset(table.ctrl, CTRL_EMPTY, table.size);
+
+        printf("  %s\n", engines[e].name);
+
+        start = now();
+        for (i = 0; i < count; i++)
+            engines[e].insert(&table, KEY(i));
+        printf("    %-12s %7.1f ns\n", "insert", (now() - start) / count);
+
+        time_lookups(&table, e, 0, count, "hit");
+        time_lookups(&table, e, count, count, "miss");
+
+        /* Keys [count / 2, count * 3 / 2) live after */
+        for (i = 0; i < count / 2; i++) {
+            engines[e].delete(&table, KEY(i));
+            engines[e].insert(&table, KEY(count + i));
+        }
+
+        time_lookups(&table, e, count / 2, count, "churned hit");
+        time_lookups(&table, e, 2 * count, count, "churned miss");
+    }
+
+    free(table.ctrl);
+    free(table.keys);
+
+    return 0;
+}
+
+int
+main(int argc, char **argv)
+{
+    static const size_t default_counts[] = {1000, 10000, 100000, 1000000, 10000000, 100000000};
+    size_t i;
+    int status = 0;
+
+    if (argc > 1) {
+        for (i = 1; i < (size_t)argc && status == 0; i++)
+            status = run(strtoul(argv[i], NULL, 10));
+    } else {
+        for (i = 0; i < sizeof(default_counts) / sizeof(default_counts[0]) && status == 0; i++)
+            status = run(default_counts[i]);
+    }
+
+    return status == 0 ? 0 : 1;
+}
@@ -0,0 +1,170 @@
+/* Cost of short-lived IdentityDicts, as made for per-call memo tables.
+
+   Each round makes a dict, sets `keys` keys in it and drops it.  Reports
+   time per round, and calls into the object and raw-memory allocators
+   per round, counted by hooks around them.  Compare a build without the
+   free lists against the default:
+
+   B_FREELIST=0 python3 setup.py build_ext --force --inplace
+   cc -O2 $(python3-config --includes) bench/freelist.c \
+       $(python3-config --ldflags --embed) -o /tmp/bench-freelist
+   /tmp/bench-freelist [rounds]
+
+   Run from the top of the tree, where the built package is.
+*/
+
+#include "Python.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+typedef struct {
+    PyMemAllocatorEx wrapped;
+    size_t allocs;
+    size_t frees;
+} Counter;
+
+static Counter counters[2];
+
+static void *
+count_malloc(void *ctx, size_t size)
+{
+    Counter *counter = ctx;
+    counter->allocs++;
+    return counter->wrapped.malloc(counter->wrapped.ctx, size);
+}
+
+static void *
+count_calloc(void *ctx, size_t nelem, size_t elsize)
+{
+    Counter *counter = ctx;
+    counter->allocs++;
+    return counter->wrapped.calloc(counter->wrapped.ctx, nelem, elsize);
+}
+
+static void *
+count_realloc(void *ctx, void *ptr, size_t size)
+{
+    Counter *counter = ctx;
+    counter->allocs++;
+    return counter->wrapped.realloc(counter->wrapped.ctx, ptr, size);
+}
+
+static void
+count_free(void *ctx, void *ptr)
+{
+    Counter *counter = ctx;
+    if (ptr != NULL)
+        counter->frees++;
+    counter->wrapped.free(counter->wrapped.ctx, ptr);
+}
+
+static void
+hook(PyMemAllocatorDomain domain, Counter *counter)
+{
+    PyMemAllocatorEx allocator = {
+        counter, count_malloc, count_calloc, count_realloc, count_free
+    };
+
+    PyMem_GetAllocator(domain, &counter->wrapped);
+    PyMem_SetAllocator(domain, &allocator);
+}
+
+static double
+now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static int
+run(PyObject *type, PyObject **keys, int nkeys, long rounds)
+{
+    double start, best = 0;
+    size_t allocs = 0, frees = 0;
+    long i;
+    int k, repeat;
+
+    for (repeat = 0; repeat < 5; repeat++) {
+        counters[0].allocs = counters[1].allocs = 0;
+        counters[0].frees = counters[1].frees = 0;
+
+        start = now();
+
+        for (i = 0; i < rounds; i++) {
+            PyObject *d = PyObject_CallNoArgs(type);
+            if (d == NULL)
+                return -1;
+
+            for (k = 0; k < nkeys; k++) {
+                if (PyObject_SetItem(d, keys[k], Py_None) == -1)
+                    return -1;
+            }
+
+            Py_DECREF(d);
+        }
+
+        start = now() - start;
+
+        if (repeat == 0 || start < best)
+            best = start;
+
+        allocs = counters[0].allocs + counters[1].allocs;
+        frees = counters[0].frees + counters[1].frees;
+    }
+
+    printf("  %d keys: %6.1f ns, %.2f allocs and %.2f frees per dict\n",
+           nkeys, best / rounds, (double)allocs / rounds, (double)frees / rounds);
+
+    return 0;
+}
+
+int
+main(int argc, char **argv)
+{
+    long rounds = argc > 1 ? strtol(argv[1], NULL, 10) : 1000000;
+    PyObject *module, *type, *keys[8];
+    int k, status = 0;
+
+    Py_Initialize();
+
+    if (PyRun_SimpleString("import sys; sys.path.insert(0, '.')") == -1)
+        return 1;
+
+    module = PyImport_ImportModule("b._collections");
+    if (module == NULL)
+        goto error;
+
+    type = PyObject_GetAttrString(module, "IdentityDict");
+    if (type == NULL)
+        goto error;
+
+    for (k = 0; k < 8; k++) {
+        keys[k] = PyObject_CallNoArgs((PyObject *)&PyBaseObject_Type);
+        if (keys[k] == NULL)
+            goto error;
+    }
+
+    hook(PYMEM_DOMAIN_MEM, &counters[0]);
+    hook(PYMEM_DOMAIN_OBJ, &counters[1]);
+
+    printf("%ld rounds\n", rounds);
+
+    if (run(type, keys, 0, rounds) == -1 ||
+        run(type, keys, 1, rounds) == -1 ||
+        run(type, keys, 8, rounds) == -1)
+        goto error;
+
+    goto done;
+
+  error:
+    PyErr_Print();
+    status = 1;
+
+  done:
+    Py_Finalize();
+
+    return status;
+}
@@ -0,0 +1,283 @@
+/* Compare the pointer hash families of include/hash.h.
+
+   For each family, on the addresses of live Python objects of mixed
+   types: cycles (or ns) per hash, and the distribution of groups probed
+   by hits and misses in a control-byte table filled to USABLE(), plus
+   how often a tag match turns out false.
+
+   cc -O2 -Iinclude $(python3-config --includes) bench/hash.c \
+       $(python3-config --ldflags --embed) -o /tmp/bench-hash
+   /tmp/bench-hash [count ...]
+*/
+
+#include "Python.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define TICKS() __rdtsc()
+#define TICK_UNIT "cycles"
+#endif
+
+#include "hash.h"
+
+#define MAX_PROBE 8
+
+typedef Py_hash_t (*hash_func)(void *);
+
+static const struct {
+    const char *name;
+    hash_func hash;
+} families[] = {
+    {"jenkins",   hash_jenkins},
+    {"fibonacci", hash_fibonacci},
+    {"rotxor",    hash_rotxor},
+};
+
+#define NUM_FAMILIES (sizeof(families) / sizeof(families[0]))
+
+typedef struct {
+    /* [n] counts probes of n + 1 groups, the last also all longer ones */
+    size_t groups[MAX_PROBE];
+    size_t total_groups;
+    size_t max_groups;
+    size_t false_tags;
+    size_t count;
+} Histogram;
+
+typedef struct {
+    Py_ssize_t size;
+    int8_t *ctrl;
+    void **keys;
+} Table;
+
+#ifndef TICKS
+static unsigned long long
+ticks(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+#define TICKS() ticks()
+#define TICK_UNIT "ns"
+#endif
+
+/* Fill `pointers` with the addresses of `count` fresh objects, kept
+   alive by `owner`.  Mixed types, so mixed sizes and allocator pools. */
+static int
+make_pointers(PyObject *owner, void **pointers, Py_ssize_t count)
+{
+    Py_ssize_t i;
+    PyObject *o;
+
+    for (i = 0; i < count; i++) {
+        switch (i % 6) {
+        case 0: o = PyObject_CallNoArgs((PyObject *)&PyBaseObject_Type); break;
+        case 1: o = PyList_New(0); break;
+        case 2: o = PyDict_New(); break;
+        case 3: o = PyFloat_FromDouble((double)i); break;
+        case 4: o = PyTuple_Pack(1, Py_None); break;
+        default: o = PyUnicode_FromFormat("key-%zd", i); break;
+        }
+
+        if (o == NULL || PyList_Append(owner, o) == -1)
+            return -1;
+
+        Py_DECREF(o);
+
+        pointers[i] = o;
+    }
+
+    /* Shuffle, so insertion order doesn't follow allocation order */
+    for (i = count - 1; i > 0; i--) {
+        Py_ssize_t j = rand() % (i + 1);
+        void *tmp = pointers[i];
+        pointers[i] = pointers[j];
+        pointers[j] = tmp;
+    }
+
+    return 0;
+}
+
+static double
+time_hash(hash_func hash, void **pointers, Py_ssize_t count)
+{
+    unsigned long long start, best = (unsigned long long)-1;
+    volatile Py_hash_t sink = 0;
+    Py_hash_t acc;
+    Py_ssize_t i;
+    int round;
+
+    for (round = 0; round < 5; round++) {
+        acc = 0;
+        start = TICKS();
+        for (i = 0; i < count; i++)
+            acc ^= hash(pointers[i]);
+        start = TICKS() - start;
+        sink ^= acc;
+
+        if (start < best)
+            best = start;
+    }
+
+    (void)sink;
+
+    return (double)best / count;
+}
+
+static void
+table_insert(Table *table, hash_func hash, void *key)
+{
+    Py_hash_t h = hash(key);
+    size_t gmask = table->size / GROUP_WIDTH - 1;
+    size_t group = H1(h) & gmask;
+    size_t step, i;
+    Bitmask match;
+
+    for (step = 1; ; step++) {
+        match = group_match_free(&table->ctrl[group * GROUP_WIDTH]);
+        if (match) {
+            i = group * GROUP_WIDTH + bitmask_lowest(match);
+            table->ctrl[i] = H2(h);
+            table->keys[i] = key;
+            return;
+        }
+        group = NEXT_GROUP(group, step, gmask);
+    }
+}
+
+static void
+table_probe(Table *table, hash_func hash, void *key, Histogram *histogram)
+{
+    Py_hash_t h = hash(key);
+    size_t gmask = table->size / GROUP_WIDTH - 1;
+    size_t group = H1(h) & gmask;
+    size_t step, i;
+    Bitmask match;
+
+    for (step = 1; ; step++) {
+        for (match = group_match(&table->ctrl[group * GROUP_WIDTH], H2(h)); match; match = BITMASK_NEXT(match)) {
+            i = group * GROUP_WIDTH + bitmask_lowest(match);
+            if (table->keys[i] == key)
+                goto done;
+            histogram->false_tags++;
+        }
+
+        if (group_match_empty(&table->ctrl[group * GROUP_WIDTH]))
+            goto done;
+
+        group = NEXT_GROUP(group, step, gmask);
+    }
+
+  done:
+    histogram->groups[step < MAX_PROBE ? step - 1 : MAX_PROBE - 1]++;
+    histogram->total_groups += step;
+    if (step > histogram->max_groups)
+        histogram->max_groups = step;
+    histogram->count++;
+}
+
+static void
+print_histogram(const char *label, Histogram *histogram)
+{
+    int n;
+
+    printf("    %-5s mean %.3f max %2zu  false tags/probe %.4f  groups:",
+           label,
+           (double)histogram->total_groups / histogram->count,
+           histogram->max_groups,
+           (double)histogram->false_tags / histogram->count);
+
+    for (n = 0; n < MAX_PROBE; n++)
+        printf(" %s%d:%.2f%%", n == MAX_PROBE - 1 ? ">=" : "", n + 1,
+               100.0 * histogram->groups[n] / histogram->count);
+
+    printf("\n");
+}
+
+static int
+run(Py_ssize_t count)
+{
+    PyObject *owner = PyList_New(0);
+    void **keys = malloc(count * sizeof(void *));
+    void **others = malloc(count * sizeof(void *));
+    Table table;
+    size_t f;
+    Py_ssize_t i;
+
+    if (owner == NULL || keys == NULL || others == NULL)
+        return -1;
+
+    if (make_pointers(owner, keys, count) == -1)
+        return -1;
+    if (make_pointers(owner, others, count) == -1)
+        return -1;
+
+    for (table.size = GROUP_WIDTH; USABLE(table.size) < count; table.size *= 2)
+        ;
+
+    table.ctrl = malloc(table.size);
+    table.keys = malloc(table.size * sizeof(void *));
+    if (table.ctrl == NULL || table.keys == NULL)
+        return -1;
+
+    printf("%zd keys, %zd slots (load %.2f)\n",
+           count, table.size, (double)count / table.size);
+
+    for (f = 0; f < NUM_FAMILIES; f++) {
+        Histogram hits = {{0}}, misses = {{0}};
+        hash_func hash = families[f].hash;
+
+        memset(table.ctrl, CTRL_EMPTY, table.size);
+
+        for (i = 0; i < count; i++)
+            table_insert(&table, hash, keys[i]);
+        for (i = 0; i < count; i++)
+            table_probe(&table, hash, keys[i], &hits);
+        for (i = 0; i < count; i++)
+            table_probe(&table, hash, others[i], &misses);
+
+        printf("  %-9s %.2f %s/hash\n", families[f].name,
+               time_hash(hash, keys, count), TICK_UNIT);
+        print_histogram("hit", &hits);
+        print_histogram("miss", &misses);
+    }
+
+    free(table.ctrl);
+    free(table.keys);
+    free(keys);
+    free(others);
+    Py_DECREF(owner);
+
+    return 0;
+}
+
+int
+main(int argc, char **argv)
+{
+    static const Py_ssize_t default_counts[] = {1000, 100000, 1000000};
+    int i, status = 0;
+
+    Py_Initialize();
+
+    srand(1);
+
+    if (argc > 1) {
+        for (i = 1; i < argc && status == 0; i++)
+            status = run(strtol(argv[i], NULL, 10));
+    } else {
+        for (i = 0; i < 3 && status == 0; i++)
+            status = run(default_counts[i]);
+    }
+
+    if (status == -1)
+        PyErr_Print();
+
+    Py_Finalize();
+
+    return status == 0 ? 0 : 1;
+}
@@ -3,13 +3,101 @@
 
 #include "Python.h"
 
-#define PERTURB_SHIFT 5
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 #define USABLE(size) ((((size) << 1) + 1) / 3)
 
+/* Load policy
+
+   USABLE() is the default: tables fill to 2/3 of their slots, then
+   double.  Tables that take a `max_load` and `growth_factor` of their own
+   use usable_at() instead, and multiply their size by `growth_factor`,
+   which keeps it a power of two.
+*/
+
+#define DEFAULT_MAX_LOAD (2.0 / 3.0)
+#define DEFAULT_GROWTH_FACTOR 2
+
+/* Entries a table of `size` slots holds at `max_load`: USABLE() at the
+   default, and never all the slots, so a probe always finds an empty one */
+static inline Py_ssize_t
+usable_at(Py_ssize_t size, double max_load)
+{
+    Py_ssize_t usable = (Py_ssize_t)(size * max_load + 0.5);
+
+    return usable < 1 ? 1 : usable >= size ? size - 1 : usable;
+}
+
+/* 0, else -1 with ValueError set */
+static inline int
+check_load_policy(double max_load, Py_ssize_t growth_factor)
+{
+    if (!(max_load > 0.0 && max_load < 1.0)) {
+        PyErr_SetString(PyExc_ValueError, "max_load must be between 0 and 1");
+        return -1;
+    }
+
+    if (growth_factor < 2 || (growth_factor & (growth_factor - 1)) != 0) {
+        PyErr_SetString(PyExc_ValueError, "growth_factor must be a power of two, at least 2");
+        return -1;
+    }
+
+    return 0;
+}
+
+/* Table memory
+
+   Tables come from PyMem_Malloc(), but table_malloc() moves their
+   tracemalloc traces from the default domain, 0, to TABLE_DOMAIN, so a
+   tracemalloc.DomainFilter can pick out the share held by b's tables, as
+   b.collections.TRACEMALLOC_DOMAIN.  Free them with table_free().
+*/
+
+#define TABLE_DOMAIN 0x62
+
+static inline void *
+table_malloc(size_t size)
+{
+    void *memory = PyMem_Malloc(size);
+
+    /* Both just return -2 unless tracemalloc is tracing */
+    if (memory != NULL && PyTraceMalloc_Untrack(0, (uintptr_t)memory) == 0)
+        PyTraceMalloc_Track(TABLE_DOMAIN, (uintptr_t)memory, size);
+
+    return memory;
+}
+
+static inline void
+table_free(void *memory)
+{
+    if (memory != NULL)
+        PyTraceMalloc_Untrack(TABLE_DOMAIN, (uintptr_t)memory);
+
+    PyMem_Free(memory);
+}
+
+/* Pointer hash families
+
+   hash_int() is whichever of these HASH_FAMILY picks at build time, e.g.
+   B_HASH_FAMILY=HASH_FIBONACCI ./setup.py build_ext.  Compare them on
+   real heap pointers with bench/hash.c before changing the default.
+*/
+
+#define HASH_JENKINS   0
+#define HASH_FIBONACCI 1
+#define HASH_ROTXOR    2
+
+#ifndef HASH_FAMILY
+#define HASH_FAMILY HASH_JENKINS
+#endif
+
+#define ROTR(x, n) (((x) >> (n)) | ((x) << (8 * sizeof(size_t) - (n))))
+
 /* http://burtleburtle.net/bob/hash/integer.html */
 static inline Py_hash_t
-hash_int(void* x)
+hash_jenkins(void* x)
 {
     Py_hash_t a = (Py_hash_t)x;
     a = (a+0x7ed55d16) + (a<<12);
@@ -21,4 +109,306 @@ hash_int(void* x)
     return a;
 }
 
+/* Drop the alignment bits and multiply by 2**N / phi.  The best mixed
+   bits of the product are its highest, so rotate them down to where H1
+   and H2 (below) read from. */
+static inline Py_hash_t
+hash_fibonacci(void* x)
+{
+#if SIZEOF_SIZE_T > 4
+    size_t a = ((size_t)x >> 4) * (size_t)0x9e3779b97f4a7c15ULL;
+#else
+    size_t a = ((size_t)x >> 4) * (size_t)0x9e3779b9UL;
+#endif
+    return (Py_hash_t)ROTR(a, 4 * sizeof(size_t));
+}
+
+/* Drop the alignment bits, then xor in the low bits raised past H2, so
+   neighbouring objects land in different groups, and the page bits
+   lowered, so objects at the same page offset get different tags. */
+static inline Py_hash_t
+hash_rotxor(void* x)
+{
+    size_t a = ROTR((size_t)x, 4);
+    return (Py_hash_t)(a ^ ROTR(a, 8 * sizeof(size_t) - 7) ^ ROTR(a, 8));
+}
+
+static inline Py_hash_t
+hash_int(void* x)
+{
+#if HASH_FAMILY == HASH_FIBONACCI
+    return hash_fibonacci(x);
+#elif HASH_FAMILY == HASH_ROTXOR
+    return hash_rotxor(x);
+#else
+    return hash_jenkins(x);
+#endif
+}
+
+/* Control bytes
+
+   One per slot, probed a group of GROUP_WIDTH at a time.  A full slot
+   keeps the low 7 bits of its key's hash (H2), so nearly every slot that
+   can't match is ruled out without loading it.  The rest of the hash
+   (H1) picks the first group; the probe then steps over whole groups,
+   and stops at the first group with an empty slot.
+
+   Tables must be a power of two of at least GROUP_WIDTH slots.
+*/
+
+#define GROUP_WIDTH 16
+
+#define CTRL_EMPTY   ((int8_t)-128)
+#define CTRL_DELETED ((int8_t)-2)
+
+#define H1(hash) ((size_t)(hash) >> 7)
+#define H2(hash) ((int8_t)((hash) & 0x7f))
+
+/* Triangular steps over a power-of-two number of groups visit them all. */
+#define NEXT_GROUP(group, step, gmask) (((group) + (step)) & (gmask))
+
+/* Bit `i` set for each slot `i` of the group that qualifies. */
+typedef unsigned int Bitmask;
+
+static inline int
+bitmask_lowest(Bitmask mask)
+{
+#if defined(__GNUC__)
+    return __builtin_ctz(mask);
+#else
+    int i = 0;
+    while (!(mask & 1)) {
+        mask >>= 1;
+        i++;
+    }
+    return i;
+#endif
+}
+
+#define BITMASK_NEXT(mask) ((mask) & ((mask) - 1))
+
+/* Hint that `address` is about to be read, e.g. the home group of a key
+   looked up a few keys from now */
+#if defined(__GNUC__)
+#define PREFETCH(address) __builtin_prefetch((address), 0, 1)
+#else
+#define PREFETCH(address) ((void)(address))
+#endif
+
+/* Full slots whose tag is `h2` */
+static inline Bitmask
+group_match(const int8_t *group, int8_t h2)
+{
+#ifdef __SSE2__
+    __m128i ctrl = _mm_loadu_si128((const __m128i *)group);
+    return (Bitmask)_mm_movemask_epi8(_mm_cmpeq_epi8(ctrl, _mm_set1_epi8(h2)));
+#else
+    Bitmask mask = 0;
+    int i;
+    for (i = 0; i < GROUP_WIDTH; i++)
+        mask |= (Bitmask)(group[i] == h2) << i;
+    return mask;
+#endif
+}
+
+/* Empty slots; any at all end the probe */
+static inline Bitmask
+group_match_empty(const int8_t *group)
+{
+#ifdef __SSE2__
+    __m128i ctrl = _mm_loadu_si128((const __m128i *)group);
+    return (Bitmask)_mm_movemask_epi8(_mm_cmpeq_epi8(ctrl, _mm_set1_epi8(CTRL_EMPTY)));
+#else
+    Bitmask mask = 0;
+    int i;
+    for (i = 0; i < GROUP_WIDTH; i++)
+        mask |= (Bitmask)(group[i] == CTRL_EMPTY) << i;
+    return mask;
+#endif
+}
+
+/* Empty or deleted slots, i.e. those with the sign bit set */
+static inline Bitmask
+group_match_free(const int8_t *group)
+{
+#ifdef __SSE2__
+    return (Bitmask)_mm_movemask_epi8(_mm_loadu_si128((const __m128i *)group));
+#else
+    Bitmask mask = 0;
+    int i;
+    for (i = 0; i < GROUP_WIDTH; i++)
+        mask |= (Bitmask)(group[i] < 0) << i;
+    return mask;
+#endif
+}
+
+/* Tables of bare slots
+
+   Those whose slots hold their keys, rather than an index to an entry as
+   IdentityDict's do, share the probe: GROUP_LOOKUP() to find a key,
+   group_find_free() for where to put one.
+*/
+
+/* Set `slot` to the full slot `i` of `ctrl`, of `size` slots, tagged for
+   `hash` and with IS_KEY(i), else to -1; and `groups` to the groups
+   probed, for STATS_LOOKUP() */
+#define GROUP_LOOKUP(slot, ctrl, size, hash, groups, IS_KEY) \
+    do { \
+        size_t gmask_ = (size_t)(size) / GROUP_WIDTH - 1; \
+        size_t group_ = H1(hash) & gmask_; \
+        int8_t h2_ = H2(hash); \
+        Bitmask match_; \
+        size_t i_; \
+        \
+        (slot) = -1; \
+        for ((groups) = 1; ; (groups)++) { \
+            for (match_ = group_match(&(ctrl)[group_ * GROUP_WIDTH], h2_); match_; match_ = BITMASK_NEXT(match_)) { \
+                i_ = group_ * GROUP_WIDTH + bitmask_lowest(match_); \
+                if (IS_KEY(i_)) { \
+                    (slot) = (Py_ssize_t)i_; \
+                    break; \
+                } \
+            } \
+            if ((slot) >= 0 || group_match_empty(&(ctrl)[group_ * GROUP_WIDTH])) \
+                break; \
+            group_ = NEXT_GROUP(group_, (groups), gmask_); \
+        } \
+    } while (0)
+
+/* First empty or deleted slot along the probe for `hash` */
+static inline size_t
+group_find_free(const int8_t *ctrl, Py_ssize_t size, Py_hash_t hash)
+{
+    register size_t group;
+    register size_t step;
+    register size_t gmask;
+    register Bitmask match;
+
+    gmask = size / GROUP_WIDTH - 1;
+
+    group = H1(hash) & gmask;
+
+    for (step = 1; ; step++) {
+        match = group_match_free(&ctrl[group * GROUP_WIDTH]);
+
+        if (match)
+            return group * GROUP_WIDTH + bitmask_lowest(match);
+
+        group = NEXT_GROUP(group, step, gmask);
+    }
+}
+
+/* Table statistics
+
+   Kept only with TABLE_STATS defined, e.g. B_STATS=1 ./setup.py build_ext,
+   for the `_stats()` of the tables that keep them.  Otherwise the
+   STATS_*() macros are empty, and `_stats()` is left out.
+*/
+
+#ifdef TABLE_STATS
+
+/* The grow clock: the public PyTime API from 3.13, which drops the
+   private one */
+#if PY_VERSION_HEX >= 0x030D0000
+typedef PyTime_t StatsTime;
+
+static inline StatsTime
+stats_clock(void)
+{
+    PyTime_t now = 0;
+    (void)PyTime_PerfCounterRaw(&now);
+    return now;
+}
+
+#define stats_seconds(time) PyTime_AsSecondsDouble(time)
+#else
+typedef _PyTime_t StatsTime;
+
+#define stats_clock() _PyTime_GetPerfCounter()
+#define stats_seconds(time) _PyTime_AsSecondsDouble(time)
+#endif
+
+/* [n] counts lookups that probed n + 1 groups, the last also all longer */
+#define STATS_MAX_PROBE 8
+
+typedef struct {
+    size_t hits[STATS_MAX_PROBE];
+    size_t misses[STATS_MAX_PROBE];
+    size_t grows;
+    StatsTime grow_time;
+} TableStats;
+
+#define STATS_CLEAR(stats) memset((stats), 0, sizeof(TableStats))
+
+#define STATS_LOOKUP(stats, hit, groups) \
+    ((hit) ? (stats)->hits : (stats)->misses) \
+        [(groups) < STATS_MAX_PROBE ? (groups) - 1 : STATS_MAX_PROBE - 1]++
+
+#define STATS_GROW_BEGIN(start) StatsTime start = stats_clock()
+
+#define STATS_GROW_END(stats, start) \
+    ((stats)->grows++, (stats)->grow_time += stats_clock() - (start))
+
+static PyObject *
+stats_histogram(const size_t *counts)
+{
+    PyObject *list = PyList_New(STATS_MAX_PROBE);
+    PyObject *count;
+    int i;
+
+    if (list == NULL)
+        return NULL;
+
+    for (i = 0; i < STATS_MAX_PROBE; i++) {
+        count = PyLong_FromSize_t(counts[i]);
+        if (count == NULL) {
+            Py_DECREF(list);
+            return NULL;
+        }
+
+        PyList_SET_ITEM(list, i, count);
+    }
+
+    return list;
+}
+
+/* The `_stats()` of a table of `slots`, `used` of them live and `deleted`
+   awaiting reuse.  Its "load" is used / slots, 0 for an inline table,
+   which has no slots. */
+static PyObject *
+stats_dict(const TableStats *stats, Py_ssize_t slots, Py_ssize_t used,
+           Py_ssize_t deleted)
+{
+    PyObject *hits, *misses;
+
+    hits = stats_histogram(stats->hits);
+    if (hits == NULL)
+        return NULL;
+
+    misses = stats_histogram(stats->misses);
+    if (misses == NULL) {
+        Py_DECREF(hits);
+        return NULL;
+    }
+
+    return Py_BuildValue("{sNsNsnsdsnsnsdsn}",
+                         "hits", hits,
+                         "misses", misses,
+                         "grows", (Py_ssize_t)stats->grows,
+                         "grow_seconds", stats_seconds(stats->grow_time),
+                         "slots", slots,
+                         "used", used,
+                         "load", slots > 0 ? (double)used / slots : 0.0,
+                         "tombstones", deleted);
+}
+
+#else
+
+#define STATS_CLEAR(stats)
+#define STATS_LOOKUP(stats, hit, groups)
+#define STATS_GROW_BEGIN(start)
+#define STATS_GROW_END(stats, start)
+
+#endif
+
 #endif
@@ -7,6 +7,37 @@ from distutils.core import setup, Extension
 import os
 os.environ['CFLAGS'] = '-Wno-unused-result'
 
+# Pointer hash family for the identity tables, see include/hash.h
+hash_macros = []
+if 'B_HASH_FAMILY' in os.environ:
+    hash_macros.append(('HASH_FAMILY', os.environ['B_HASH_FAMILY']))
+
+# Probe and growth statistics, `_stats()`, see include/hash.h
+if os.environ.get('B_STATS'):
+    hash_macros.append(('TABLE_STATS', '1'))
+
+# IdentityDict free list cap, see src/collections.c
+collections_macros = list(hash_macros)
+if 'B_FREELIST' in os.environ:
+    collections_macros.append(('IDENTITYDICT_MAXFREELIST', os.environ['B_FREELIST']))
+
+# IdentityDict inline table size, see src/collections.c
+if 'B_SMALL' in os.environ:
+    collections_macros.append(('IDENTITYDICT_SMALL', os.environ['B_SMALL']))
+
+# IdentityDict probing engine, see src/collections.c
+if 'B_ENGINE' in os.environ:
+    collections_macros.append(('TABLE_ENGINE', os.environ['B_ENGINE']))
+
+# IdentityDict entry layout, see src/collections.c
+if 'B_LAYOUT' in os.environ:
+    collections_macros.append(('TABLE_LAYOUT', os.environ['B_LAYOUT']))
+
+# PersistentIdentityMap key hash, see src/collections.c, e.g. B_HAMT_HASH=0
+# to run its tests with every key in one collision node
+if 'B_HAMT_HASH' in os.environ:
+    collections_macros.append(('HAMT_HASH(key)', os.environ['B_HAMT_HASH']))
+
 setup(
     name = 'lazy',
     version = '1.0',
@@ -17,6 +48,7 @@ setup(
             include_dirs = [
                 'include',
             ],
+            define_macros = collections_macros,
             sources = [
                 'src/collections.c',
             ],
@@ -47,6 +79,7 @@ setup(
             include_dirs = [
                 'include',
             ],
+            define_macros = hash_macros,
             sources = [
                 'src/types.c',
             ],
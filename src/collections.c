@@ -1,24 +1,170 @@
 #include "Python.h"
 
+#include <stddef.h>
+
 #include "hash.h"
 
 #define INITIAL_SIZE 16
 
+#if INITIAL_SIZE < GROUP_WIDTH
+#error "INITIAL_SIZE must hold at least one group"
+#endif
+
+/* How many freed IdentityDicts, and tables of INITIAL_SIZE, to keep for
+   reuse, e.g. B_FREELIST=0 ./setup.py build_ext to keep none. */
+#ifndef IDENTITYDICT_MAXFREELIST
+#define IDENTITYDICT_MAXFREELIST 80
+#endif
+
+/* Without the GIL, nothing would guard the lists: keep none. */
+#ifdef Py_GIL_DISABLED
+#undef IDENTITYDICT_MAXFREELIST
+#define IDENTITYDICT_MAXFREELIST 0
+#endif
+
+/* How many entries an IdentityDict keeps inline, before it needs a table
+   of its own, e.g. B_SMALL=4 ./setup.py build_ext. */
+#ifndef IDENTITYDICT_SMALL
+#define IDENTITYDICT_SMALL 8
+#endif
+
+#if IDENTITYDICT_SMALL < 1
+#error "IDENTITYDICT_SMALL must be at least 1"
+#endif
+
+/* How IdentityDict tables probe, e.g. B_ENGINE=ENGINE_ROBIN_HOOD
+   ./setup.py build_ext.  Compare them with bench/engine.c. */
+#define ENGINE_GROUPS     0
+#define ENGINE_ROBIN_HOOD 1
+
+#ifndef TABLE_ENGINE
+#define TABLE_ENGINE ENGINE_GROUPS
+#endif
+
+/* How IdentityDict tables lay out their entries, e.g. B_LAYOUT=LAYOUT_SPLIT
+   ./setup.py build_ext: as key, value pairs, or as all the keys and then
+   all the values, so probing only ever loads keys. */
+#define LAYOUT_PAIRS 0
+#define LAYOUT_SPLIT 1
+
+#ifndef TABLE_LAYOUT
+#define TABLE_LAYOUT LAYOUT_PAIRS
+#endif
+
 typedef struct {
     PyObject *key;
     PyObject *value;
 } Entry;
 
+/* Returned by `lookup()` for a missing key */
+#define IX_EMPTY (-1)
+
+/* One allocation: `size` control bytes (see hash.h), then as many index
+   slots, each as narrow as the entry positions they hold allow, then the
+   entries themselves, densely and in insertion order.  Deleted entries
+   are left as NULL keys, and their slots as CTRL_DELETED, until
+   `compact()`.
+
+   Under LAYOUT_SPLIT the entries are two arrays of TABLE_CAPACITY(), the
+   keys then the values.  Either way, get at them with ENTRY_KEY() and
+   ENTRY_VALUE().
+
+   Under ENGINE_ROBIN_HOOD the control byte of a full slot is instead
+   how far it is from its key's home slot, H1(hash), probed linearly; see
+   `put_slot()`.  Deleting shifts the slots after back, so there are no
+   CTRL_DELETED slots, only the deleted entries. */
+typedef struct {
+    Py_ssize_t size;
+    Py_ssize_t usable;
+    Py_ssize_t nentries;
+    int8_t ctrl[1];
+} Table;
+
+#if SIZEOF_VOID_P > 4
+#define INDEX_WIDTH(size) \
+    ((size) <= 0x80 ? 1 : (size) <= 0x8000 ? 2 : (size) <= 0x80000000 ? 4 : 8)
+#else
+#define INDEX_WIDTH(size) \
+    ((size) <= 0x80 ? 1 : (size) <= 0x8000 ? 2 : 4)
+#endif
+
+#define TABLE_INDICES(table) \
+    ((char *)&(table)->ctrl[(table)->size])
+
+#define TABLE_ENTRIES(table) \
+    ((Entry *)&TABLE_INDICES(table)[(table)->size * INDEX_WIDTH((table)->size)])
+
+#if TABLE_LAYOUT == LAYOUT_SPLIT
+#define ENTRY_KEY(table, ix) \
+    (((PyObject **)TABLE_ENTRIES(table))[ix])
+#define ENTRY_VALUE(table, ix) \
+    (((PyObject **)TABLE_ENTRIES(table))[TABLE_CAPACITY(table) + (ix)])
+#else
+#define ENTRY_KEY(table, ix)   (TABLE_ENTRIES(table)[ix].key)
+#define ENTRY_VALUE(table, ix) (TABLE_ENTRIES(table)[ix].value)
+#endif
+
+/* A table of no slots, so no control bytes or index: the layout of Table
+   leaves its entries right after the header, searched linearly.  Each
+   IdentityDict has one inline, used until it holds more than
+   IDENTITYDICT_SMALL keys. */
 typedef struct {
-    PyObject_HEAD
     Py_ssize_t size;
     Py_ssize_t usable;
-    Entry (*entries)[1];
+    Py_ssize_t nentries;
+#if TABLE_LAYOUT == LAYOUT_SPLIT
+    PyObject *entries[2 * IDENTITYDICT_SMALL];
+#else
+    Entry entries[IDENTITYDICT_SMALL];
+#endif
+} SmallTable;
+
+#define IS_SMALL(table) ((table)->size == 0)
+
+/* Entries a table holds in all, deleted ones included */
+#define TABLE_CAPACITY(table) ((table)->usable + (table)->nentries)
+
+/* `table` is either `small`, or on the heap.  Then it may be shared,
+   copy-on-write, with snapshots: then `shared` is the SharedTable that
+   owns it, and UNSHARE() must come before changing it. */
+typedef struct {
+    PyObject_HEAD
+    Py_ssize_t used;
+    Table *table;
+    PyObject *shared;
+    /* Bumped whenever entries are added or move, so that a slot found
+       before calling out still holds after if this hasn't changed */
+    Py_ssize_t version;
+    /* Tables fill to `max_load` (see hash.h), then grow `growth_factor`
+       times over, and shrink once deletions leave less than `min_load` of
+       the slots used */
+    double max_load;
+    Py_ssize_t growth_factor;
+    double min_load;
+#ifdef TABLE_STATS
+    TableStats stats;
+#endif
+    SmallTable small;
 } IdentityDict;
 
+#define SMALL_TABLE(this) ((Table *)&(this)->small)
+
+typedef struct {
+    PyObject_HEAD
+    Table *table;
+} SharedTable;
+
+#define UNSHARE(this) ((this)->shared == NULL ? 0 : unshare_table(this))
+
 /* Forward */
 
-static int grow(IdentityDict *this);
+static int resize(IdentityDict *this, Py_ssize_t new_size);
+static void compact(IdentityDict *this);
+static int reserve(IdentityDict *this, Py_ssize_t n);
+static int unshare_table(IdentityDict *this);
+
+static PyTypeObject IdentityDict_type;
+static PyTypeObject SharedTable_type;
 
 static PyTypeObject IdentityDictKeys_type;
 static PyTypeObject IdentityDictItems_type;
@@ -31,1085 +177,6883 @@ static PyTypeObject IdentityDictValuesIterator_type;
 static PyObject * IdentityDictIterator_new(PyTypeObject *type, IdentityDict *dict);
 static PyObject * IdentityDictView_new(PyTypeObject *type, IdentityDict *dict);
 
-/* IdentityDict */
+/* Table */
 
-PyDoc_STRVAR(IdentityDict__doc__,
-"TODO IdentityDict.__doc__");
+static inline Py_ssize_t
+get_index(Table *table, size_t i)
+{
+    Py_ssize_t size = table->size;
+
+    if (size <= 0x80)
+        return ((int8_t *)TABLE_INDICES(table))[i];
+    if (size <= 0x8000)
+        return ((int16_t *)TABLE_INDICES(table))[i];
+#if SIZEOF_VOID_P > 4
+    if (size <= 0x80000000)
+        return ((int32_t *)TABLE_INDICES(table))[i];
+    return ((int64_t *)TABLE_INDICES(table))[i];
+#else
+    return ((int32_t *)TABLE_INDICES(table))[i];
+#endif
+}
 
-static PyObject *
-IdentityDict__new__(PyTypeObject *type, PyObject *args, PyObject *kwargs)
+static inline void
+set_index(Table *table, size_t i, Py_ssize_t ix)
 {
-    PyObject *self = type->tp_alloc(type, 0);
-    if (self == NULL)
-        return NULL;
+    Py_ssize_t size = table->size;
+
+    if (size <= 0x80)
+        ((int8_t *)TABLE_INDICES(table))[i] = (int8_t)ix;
+    else if (size <= 0x8000)
+        ((int16_t *)TABLE_INDICES(table))[i] = (int16_t)ix;
+#if SIZEOF_VOID_P > 4
+    else if (size <= 0x80000000)
+        ((int32_t *)TABLE_INDICES(table))[i] = (int32_t)ix;
+    else
+        ((int64_t *)TABLE_INDICES(table))[i] = (int64_t)ix;
+#else
+    else
+        ((int32_t *)TABLE_INDICES(table))[i] = (int32_t)ix;
+#endif
+}
 
+/* Smallest table that holds `n` entries at `max_load` */
+static Py_ssize_t
+size_for(Py_ssize_t n, double max_load)
+{
     Py_ssize_t size = INITIAL_SIZE;
-    Entry (*entries)[1];
-
-    entries = PyMem_Malloc(size * sizeof(Entry));
-    if (entries == NULL)
-        return NULL;
 
-    Entry *entry_0 = (Entry *)&entries[0];
+    while (usable_at(size, max_load) < n) {
+        if (size > PY_SSIZE_T_MAX / (2 * (Py_ssize_t)(1 + 8 + sizeof(Entry)))) {
+            PyErr_NoMemory();
+            return -1;
+        }
 
-    Py_ssize_t i;
-    for (i = 0; i < size; i++) {
-        entry_0[i].key = NULL;
-        entry_0[i].value = NULL;
+        size <<= 1;
     }
 
-    ((IdentityDict *)self)->entries = entries;
-    ((IdentityDict *)self)->size = size;
-    ((IdentityDict *)self)->usable = USABLE(size);
-
-    return self;
+    return size;
 }
 
-static void
-IdentityDict__del__(PyObject *self)
+/* Bytes up to the entries of a table of `size` slots */
+#define TABLE_HEAD_SIZE(size) \
+    (offsetof(Table, ctrl) + (size) + (size) * INDEX_WIDTH(size))
+
+#if IDENTITYDICT_MAXFREELIST > 0
+static Table *free_tables[IDENTITYDICT_MAXFREELIST];
+static int num_free_tables = 0;
+#endif
+
+/* Only tables of INITIAL_SIZE at the default load are kept for reuse */
+#define TABLE_REUSABLE(size, capacity) \
+    ((size) == INITIAL_SIZE && (capacity) == USABLE(INITIAL_SIZE))
+
+/* Memory for a table of `size` slots and `capacity` entries, for the
+   caller to fill in */
+static Table *
+Table_alloc(Py_ssize_t size, Py_ssize_t capacity)
 {
-    IdentityDict *this = (IdentityDict *)self;
+    Table *table;
 
-    register Py_ssize_t i;
-    register Py_ssize_t size = this->size;
+#if IDENTITYDICT_MAXFREELIST > 0
+    if (TABLE_REUSABLE(size, capacity) && num_free_tables > 0)
+        return free_tables[--num_free_tables];
+#endif
+
+    table = table_malloc(TABLE_HEAD_SIZE(size) + capacity * sizeof(Entry));
+    if (table == NULL)
+        PyErr_NoMemory();
 
-    Entry *entry_0 = (Entry *)&this->entries[0];
+    return table;
+}
 
-    for (i = 0; i < size; i++) {
-        Py_XDECREF(entry_0[i].key);
-        Py_XDECREF(entry_0[i].value);
+/* Free `table`, or keep it for reuse */
+static void
+Table_release(Table *table)
+{
+    /* Inline in its dict */
+    if (IS_SMALL(table))
+        return;
+
+#if IDENTITYDICT_MAXFREELIST > 0
+    if (TABLE_REUSABLE(table->size, TABLE_CAPACITY(table)) && num_free_tables < IDENTITYDICT_MAXFREELIST) {
+        free_tables[num_free_tables++] = table;
+        return;
     }
+#endif
 
-    Py_TYPE(self)->tp_free(self);
+    table_free(table);
 }
 
-static PyObject *
-IdentityDict__getitem__(PyObject *self, PyObject *key)
+static Table *
+Table_new(Py_ssize_t size, Py_ssize_t capacity)
 {
-    IdentityDict *this = (IdentityDict *)self;
-
-    PyObject *value;
+    Table *table = Table_alloc(size, capacity);
+    if (table == NULL)
+        return NULL;
 
-    register size_t i;
-    register size_t perturb;
-    register size_t mask;
-    register Entry *entry;
-    Entry *entry_0; // register-ing this slows by 33%
-    Py_hash_t hash;
+    table->size = size;
+    table->usable = capacity;
+    table->nentries = 0;
 
-    entry_0 = (Entry *)&this->entries[0];
+    memset(table->ctrl, CTRL_EMPTY, size);
 
-    mask = this->size - 1;
+    return table;
+}
 
-    hash = hash_int(key);
+/* Fill in the SmallTable at `table` */
+static Table *
+Table_init_small(Table *table)
+{
+    Py_BUILD_ASSERT(offsetof(SmallTable, entries) == offsetof(Table, ctrl));
 
-    i = hash & mask;
+    table->size = 0;
+    table->usable = IDENTITYDICT_SMALL;
+    table->nentries = 0;
 
-    entry = &entry_0[i];
+    return table;
+}
 
-    if (entry->key == key) {
-        value = entry->value;
-        Py_INCREF(value);
-        return value;
+/* Copy `table` over `copy`, the same size, with new references to all
+   its items */
+static void
+Table_copy_to(Table *copy, Table *table)
+{
+    Py_ssize_t i, nentries = table->nentries;
+
+#if TABLE_LAYOUT == LAYOUT_SPLIT
+    memcpy(copy, table, TABLE_HEAD_SIZE(table->size) + nentries * sizeof(PyObject *));
+    memcpy(&ENTRY_VALUE(copy, 0), &ENTRY_VALUE(table, 0), nentries * sizeof(PyObject *));
+#else
+    memcpy(copy, table, TABLE_HEAD_SIZE(table->size) + nentries * sizeof(Entry));
+#endif
+
+    for (i = 0; i < nentries; i++) {
+        if (ENTRY_KEY(copy, i) != NULL) {
+            Py_INCREF(ENTRY_KEY(copy, i));
+            Py_INCREF(ENTRY_VALUE(copy, i));
+        }
     }
+}
 
-    if (entry->key == NULL)
-        goto missing;
+/* A copy of heap `table`, with new references to all its items */
+static Table *
+Table_copy(Table *table)
+{
+    Table *copy = Table_alloc(table->size, TABLE_CAPACITY(table));
+    if (copy == NULL)
+        return NULL;
 
-    for (perturb = hash; ; perturb >>= PERTURB_SHIFT) {
-        i = (i << 2) + i + perturb + 1;
+    Table_copy_to(copy, table);
 
-        entry = &entry_0[i & mask];
+    return copy;
+}
 
-        if (entry->key == key) {
-            value = entry->value;
-            Py_INCREF(value);
-            return value;
-        }
+/* Drop the references held by `table`, then free it */
+static void
+Table_free(Table *table)
+{
+    register Py_ssize_t i;
+    register Py_ssize_t nentries = table->nentries;
 
-        if (entry->key == NULL)
-            goto missing;
+    for (i = 0; i < nentries; i++) {
+        if (ENTRY_KEY(table, i) != NULL) {
+            Py_DECREF(ENTRY_KEY(table, i));
+            Py_DECREF(ENTRY_VALUE(table, i));
+        }
     }
 
-  missing:
-    PyErr_SetString(PyExc_NotImplementedError, "__missing__");
-    return NULL;
+    Table_release(table);
 }
 
-static int
-IdentityDict__setitem__(PyObject *self, PyObject *key, PyObject *value)
+#if TABLE_ENGINE == ENGINE_ROBIN_HOOD
+
+/* How far a slot is from its key's home slot, as its control byte holds
+   it: exactly, short of RH_MAX_DISTANCE, which stands for all further.
+
+   Each slot along a key's probe, up to the key's own, is at least as far
+   from home as the probe has come, so a probe stops at the first slot
+   nearer home than that. */
+#define RH_MAX_DISTANCE 127
+#define RH_DISTANCE(distance) \
+    ((int8_t)((distance) < RH_MAX_DISTANCE ? (distance) : RH_MAX_DISTANCE))
+
+/* How far full `slot` is from home, exactly */
+static inline size_t
+home_distance(Table *table, size_t slot)
 {
-    IdentityDict *this = (IdentityDict *)self;
+    Py_hash_t hash;
 
-    register size_t i;
-    register size_t perturb;
-    register size_t mask;
-    Entry *entry_0;
-    register Entry *entry;
+    if (table->ctrl[slot] < RH_MAX_DISTANCE)
+        return table->ctrl[slot];
 
-    Py_hash_t hash = hash_int(key);
+    hash = hash_int(ENTRY_KEY(table, get_index(table, slot)));
 
-    mask = this->size - 1;
+    return (slot - H1(hash)) & (table->size - 1);
+}
 
-    entry_0 = (Entry *)&this->entries[0];
+/* Where an entry for `hash`, known to be absent, goes */
+static inline size_t
+find_free_slot(Table *table, Py_hash_t hash)
+{
+    size_t mask = table->size - 1;
+    size_t i = H1(hash) & mask;
+    size_t step;
+    int8_t ctrl;
 
-    i = (size_t)hash & mask;
+    for (step = 0; ; step++) {
+        ctrl = table->ctrl[i];
 
-    entry = &entry_0[i];
+        if (ctrl < RH_DISTANCE(step))
+            return i;
 
-    if (entry->key == key)
-        goto found;
+        if (ctrl == RH_MAX_DISTANCE && step > RH_MAX_DISTANCE && home_distance(table, i) < step)
+            return i;
 
-    if (entry->key == NULL)
-        goto missing;
+        i = (i + 1) & mask;
+    }
+}
 
-    for (perturb = hash; ; perturb >>= PERTURB_SHIFT) {
-        i = (i << 2) + i + perturb + 1;
+/* Point `slot`, from `find_free_slot()` or a missed `lookup()`, at entry
+   `ix`.  What's there, and on up to the next empty slot, moves along one,
+   each time for whichever is nearer home to give way. */
+static inline void
+put_slot(Table *table, size_t slot, Py_hash_t hash, Py_ssize_t ix)
+{
+    size_t mask = table->size - 1;
+    size_t distance = (slot - H1(hash)) & mask;
+    size_t other_distance;
+    Py_ssize_t other;
+
+    for (;;) {
+        if (table->ctrl[slot] == CTRL_EMPTY) {
+            table->ctrl[slot] = RH_DISTANCE(distance);
+            set_index(table, slot, ix);
+            return;
+        }
 
-        entry = &entry_0[i & mask];
+        other_distance = distance > RH_MAX_DISTANCE
+            ? home_distance(table, slot)
+            : (size_t)table->ctrl[slot];
 
-        if (entry->key == key)
-            goto found;
+        if (other_distance < distance) {
+            other = get_index(table, slot);
 
-        if (entry->key == NULL)
-            goto missing;
-    }
+            table->ctrl[slot] = RH_DISTANCE(distance);
+            set_index(table, slot, ix);
 
-  missing:
-    if (value == NULL)
-        return -1;
+            distance = other_distance;
+            ix = other;
+        }
 
-    Py_INCREF(key);
-    Py_INCREF(value);
+        slot = (slot + 1) & mask;
+        distance++;
+    }
+}
 
-    entry->key = key;
-    entry->value = value;
+/* `lookup()` in a table of slots.  Counted by slots probed, not groups.
 
-    if (this->usable-- < 1)
-        if (grow(this) == -1)
-            return -1;
+   Only a slot as far from home as the probe is can be the key's. */
+static inline Py_ssize_t
+probe(IdentityDict *this, PyObject *key, Py_hash_t hash, size_t *slot)
+{
+    register size_t step;
+    register size_t i;
+    register Py_ssize_t ix;
 
-    return 0;
+    Table *table = this->table;
+    int8_t *ctrl = table->ctrl;
+    size_t mask = table->size - 1;
 
-  found:
-    if (value == NULL) {
-        entry->key = NULL;
-        entry->value = NULL;
+    i = H1(hash) & mask;
 
-        Py_DECREF(entry->key);
-        Py_DECREF(entry->value);
+    for (step = 0; ; step++) {
+        if (ctrl[i] == RH_DISTANCE(step)) {
+            ix = get_index(table, i);
 
-        this->usable++;
-    } else {
-        if (entry->key != key) {
-            Py_DECREF(entry->key);
-            Py_INCREF(key);
-            entry->key = key;
+            if (ENTRY_KEY(table, ix) == key) {
+                STATS_LOOKUP(&this->stats, 1, step + 1);
+                *slot = i;
+                return ix;
+            }
+        } else if (ctrl[i] < RH_DISTANCE(step)) {
+            STATS_LOOKUP(&this->stats, 0, step + 1);
+            /* So far out, the probe may have passed where the key goes */
+            *slot = step < RH_MAX_DISTANCE ? i : find_free_slot(table, hash);
+            return IX_EMPTY;
         }
 
-        Py_INCREF(value);
-
-        entry->value = value;
+        i = (i + 1) & mask;
     }
+}
 
-    return 0;
+/* Start loading the home slot of `hash`, for a `probe()` to come */
+static inline void
+prefetch_home(Table *table, Py_hash_t hash)
+{
+    size_t slot = H1(hash) & (table->size - 1);
+
+    PREFETCH(&table->ctrl[slot]);
+    PREFETCH(&TABLE_INDICES(table)[slot * INDEX_WIDTH(table->size)]);
 }
 
-static int
-IdentityDict__contains__(PyObject *self, PyObject *key)
+/* Then the entry in it, if full, the likeliest of `hash` */
+static inline void
+prefetch_entry(Table *table, Py_hash_t hash)
 {
-    IdentityDict *this = (IdentityDict *)self;
+    size_t slot = H1(hash) & (table->size - 1);
 
-    register size_t i;
-    register size_t perturb;
-    register Entry *entry;
-    register size_t mask;
+    if (table->ctrl[slot] >= 0)
+        PREFETCH(&ENTRY_KEY(table, get_index(table, slot)));
+}
 
-    Entry *entry_0;
-    Py_hash_t hash;
+/* Retire the slot `lookup()` found for an entry just deleted, shifting
+   back the slots after it that are away from home.  Those move, so this
+   counts as a change for `version`. */
+static inline void
+mark_deleted(IdentityDict *this, size_t slot)
+{
+    Table *table = this->table;
+    size_t mask = table->size - 1;
+    size_t next;
 
-    entry_0 = (Entry *)&this->entries[0];
+    if (IS_SMALL(table))
+        return;
 
-    mask = this->size - 1;
+    for (next = (slot + 1) & mask; table->ctrl[next] > 0; next = (next + 1) & mask) {
+        table->ctrl[slot] = RH_DISTANCE(home_distance(table, next) - 1);
+        set_index(table, slot, get_index(table, next));
 
-    hash = hash_int(key);
+        slot = next;
+    }
 
-    i = hash & mask;
+    table->ctrl[slot] = CTRL_EMPTY;
 
-    entry = &entry_0[i];
+    this->version++;
+}
 
-    if (entry->key == key)
-        return 1;
+#else
 
-    if (entry->key == NULL)
-        return 0;
+/* `lookup()` in a table of slots */
+static inline Py_ssize_t
+probe(IdentityDict *this, PyObject *key, Py_hash_t hash, size_t *slot)
+{
+    register size_t group;
+    register size_t step;
+    register size_t gmask;
+    register Bitmask match;
+    register size_t i;
+    register Py_ssize_t ix;
 
-    for (perturb = hash; ; perturb >>= PERTURB_SHIFT) {
-        i = (i << 2) + i + perturb + 1;
+    Table *table = this->table;
+    int8_t *ctrl = table->ctrl;
+    int8_t h2 = H2(hash);
 
-        entry = &entry_0[i & mask];
+    gmask = table->size / GROUP_WIDTH - 1;
 
-        if (entry->key == key)
-            return 1;
+    group = H1(hash) & gmask;
 
-        if (entry->key == NULL)
-            return 0;
-    }
+    for (step = 1; ; step++) {
+        for (match = group_match(&ctrl[group * GROUP_WIDTH], h2); match; match = BITMASK_NEXT(match)) {
+            i = group * GROUP_WIDTH + bitmask_lowest(match);
 
-    assert(0);
-    return -1;
+            ix = get_index(table, i);
+
+            if (ENTRY_KEY(table, ix) == key) {
+                STATS_LOOKUP(&this->stats, 1, step);
+                *slot = i;
+                return ix;
+            }
+        }
+
+        match = group_match_empty(&ctrl[group * GROUP_WIDTH]);
+        if (match) {
+            STATS_LOOKUP(&this->stats, 0, step);
+            *slot = group * GROUP_WIDTH + bitmask_lowest(match);
+            return IX_EMPTY;
+        }
+
+        group = NEXT_GROUP(group, step, gmask);
+    }
 }
 
-static Py_ssize_t
-IdentityDict__len__(PyObject *self)
+/* Start loading the home group of `hash`, for a `probe()` to come */
+static inline void
+prefetch_home(Table *table, Py_hash_t hash)
 {
-    IdentityDict *this = (IdentityDict *)self;
+    size_t slot = (H1(hash) & (table->size / GROUP_WIDTH - 1)) * GROUP_WIDTH;
 
-    return USABLE(this->size) - this->usable;
+    PREFETCH(&table->ctrl[slot]);
+    PREFETCH(&TABLE_INDICES(table)[slot * INDEX_WIDTH(table->size)]);
 }
 
-/* Forward */
-
-static PyObject *
-IdentityDict__iter__(PyObject *self)
+/* Then the entry of the first slot there tagged for `hash`, if any */
+static inline void
+prefetch_entry(Table *table, Py_hash_t hash)
 {
-    return IdentityDictIterator_new(
-        &IdentityDictKeysIterator_type,
-        (IdentityDict *)self
-        );
+    size_t slot = (H1(hash) & (table->size / GROUP_WIDTH - 1)) * GROUP_WIDTH;
+    Bitmask match = group_match(&table->ctrl[slot], H2(hash));
+
+    if (match)
+        PREFETCH(&ENTRY_KEY(table, get_index(table, slot + bitmask_lowest(match))));
 }
 
-static int
-grow(IdentityDict *this)
+/* Retire the slot `lookup()` found for an entry just deleted */
+static inline void
+mark_deleted(IdentityDict *this, size_t slot)
 {
-    Py_ssize_t old_size = this->size;
-    Py_ssize_t new_size = old_size * 2;
+    if (!IS_SMALL(this->table))
+        this->table->ctrl[slot] = CTRL_DELETED;
+}
 
-    Entry *old_entry_0;
-    Entry *new_entry_0;
+/* First empty or deleted slot along the probe for `hash` */
+static inline size_t
+find_free_slot(Table *table, Py_hash_t hash)
+{
+    return group_find_free(table->ctrl, table->size, hash);
+}
 
-    Entry (*old_entries)[old_size] = this->entries;
-    Entry (*new_entries)[new_size] = PyMem_Malloc(new_size * sizeof(Entry));
+/* Point free `slot` at entry `ix` */
+static inline void
+put_slot(Table *table, size_t slot, Py_hash_t hash, Py_ssize_t ix)
+{
+    table->ctrl[slot] = H2(hash);
+    set_index(table, slot, ix);
+}
 
-    register size_t i, j;
-    register size_t perturb;
-    register size_t mask;
-    register Entry *old_entry, *new_entry;
+#endif
 
-    Py_ssize_t new_usable = USABLE(new_size);
+/* Return the position of `key` in the entries, else IX_EMPTY.
 
-    PyObject *key;
-    Py_hash_t hash;
+   On a hit, `*slot` is left at the key's slot, for `mark_deleted()`; on a
+   miss, at a free slot along its probe, for `insert_at()`.
+*/
+static inline Py_ssize_t
+lookup(IdentityDict *this, PyObject *key, Py_hash_t hash, size_t *slot)
+{
+    Table *table = this->table;
+    Py_ssize_t ix;
+
+    /* Counted as probing one group */
+    if (IS_SMALL(table)) {
+        for (ix = 0; ix < table->nentries; ix++) {
+            if (ENTRY_KEY(table, ix) == key) {
+                STATS_LOOKUP(&this->stats, 1, 1);
+                *slot = ix;
+                return ix;
+            }
+        }
 
-    if (new_entries == NULL) {
-        PyErr_NoMemory();
-        return -1;
+        STATS_LOOKUP(&this->stats, 0, 1);
+        *slot = table->nentries;
+        return IX_EMPTY;
     }
 
-    old_entry_0 = (Entry *)&old_entries[0];
-    new_entry_0 = (Entry *)&new_entries[0];
+    return probe(this, key, hash, slot);
+}
 
-    for (j = 0; j < new_size; j++) {
-        new_entry_0[j].key = NULL;
-        new_entry_0[j].value = NULL;
-    }
+/* Append an entry for `key` in free `slot`, taking no references.  The
+   table must have room. */
+static inline void
+fill_slot(IdentityDict *this, size_t slot, PyObject *key, Py_hash_t hash, PyObject *value)
+{
+    Table *table = this->table;
 
-    mask = new_size - 1;
+    ENTRY_KEY(table, table->nentries) = key;
+    ENTRY_VALUE(table, table->nentries) = value;
 
-    for (i = 0; i < old_size; i++) {
-        old_entry = &old_entry_0[i];
+    if (!IS_SMALL(table))
+        put_slot(table, slot, hash, table->nentries);
 
-        key = old_entry->key;
+    table->nentries++;
+    table->usable--;
+    this->used++;
+    this->version++;
+}
 
-        if (key != NULL) {
-            new_usable--;
+/* `resize()` up, counted in the stats */
+static int
+grow(IdentityDict *this, Py_ssize_t new_size)
+{
+    STATS_GROW_BEGIN(start);
 
-            hash = hash_int(key);
+    if (resize(this, new_size) == -1)
+        return -1;
 
-            j = hash & mask;
+    STATS_GROW_END(&this->stats, start);
 
-            new_entry = &new_entry_0[j];
+    return 0;
+}
 
-            if (new_entry->key == NULL) {
-                new_entry->key   = key;
-                new_entry->value = old_entry->value;
-            } else {
-                for (perturb = hash; ; perturb >>= PERTURB_SHIFT) {
-                    j = (j << 2) + j + perturb + 1;
+/* Size for `this` to grow to: `growth_factor` times its table, and at
+   least enough for one more entry */
+static Py_ssize_t
+grow_size(IdentityDict *this)
+{
+    Table *table = this->table;
+    Py_ssize_t size = size_for(this->used + 1, this->max_load);
 
-                    new_entry = &new_entry_0[j & mask];
+    if (size == -1 || IS_SMALL(table))
+        return size;
 
-                    if (new_entry->key == NULL) {
-                        new_entry->key   = key;
-                        new_entry->value = old_entry->value;
-                        break;
-                    }
-                }
-            }
-        }
+    if (table->size > PY_SSIZE_T_MAX / (this->growth_factor * (Py_ssize_t)(1 + 8 + sizeof(Entry)))) {
+        PyErr_NoMemory();
+        return -1;
     }
 
-    PyMem_FREE(old_entries);
-
-    this->entries = new_entries;
-    this->size = new_size;
-    this->usable = new_usable;
-
-    return 0;
+    return Py_MAX(size, table->size * this->growth_factor);
 }
 
-/*[clinic]
-module IdentityDict
+/* After a delete: once under `min_load`, move to a table sized for twice
+   the entries left, so a few adds don't grow it straight back.  Deleting
+   never fails, so neither does this; without the memory, keep the table. */
+static void
+maybe_shrink(IdentityDict *this)
+{
+    Table *table = this->table;
+    Py_ssize_t size;
 
-IdentityDict.get
+    if (IS_SMALL(table) || !((double)this->used < table->size * this->min_load))
+        return;
 
-  key: object
-  default: object = NULL
-  /
+    size = this->used * 2 <= IDENTITYDICT_SMALL ? 0 : size_for(this->used * 2, this->max_load);
 
-self[key] if key in self, else default (which is None if not provided).
-[clinic]*/
+    if (size == -1 || (size < table->size && resize(this, size) == -1))
+        PyErr_Clear();
+}
 
-PyDoc_STRVAR(IdentityDict_get__doc__,
-"self[key] if key in self, else default (which is None if not provided).\n"
-"\n"
-"IdentityDict.get(key, default=None)");
+/* Append an entry for `key`, known to be absent, taking no references */
+static int
+append(IdentityDict *this, PyObject *key, Py_hash_t hash, PyObject *value)
+{
+    Table *table = this->table;
 
-#define IDENTITYDICT_GET_METHODDEF    \
-    {"get", (PyCFunction)IdentityDict_get, METH_VARARGS, IdentityDict_get__doc__},
+    Py_ssize_t size;
 
-static PyObject *
-IdentityDict_get_impl(PyObject *self, PyObject *key, PyObject *default_value);
+    if (table->usable <= 0) {
+        /* Deleted entries are at least half of them, or any at all of a
+           small table's: reclaim those. */
+        if (IS_SMALL(table) ? this->used < table->nentries : this->used * 2 <= table->nentries) {
+            compact(this);
+        } else {
+            size = grow_size(this);
+            if (size == -1 || grow(this, size) == -1)
+                return -1;
+        }
 
-static PyObject *
-IdentityDict_get(PyObject *self, PyObject *args)
-{
-    PyObject *return_value = NULL;
-    PyObject *key;
-    PyObject *default_value = NULL;
+        table = this->table;
+    }
 
-    if (!PyArg_ParseTuple(args,
-        "O|O:get",
-        &key, &default_value))
-        goto exit;
-    return_value = IdentityDict_get_impl(self, key, default_value);
+    fill_slot(this, IS_SMALL(table) ? 0 : find_free_slot(table, hash), key, hash, value);
 
-exit:
-    return return_value;
+    return 0;
 }
 
-static PyObject *
-IdentityDict_get_impl(PyObject *self, PyObject *key, PyObject *default_value)
-/*[clinic checksum: eeb64b68bb6f130ac11a4cbf38dad4932b3be342]*/
+/* Append an entry for `key`, known to be absent */
+static int
+insert(IdentityDict *this, PyObject *key, Py_hash_t hash, PyObject *value)
 {
-    PyObject *value;
+    if (append(this, key, hash, value) == -1)
+        return -1;
 
-    IdentityDict *this = (IdentityDict *)self;
+    Py_INCREF(key);
+    Py_INCREF(value);
 
-    register size_t i;
-    register size_t perturb;
-    register Entry *entry;
-    register size_t mask;
+    return 0;
+}
 
-    Entry *entry_0;
-    Py_hash_t hash;
+/* As `insert()`, into the `slot` a missed `lookup()` left, so without
+   probing again unless the table must grow first */
+static int
+insert_at(IdentityDict *this, size_t slot, PyObject *key, Py_hash_t hash, PyObject *value)
+{
+    if (this->table->usable <= 0)
+        return insert(this, key, hash, value);
 
-    entry_0 = (Entry *)&this->entries[0];
+    fill_slot(this, slot, key, hash, value);
 
-    mask = this->size - 1;
+    Py_INCREF(key);
+    Py_INCREF(value);
 
-    hash = hash_int(key);
+    return 0;
+}
 
-    i = hash & mask;
+/* IdentityDict */
 
-    entry = &entry_0[i];
+#if IDENTITYDICT_MAXFREELIST > 0
+static IdentityDict *free_dicts[IDENTITYDICT_MAXFREELIST];
+static int num_free_dicts = 0;
+#endif
 
-    if (entry->key == key) {
-        value = entry->value;
-        Py_INCREF(value);
-        return value;
-    }
+/* An untracked IdentityDict, not a subclass, for the caller to fill in */
+static IdentityDict *
+IdentityDict_alloc(void)
+{
+#if IDENTITYDICT_MAXFREELIST > 0
+    IdentityDict *this;
 
-    if (entry->key == NULL) {
-        value = default_value == NULL ? Py_None : default_value;
-        Py_INCREF(value);
-        return value;
+    if (num_free_dicts > 0) {
+        this = free_dicts[--num_free_dicts];
+        _Py_NewReference((PyObject *)this);
+        return this;
     }
+#endif
 
-    for (perturb = hash; ; perturb >>= PERTURB_SHIFT) {
-        i = (i << 2) + i + perturb + 1;
+    return PyObject_GC_New(IdentityDict, &IdentityDict_type);
+}
 
-        entry = &entry_0[i & mask];
+PyDoc_STRVAR(IdentityDict__doc__,
+"TODO IdentityDict.__doc__");
 
-        if (entry->key == key) {
-            value = entry->value;
-            Py_INCREF(value);
-            return value;
-        }
+/* The `min_load` that stands for the default: a quarter of the least
+   load growing leaves */
+#define MIN_LOAD_DEFAULT Py_NAN
 
-        if (entry->key == NULL) {
-            value = default_value == NULL ? Py_None : default_value;
-            Py_INCREF(value);
-            return value;
-        }
+/* 0 with `*min_load` made the default if it stands for it, else -1 with
+   ValueError set if out of range */
+static int
+check_min_load(double *min_load, double max_load, Py_ssize_t growth_factor)
+{
+    /* Shrinking leaves the table at least a quarter full, and growing half
+       again: at most half those, so neither undoes the other straight away */
+    if (Py_IS_NAN(*min_load)) {
+        *min_load = max_load / (4 * growth_factor);
+    } else if (!(*min_load >= 0.0 && *min_load <= max_load / (2 * growth_factor))) {
+        PyErr_SetString(PyExc_ValueError, "min_load must be from 0 to max_load / (2 * growth_factor)");
+        return -1;
     }
 
-    assert(0);
-    return NULL;
+    return 0;
 }
 
-/*[clinic]
-module IdentityDict
+/* An empty `type`, with room for `capacity` keys, and the given load
+   policy */
+static PyObject *
+IdentityDict_new(PyTypeObject *type, Py_ssize_t capacity,
+                 double max_load, Py_ssize_t growth_factor, double min_load)
+{
+    Py_ssize_t size;
+    Table *table;
 
-IdentityDict.setdefault
+    if (capacity < 0) {
+        PyErr_SetString(PyExc_ValueError, "IdentityDict() of a negative capacity");
+        return NULL;
+    }
 
-  key: object
-  default: object = NULL
-  /
+    if (check_load_policy(max_load, growth_factor) == -1 ||
+        check_min_load(&min_load, max_load, growth_factor) == -1)
+        return NULL;
 
-Return `self.get(key, default)` and assign `key` to `default` if absent.
-[clinic]*/
+    if (capacity > IDENTITYDICT_SMALL) {
+        size = size_for(capacity, max_load);
+        if (size == -1)
+            return NULL;
 
-PyDoc_STRVAR(IdentityDict_setdefault__doc__,
-"Return `self.get(key, default)` and assign `key` to `default` if absent.\n"
-"\n"
-"IdentityDict.setdefault(key, default=None)");
+        table = Table_new(size, usable_at(size, max_load));
+        if (table == NULL)
+            return NULL;
+    } else {
+        table = NULL;
+    }
 
-#define IDENTITYDICT_SETDEFAULT_METHODDEF    \
-    {"setdefault", (PyCFunction)IdentityDict_setdefault, METH_VARARGS, IdentityDict_setdefault__doc__},
+    PyObject *self = type == &IdentityDict_type
+        ? (PyObject *)IdentityDict_alloc()
+        : type->tp_alloc(type, 0);
 
-static PyObject *
-IdentityDict_setdefault_impl(PyObject *self, PyObject *key, PyObject *default_value);
+    if (self == NULL) {
+        if (table != NULL)
+            Table_release(table);
+        return NULL;
+    }
 
-static PyObject *
-IdentityDict_setdefault(PyObject *self, PyObject *args)
-{
-    PyObject *return_value = NULL;
-    PyObject *key;
-    PyObject *default_value = NULL;
+    if (table == NULL)
+        table = Table_init_small(SMALL_TABLE((IdentityDict *)self));
 
-    if (!PyArg_ParseTuple(args,
-        "O|O:setdefault",
-        &key, &default_value))
-        goto exit;
-    return_value = IdentityDict_setdefault_impl(self, key, default_value);
+    ((IdentityDict *)self)->table = table;
+    ((IdentityDict *)self)->used = 0;
+    ((IdentityDict *)self)->shared = NULL;
+    ((IdentityDict *)self)->version = 0;
+    ((IdentityDict *)self)->max_load = max_load;
+    ((IdentityDict *)self)->growth_factor = growth_factor;
+    ((IdentityDict *)self)->min_load = min_load;
 
-exit:
-    return return_value;
+    STATS_CLEAR(&((IdentityDict *)self)->stats);
+
+    if (type == &IdentityDict_type)
+        PyObject_GC_Track(self);
+
+    return self;
 }
 
 static PyObject *
-IdentityDict_setdefault_impl(PyObject *self, PyObject *key, PyObject *default_value)
-/*[clinic checksum: 18f699c16ff10235b7b6fc860d29fd73ee7029df]*/
+IdentityDict__new__(PyTypeObject *type, PyObject *args, PyObject *kwargs)
 {
-    PyErr_SetString(PyExc_NotImplementedError, "IdentityDict.setdefault");
-    return NULL;
-}
+    static char *kwlist[] = {"capacity", "max_load", "growth_factor", "min_load", NULL};
 
-/*[clinic]
-module IdentityDict
+    Py_ssize_t capacity = 0;
+    double max_load = DEFAULT_MAX_LOAD;
+    Py_ssize_t growth_factor = DEFAULT_GROWTH_FACTOR;
+    double min_load = MIN_LOAD_DEFAULT;
 
-IdentityDict.pop
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "|$ndnd:IdentityDict", kwlist,
+                                     &capacity, &max_load, &growth_factor, &min_load))
+        return NULL;
 
-  key: object
-  default: object = NULL
-  /
+    return IdentityDict_new(type, capacity, max_load, growth_factor, min_load);
+}
 
-Remove a specified key and return its corresponding value.
+static void
+IdentityDict__del__(PyObject *self)
+{
+    IdentityDict *this = (IdentityDict *)self;
 
-If absent and `default` is provided, return `default`.
-If absent and `default` is NOT provided, raise `KeyError`.
-[clinic]*/
+    PyObject_GC_UnTrack(self);
+    Py_TRASHCAN_BEGIN(self, IdentityDict__del__)
 
-PyDoc_STRVAR(IdentityDict_pop__doc__,
-"Remove a specified key and return its corresponding value.\n"
-"\n"
-"IdentityDict.pop(key, default=None)\n"
-"\n"
-"If absent and `default` is provided, return `default`.\n"
-"If absent and `default` is NOT provided, raise `KeyError`.");
+    if (this->shared != NULL)
+        Py_DECREF(this->shared);
+    else
+        Table_free(this->table);
 
-#define IDENTITYDICT_POP_METHODDEF    \
-    {"pop", (PyCFunction)IdentityDict_pop, METH_VARARGS, IdentityDict_pop__doc__},
+#if IDENTITYDICT_MAXFREELIST > 0
+    if (Py_TYPE(self) == &IdentityDict_type && num_free_dicts < IDENTITYDICT_MAXFREELIST)
+        free_dicts[num_free_dicts++] = this;
+    else
+#endif
+        Py_TYPE(self)->tp_free(self);
 
-static PyObject *
-IdentityDict_pop_impl(PyObject *self, PyObject *key, PyObject *default_value);
+    Py_TRASHCAN_END
+}
 
-static PyObject *
-IdentityDict_pop(PyObject *self, PyObject *args)
+static int
+IdentityDict__traverse__(PyObject *self, visitproc visit, void *arg)
 {
-    PyObject *return_value = NULL;
-    PyObject *key;
-    PyObject *default_value = NULL;
+    IdentityDict *this = (IdentityDict *)self;
+    Table *table = this->table;
+
+    Py_ssize_t i, nentries;
+
+    /* Its items are the SharedTable's to visit, once. */
+    if (this->shared != NULL) {
+        Py_VISIT(this->shared);
+        return 0;
+    }
 
-    if (!PyArg_ParseTuple(args,
-        "O|O:pop",
-        &key, &default_value))
-        goto exit;
-    return_value = IdentityDict_pop_impl(self, key, default_value);
+    for (i = 0, nentries = table->nentries; i < nentries; i++) {
+        if (ENTRY_KEY(table, i) != NULL) {
+            Py_VISIT(ENTRY_KEY(table, i));
+            Py_VISIT(ENTRY_VALUE(table, i));
+        }
+    }
 
-exit:
-    return return_value;
+    return 0;
 }
 
-static PyObject *
-IdentityDict_pop_impl(PyObject *self, PyObject *key, PyObject *default_value)
-/*[clinic checksum: 32e484b32203c8ffdaed3eee54d29c8889d30432]*/
+/* Drop every item, for the collector, so without allocating.
+
+   Each entry is emptied before its decrefs, as those may re-enter, and
+   the table reloaded after them.
+*/
+static int
+IdentityDict__clear__(PyObject *self)
 {
     IdentityDict *this = (IdentityDict *)self;
+    Table *table;
 
-    PyObject *value;
+    PyObject *key, *value;
+    Py_ssize_t i;
 
-    register size_t i;
-    register size_t perturb;
-    register size_t mask;
-    register Entry *entry;
-    Entry *entry_0; // register-ing this slows by 33%
-    Py_hash_t hash;
+    /* Shared, the last to let go of the SharedTable breaks the cycle. */
+    if (this->shared != NULL) {
+        this->table = Table_init_small(SMALL_TABLE(this));
+        this->used = 0;
+        this->version++;
+
+        Py_CLEAR(this->shared);
 
-    entry_0 = (Entry *)&this->entries[0];
+        return 0;
+    }
 
-    mask = this->size - 1;
+    for (i = 0; i < this->table->nentries; i++) {
+        key = ENTRY_KEY(this->table, i);
+        if (key == NULL)
+            continue;
 
-    hash = hash_int(key);
+        value = ENTRY_VALUE(this->table, i);
 
-    i = hash & mask;
+        ENTRY_KEY(this->table, i) = NULL;
+        ENTRY_VALUE(this->table, i) = NULL;
 
-    entry = &entry_0[i];
+        this->used--;
 
-    if (entry->key == key)
-        goto found;
+        Py_DECREF(key);
+        Py_DECREF(value);
+    }
 
-    if (entry->key == NULL)
-        goto missing;
+    /* Nothing re-entered to add more: reset the index too, or with
+       shrinking on, go back inline. */
+    if (this->used == 0) {
+        table = this->table;
 
-    for (perturb = hash; ; perturb >>= PERTURB_SHIFT) {
-        i = (i << 2) + i + perturb + 1;
+        if (!IS_SMALL(table) && this->min_load > 0.0) {
+            resize(this, 0);
+            return 0;
+        }
 
-        entry = &entry_0[i & mask];
+        memset(table->ctrl, CTRL_EMPTY, table->size);
 
-        if (entry->key == key)
-            goto found;
+        table->usable = TABLE_CAPACITY(table);
+        table->nentries = 0;
 
-        if (entry->key == NULL)
-            goto missing;
+        this->version++;
     }
 
-  found:
-    value = entry->value;
+    return 0;
+}
 
-    Py_DECREF(key);
+static PyObject *
+IdentityDict__getitem__(PyObject *self, PyObject *key)
+{
+    Table *table = ((IdentityDict *)self)->table;
 
-    entry->key = NULL;
-    entry->value = NULL;
+    PyObject *value;
+    Py_ssize_t ix;
+    size_t slot;
 
-    this->usable++;
+    ix = lookup((IdentityDict *)self, key, hash_int(key), &slot);
 
-    return value;
+    if (ix < 0) {
+        /* As dict, a subclass may fill in. */
+        if (Py_TYPE(self) != &IdentityDict_type &&
+            PyObject_HasAttrString((PyObject *)Py_TYPE(self), "__missing__"))
+            return PyObject_CallMethod(self, "__missing__", "O", key);
 
-  missing:
-    if (default_value == NULL) {
-        /* Implementation detail, probably? */
         _PyErr_SetKeyError(key);
         return NULL;
-    } else {
-        Py_INCREF(default_value);
-        return default_value;
     }
+
+    value = ENTRY_VALUE(table, ix);
+    Py_INCREF(value);
+    return value;
 }
 
-/*[clinic]
-module IdentityDict
+static int
+IdentityDict__setitem__(PyObject *self, PyObject *key, PyObject *value)
+{
+    IdentityDict *this = (IdentityDict *)self;
+    Table *table = this->table;
 
-IdentityDict.popitem
+    PyObject *old_value;
+    Py_ssize_t ix;
+    size_t slot;
 
-Remove an return some (key, value) pair as a 2-tuple.
+    Py_hash_t hash = hash_int(key);
 
-Raise `KeyError` if empty.
-[clinic]*/
+    ix = lookup(this, key, hash, &slot);
 
-PyDoc_STRVAR(IdentityDict_popitem__doc__,
-"Remove an return some (key, value) pair as a 2-tuple.\n"
-"\n"
-"IdentityDict.popitem()\n"
-"\n"
-"Raise `KeyError` if empty.");
+    if (ix < 0 && value == NULL) {
+        _PyErr_SetKeyError(key);
+        return -1;
+    }
 
-#define IDENTITYDICT_POPITEM_METHODDEF    \
-    {"popitem", (PyCFunction)IdentityDict_popitem, METH_NOARGS, IdentityDict_popitem__doc__},
+    /* A copy keeps every entry where it was. */
+    if (UNSHARE(this) == -1)
+        return -1;
 
-static PyObject *
-IdentityDict_popitem(PyObject *self)
-/*[clinic checksum: 6e63caf3587426293b3a58cb4f31f0f6993ea30d]*/
-{
-    PyErr_SetString(PyExc_NotImplementedError, "IdentityDict.popitem");
-    return NULL;
-}
+    if (ix < 0)
+        return insert_at(this, slot, key, hash, value);
 
-/*[clinic]
-module IdentityDict
+    table = this->table;
+    old_value = ENTRY_VALUE(table, ix);
 
-IdentityDict.keys
+    if (value == NULL) {
+        /* Slot first, as the decrefs may re-enter. */
+        ENTRY_KEY(table, ix) = NULL;
+        ENTRY_VALUE(table, ix) = NULL;
 
-Return a set-like object providing a view on D's keys.
-[clinic]*/
+        mark_deleted(this, slot);
 
-PyDoc_STRVAR(IdentityDict_keys__doc__,
-"Return a set-like object providing a view on D\'s keys.\n"
-"\n"
-"IdentityDict.keys()");
+        this->used--;
 
-#define IDENTITYDICT_KEYS_METHODDEF    \
-    {"keys", (PyCFunction)IdentityDict_keys, METH_NOARGS, IdentityDict_keys__doc__},
+        maybe_shrink(this);
 
-static PyObject *
-IdentityDict_keys(PyObject *self)
-/*[clinic checksum: 26bf04aae2bb683dd2ed3cfb892713c9242d5703]*/
-{
-    return IdentityDictView_new(
-        &IdentityDictKeys_type,
-        (IdentityDict *)self
-        );
-}
+        Py_DECREF(key);
+    } else {
+        Py_INCREF(value);
 
-/*[clinic]
-module IdentityDict
+        ENTRY_VALUE(table, ix) = value;
+    }
 
-IdentityDict.items
+    Py_DECREF(old_value);
 
-Return an object providing a view on D's items.
-[clinic]*/
+    return 0;
+}
 
-PyDoc_STRVAR(IdentityDict_items__doc__,
-"Return an object providing a view on D\'s items.\n"
-"\n"
-"IdentityDict.items()");
+static int
+IdentityDict__contains__(PyObject *self, PyObject *key)
+{
+    size_t slot;
 
-#define IDENTITYDICT_ITEMS_METHODDEF    \
-    {"items", (PyCFunction)IdentityDict_items, METH_NOARGS, IdentityDict_items__doc__},
+    return lookup((IdentityDict *)self, key, hash_int(key), &slot) >= 0;
+}
 
-static PyObject *
-IdentityDict_items(PyObject *self)
-/*[clinic checksum: ab64d075b37f5e6df7ab75d21a13e8a59c23c7b7]*/
+static Py_ssize_t
+IdentityDict__len__(PyObject *self)
 {
-    return IdentityDictView_new(
-        &IdentityDictItems_type,
-        (IdentityDict *)self
-        );
+    return ((IdentityDict *)self)->used;
 }
 
-/*[clinic]
-module IdentityDict
-
-IdentityDict.values
-
-Return a set-like object providing a view on D's values.
-[clinic]*/
-
-PyDoc_STRVAR(IdentityDict_values__doc__,
-"Return a set-like object providing a view on D\'s values.\n"
-"\n"
-"IdentityDict.values()");
-
-#define IDENTITYDICT_VALUES_METHODDEF    \
-    {"values", (PyCFunction)IdentityDict_values, METH_NOARGS, IdentityDict_values__doc__},
+/* Forward */
 
 static PyObject *
-IdentityDict_values(PyObject *self)
-/*[clinic checksum: 53333f1117776f2e6abb726f5161836de82d2f96]*/
+IdentityDict__iter__(PyObject *self)
 {
-    return IdentityDictView_new(
-        &IdentityDictValues_type,
+    return IdentityDictIterator_new(
+        &IdentityDictKeysIterator_type,
         (IdentityDict *)self
         );
 }
 
-/* Manually for now, as this one's too out there for argument clinic. */
-#define IDENTITYDICT_UPDATE_METHODDEF    \
-    {"update", (PyCFunction)IdentityDict_update, METH_VARARGS|METH_KEYWORDS, "TODO"},
-
-static PyObject *
-IdentityDict_update(PyObject *self, PyObject *args, PyObject *kwargs)
+/* Move the live entries to a new table of `new_size` slots, or back
+   inline for 0 */
+static int
+resize(IdentityDict *this, Py_ssize_t new_size)
 {
-    PyErr_SetString(PyExc_NotImplementedError, "IdentityDict.update");
-    return NULL;
-}
-
-/*[clinic]
-module IdentityDict
+    Table *old_table = this->table;
+    Table *new_table = new_size == 0
+        ? Table_init_small(SMALL_TABLE(this))
+        : Table_new(new_size, usable_at(new_size, this->max_load));
 
-IdentityDict.clear
+    register Py_ssize_t i, n;
+    register Py_ssize_t nentries = old_table->nentries;
 
-Remove all items from D.
-[clinic]*/
+    Py_hash_t hash;
+    size_t slot;
 
-PyDoc_STRVAR(IdentityDict_clear__doc__,
-"Remove all items from D.\n"
-"\n"
-"IdentityDict.clear()");
+    if (new_table == NULL)
+        return -1;
 
-#define IDENTITYDICT_CLEAR_METHODDEF    \
-    {"clear", (PyCFunction)IdentityDict_clear, METH_NOARGS, IdentityDict_clear__doc__},
+    for (i = 0, n = 0; i < nentries; i++) {
+        if (ENTRY_KEY(old_table, i) == NULL)
+            continue;
 
-static PyObject *
-IdentityDict_clear(PyObject *self)
-/*[clinic checksum: 735c297484b6301ab6db91e67b195cd122d817c8]*/
-{
-    IdentityDict *this = (IdentityDict *)self;
-    Py_ssize_t i, size;
-    Entry *entry_0 = (Entry *)&this->entries[0];
-    PyObject *key;
+        ENTRY_KEY(new_table, n) = ENTRY_KEY(old_table, i);
+        ENTRY_VALUE(new_table, n) = ENTRY_VALUE(old_table, i);
 
-    for (i = 0, size = this->size; i < size; i++) {
-        key = entry_0[i].key;
+        if (new_size > 0) {
+            hash = hash_int(ENTRY_KEY(new_table, n));
+            slot = find_free_slot(new_table, hash);
 
-        if (key != NULL) {
-            Py_DECREF(key);
-            Py_DECREF(entry_0[i].value);
+            put_slot(new_table, slot, hash, n);
         }
+
+        n++;
     }
 
-    this->usable = USABLE(this->size);
+    new_table->nentries = n;
+    new_table->usable -= n;
 
-    Py_RETURN_NONE;
-}
+    Table_release(old_table);
 
-/*[clinic]
-module IdentityDict
+    this->table = new_table;
+    this->version++;
 
-IdentityDict.copy
+    return 0;
+}
 
-Return a shallow copy of D.
-[clinic]*/
+/* Squeeze deleted entries out and rebuild the index, all in place.
 
-PyDoc_STRVAR(IdentityDict_copy__doc__,
-"Return a shallow copy of D.\n"
+   Used instead of growing once half the entries are deleted, so
+   that insert/delete churn at a steady size never grows the table.
+*/
+static void
+compact(IdentityDict *this)
+{
+    Table *table = this->table;
+
+    register Py_ssize_t i, n;
+    register Py_ssize_t nentries = table->nentries;
+
+    Py_ssize_t capacity = TABLE_CAPACITY(table);
+    Py_hash_t hash;
+    size_t slot;
+
+    memset(table->ctrl, CTRL_EMPTY, table->size);
+
+    for (i = 0, n = 0; i < nentries; i++) {
+        if (ENTRY_KEY(table, i) == NULL)
+            continue;
+
+        ENTRY_KEY(table, n) = ENTRY_KEY(table, i);
+        ENTRY_VALUE(table, n) = ENTRY_VALUE(table, i);
+
+        if (!IS_SMALL(table)) {
+            hash = hash_int(ENTRY_KEY(table, n));
+            slot = find_free_slot(table, hash);
+
+            put_slot(table, slot, hash, n);
+        }
+
+        n++;
+    }
+
+    table->nentries = n;
+    table->usable = capacity - n;
+
+    this->version++;
+}
+
+/*[clinic]
+module IdentityDict
+
+IdentityDict.get
+
+  key: object
+  default: object = NULL
+  /
+
+self[key] if key in self, else default (which is None if not provided).
+[clinic]*/
+
+PyDoc_STRVAR(IdentityDict_get__doc__,
+"self[key] if key in self, else default (which is None if not provided).\n"
+"\n"
+"IdentityDict.get(key, default=None)");
+
+#define IDENTITYDICT_GET_METHODDEF    \
+    {"get", (PyCFunction)(void(*)(void))IdentityDict_get, METH_FASTCALL, IdentityDict_get__doc__},
+
+static PyObject *
+IdentityDict_get_impl(PyObject *self, PyObject *key, PyObject *default_value);
+
+static PyObject *
+IdentityDict_get(PyObject *self, PyObject *const *args, Py_ssize_t nargs)
+{
+    if (!_PyArg_CheckPositional("get", nargs, 1, 2))
+        return NULL;
+
+    return IdentityDict_get_impl(self, args[0], nargs > 1 ? args[1] : NULL);
+}
+
+static PyObject *
+IdentityDict_get_impl(PyObject *self, PyObject *key, PyObject *default_value)
+/*[clinic checksum: eeb64b68bb6f130ac11a4cbf38dad4932b3be342]*/
+{
+    Table *table = ((IdentityDict *)self)->table;
+
+    PyObject *value;
+    Py_ssize_t ix;
+    size_t slot;
+
+    ix = lookup((IdentityDict *)self, key, hash_int(key), &slot);
+
+    if (ix >= 0)
+        value = ENTRY_VALUE(table, ix);
+    else
+        value = default_value == NULL ? Py_None : default_value;
+
+    Py_INCREF(value);
+    return value;
+}
+
+/*[clinic]
+module IdentityDict
+
+IdentityDict.setdefault
+
+  key: object
+  default: object = NULL
+  /
+
+Return `self.get(key, default)` and assign `key` to `default` if absent.
+[clinic]*/
+
+PyDoc_STRVAR(IdentityDict_setdefault__doc__,
+"Return `self.get(key, default)` and assign `key` to `default` if absent.\n"
+"\n"
+"IdentityDict.setdefault(key, default=None)");
+
+#define IDENTITYDICT_SETDEFAULT_METHODDEF    \
+    {"setdefault", (PyCFunction)(void(*)(void))IdentityDict_setdefault, METH_FASTCALL, IdentityDict_setdefault__doc__},
+
+static PyObject *
+IdentityDict_setdefault_impl(PyObject *self, PyObject *key, PyObject *default_value);
+
+static PyObject *
+IdentityDict_setdefault(PyObject *self, PyObject *const *args, Py_ssize_t nargs)
+{
+    if (!_PyArg_CheckPositional("setdefault", nargs, 1, 2))
+        return NULL;
+
+    return IdentityDict_setdefault_impl(self, args[0], nargs > 1 ? args[1] : NULL);
+}
+
+static PyObject *
+IdentityDict_setdefault_impl(PyObject *self, PyObject *key, PyObject *default_value)
+/*[clinic checksum: 18f699c16ff10235b7b6fc860d29fd73ee7029df]*/
+{
+    IdentityDict *this = (IdentityDict *)self;
+    Table *table = this->table;
+
+    PyObject *value;
+    Py_ssize_t ix;
+    size_t slot;
+
+    Py_hash_t hash = hash_int(key);
+
+    ix = lookup(this, key, hash, &slot);
+
+    if (ix >= 0) {
+        value = ENTRY_VALUE(table, ix);
+    } else {
+        value = default_value == NULL ? Py_None : default_value;
+
+        if (UNSHARE(this) == -1 || insert_at(this, slot, key, hash, value) == -1)
+            return NULL;
+    }
+
+    Py_INCREF(value);
+    return value;
+}
+
+/* self[key], else self[key] = factory(), all in one probe unless the
+   factory changes the dict */
+static PyObject *
+get_or_insert(IdentityDict *this, PyObject *key, PyObject *factory)
+{
+    Py_hash_t hash = hash_int(key);
+
+    PyObject *value;
+    Py_ssize_t ix, version;
+    size_t slot;
+    int status;
+
+    ix = lookup(this, key, hash, &slot);
+
+    if (ix >= 0) {
+        value = ENTRY_VALUE(this->table, ix);
+        Py_INCREF(value);
+        return value;
+    }
+
+    version = this->version;
+
+    value = PyObject_CallNoArgs(factory);
+    if (value == NULL)
+        return NULL;
+
+    /* Else `slot` may be taken, or `key` added, by now. */
+    if (this->version != version)
+        status = IdentityDict__setitem__((PyObject *)this, key, value);
+    else if (UNSHARE(this) == -1)
+        status = -1;
+    else
+        status = insert_at(this, slot, key, hash, value);
+
+    if (status == -1) {
+        Py_DECREF(value);
+        return NULL;
+    }
+
+    return value;
+}
+
+PyDoc_STRVAR(IdentityDict_get_or_insert__doc__,
+"Return self[key], first setting it to factory() if absent.\n"
+"\n"
+"IdentityDict.get_or_insert(key, factory)\n"
+"\n"
+"Unlike `setdefault(key, factory())`, only calls `factory` if `key` is absent.");
+
+#define IDENTITYDICT_GET_OR_INSERT_METHODDEF    \
+    {"get_or_insert", (PyCFunction)(void(*)(void))IdentityDict_get_or_insert, METH_FASTCALL, IdentityDict_get_or_insert__doc__},
+
+static PyObject *
+IdentityDict_get_or_insert(PyObject *self, PyObject *const *args, Py_ssize_t nargs)
+{
+    if (!_PyArg_CheckPositional("get_or_insert", nargs, 2, 2))
+        return NULL;
+
+    return get_or_insert((IdentityDict *)self, args[0], args[1]);
+}
+
+/* Batched lookups
+
+   Each key's home group is prefetched BATCH_DISTANCE keys ahead of its
+   probe, and the entry there halfway, once the group has arrived, so
+   that many cache misses are in flight at once instead of one after
+   another.  Nothing in between can re-enter, so the table stays put
+   throughout.
+*/
+
+#define BATCH_DISTANCE 16
+
+enum {BATCH_GET, BATCH_CONTAINS};
+
+/* A new list of `self.get(key, default)`, or of `key in self`, for each
+   key of `keys` */
+static PyObject *
+batch_lookup(IdentityDict *this, PyObject *keys, PyObject *default_value, int what)
+{
+    Py_hash_t hashes[BATCH_DISTANCE];
+    PyObject *sequence, *list, *value;
+    PyObject **items;
+    Py_ssize_t i, j, n, ix;
+    size_t slot;
+    Table *table;
+
+    sequence = PySequence_Fast(keys, "keys must be iterable");
+    if (sequence == NULL)
+        return NULL;
+
+    n = PySequence_Fast_GET_SIZE(sequence);
+    items = PySequence_Fast_ITEMS(sequence);
+
+    list = PyList_New(n);
+    if (list == NULL) {
+        Py_DECREF(sequence);
+        return NULL;
+    }
+
+    table = this->table;
+
+    /* Each time round, key `i - BATCH_DISTANCE` is looked up, freeing its
+       place in `hashes` for key `i`, hashed and its home prefetched, with
+       the entry of key `i - BATCH_DISTANCE / 2` prefetched in between. */
+    for (i = 0; i < n + BATCH_DISTANCE; i++) {
+        j = i - BATCH_DISTANCE;
+        if (j >= 0) {
+            ix = lookup(this, items[j], hashes[j % BATCH_DISTANCE], &slot);
+
+            if (what == BATCH_CONTAINS)
+                value = ix >= 0 ? Py_True : Py_False;
+            else
+                value = ix >= 0 ? ENTRY_VALUE(table, ix) : default_value;
+
+            Py_INCREF(value);
+            PyList_SET_ITEM(list, j, value);
+        }
+
+        j = i - BATCH_DISTANCE / 2;
+        if (j >= 0 && j < n && !IS_SMALL(table))
+            prefetch_entry(table, hashes[j % BATCH_DISTANCE]);
+
+        if (i < n) {
+            hashes[i % BATCH_DISTANCE] = hash_int(items[i]);
+
+            if (!IS_SMALL(table))
+                prefetch_home(table, hashes[i % BATCH_DISTANCE]);
+        }
+    }
+
+    Py_DECREF(sequence);
+
+    return list;
+}
+
+PyDoc_STRVAR(IdentityDict_get_many__doc__,
+"A list of self.get(key, default) for each key of `keys`.\n"
+"\n"
+"IdentityDict.get_many(keys, default=None)\n"
+"\n"
+"Faster than calling get() for each, the larger the dict, as the lookups\n"
+"overlap their cache misses.");
+
+#define IDENTITYDICT_GET_MANY_METHODDEF    \
+    {"get_many", (PyCFunction)(void(*)(void))IdentityDict_get_many, METH_FASTCALL, IdentityDict_get_many__doc__},
+
+static PyObject *
+IdentityDict_get_many(PyObject *self, PyObject *const *args, Py_ssize_t nargs)
+{
+    if (!_PyArg_CheckPositional("get_many", nargs, 1, 2))
+        return NULL;
+
+    return batch_lookup((IdentityDict *)self, args[0], nargs > 1 ? args[1] : Py_None, BATCH_GET);
+}
+
+PyDoc_STRVAR(IdentityDict_contains_many__doc__,
+"A list of `key in self` for each key of `keys`.\n"
+"\n"
+"IdentityDict.contains_many(keys)\n"
+"\n"
+"Faster than testing each, the larger the dict, as the lookups overlap\n"
+"their cache misses.");
+
+#define IDENTITYDICT_CONTAINS_MANY_METHODDEF    \
+    {"contains_many", (PyCFunction)IdentityDict_contains_many, METH_O, IdentityDict_contains_many__doc__},
+
+static PyObject *
+IdentityDict_contains_many(PyObject *self, PyObject *keys)
+{
+    return batch_lookup((IdentityDict *)self, keys, NULL, BATCH_CONTAINS);
+}
+
+/*[clinic]
+module IdentityDict
+
+IdentityDict.pop
+
+  key: object
+  default: object = NULL
+  /
+
+Remove a specified key and return its corresponding value.
+
+If absent and `default` is provided, return `default`.
+If absent and `default` is NOT provided, raise `KeyError`.
+[clinic]*/
+
+PyDoc_STRVAR(IdentityDict_pop__doc__,
+"Remove a specified key and return its corresponding value.\n"
+"\n"
+"IdentityDict.pop(key, default=None)\n"
+"\n"
+"If absent and `default` is provided, return `default`.\n"
+"If absent and `default` is NOT provided, raise `KeyError`.");
+
+#define IDENTITYDICT_POP_METHODDEF    \
+    {"pop", (PyCFunction)(void(*)(void))IdentityDict_pop, METH_FASTCALL, IdentityDict_pop__doc__},
+
+static PyObject *
+IdentityDict_pop_impl(PyObject *self, PyObject *key, PyObject *default_value);
+
+static PyObject *
+IdentityDict_pop(PyObject *self, PyObject *const *args, Py_ssize_t nargs)
+{
+    if (!_PyArg_CheckPositional("pop", nargs, 1, 2))
+        return NULL;
+
+    return IdentityDict_pop_impl(self, args[0], nargs > 1 ? args[1] : NULL);
+}
+
+static PyObject *
+IdentityDict_pop_impl(PyObject *self, PyObject *key, PyObject *default_value)
+/*[clinic checksum: 32e484b32203c8ffdaed3eee54d29c8889d30432]*/
+{
+    IdentityDict *this = (IdentityDict *)self;
+    Table *table = this->table;
+
+    PyObject *value;
+    Py_ssize_t ix;
+    size_t slot;
+
+    ix = lookup(this, key, hash_int(key), &slot);
+
+    if (ix < 0) {
+        if (default_value == NULL) {
+            /* Implementation detail, probably? */
+            _PyErr_SetKeyError(key);
+            return NULL;
+        } else {
+            Py_INCREF(default_value);
+            return default_value;
+        }
+    }
+
+    if (UNSHARE(this) == -1)
+        return NULL;
+
+    table = this->table;
+    value = ENTRY_VALUE(table, ix);
+
+    ENTRY_KEY(table, ix) = NULL;
+    ENTRY_VALUE(table, ix) = NULL;
+
+    mark_deleted(this, slot);
+
+    this->used--;
+
+    maybe_shrink(this);
+
+    Py_DECREF(key);
+
+    return value;
+}
+
+/*[clinic]
+module IdentityDict
+
+IdentityDict.popitem
+
+Remove an return some (key, value) pair as a 2-tuple.
+
+Raise `KeyError` if empty.
+[clinic]*/
+
+PyDoc_STRVAR(IdentityDict_popitem__doc__,
+"Remove an return some (key, value) pair as a 2-tuple.\n"
+"\n"
+"IdentityDict.popitem()\n"
+"\n"
+"Raise `KeyError` if empty.");
+
+#define IDENTITYDICT_POPITEM_METHODDEF    \
+    {"popitem", (PyCFunction)IdentityDict_popitem, METH_NOARGS, IdentityDict_popitem__doc__},
+
+static PyObject *
+IdentityDict_popitem(PyObject *self)
+/*[clinic checksum: 6e63caf3587426293b3a58cb4f31f0f6993ea30d]*/
+{
+    PyErr_SetString(PyExc_NotImplementedError, "IdentityDict.popitem");
+    return NULL;
+}
+
+/*[clinic]
+module IdentityDict
+
+IdentityDict.keys
+
+Return a set-like object providing a view on D's keys.
+[clinic]*/
+
+PyDoc_STRVAR(IdentityDict_keys__doc__,
+"Return a set-like object providing a view on D\'s keys.\n"
+"\n"
+"IdentityDict.keys()");
+
+#define IDENTITYDICT_KEYS_METHODDEF    \
+    {"keys", (PyCFunction)IdentityDict_keys, METH_NOARGS, IdentityDict_keys__doc__},
+
+static PyObject *
+IdentityDict_keys(PyObject *self)
+/*[clinic checksum: 26bf04aae2bb683dd2ed3cfb892713c9242d5703]*/
+{
+    return IdentityDictView_new(
+        &IdentityDictKeys_type,
+        (IdentityDict *)self
+        );
+}
+
+/*[clinic]
+module IdentityDict
+
+IdentityDict.items
+
+Return an object providing a view on D's items.
+[clinic]*/
+
+PyDoc_STRVAR(IdentityDict_items__doc__,
+"Return an object providing a view on D\'s items.\n"
+"\n"
+"IdentityDict.items()");
+
+#define IDENTITYDICT_ITEMS_METHODDEF    \
+    {"items", (PyCFunction)IdentityDict_items, METH_NOARGS, IdentityDict_items__doc__},
+
+static PyObject *
+IdentityDict_items(PyObject *self)
+/*[clinic checksum: ab64d075b37f5e6df7ab75d21a13e8a59c23c7b7]*/
+{
+    return IdentityDictView_new(
+        &IdentityDictItems_type,
+        (IdentityDict *)self
+        );
+}
+
+/*[clinic]
+module IdentityDict
+
+IdentityDict.values
+
+Return a set-like object providing a view on D's values.
+[clinic]*/
+
+PyDoc_STRVAR(IdentityDict_values__doc__,
+"Return a set-like object providing a view on D\'s values.\n"
+"\n"
+"IdentityDict.values()");
+
+#define IDENTITYDICT_VALUES_METHODDEF    \
+    {"values", (PyCFunction)IdentityDict_values, METH_NOARGS, IdentityDict_values__doc__},
+
+static PyObject *
+IdentityDict_values(PyObject *self)
+/*[clinic checksum: 53333f1117776f2e6abb726f5161836de82d2f96]*/
+{
+    return IdentityDictView_new(
+        &IdentityDictValues_type,
+        (IdentityDict *)self
+        );
+}
+
+/* Add every item of the IdentityDict `other`, straight from its entries */
+static int
+merge_entries(IdentityDict *this, IdentityDict *other)
+{
+    PyObject *key, *value;
+    Py_ssize_t i;
+    int status;
+
+    if (reserve(this, this->used + other->used) == -1)
+        return -1;
+
+    /* Reload the table each time round, as replacing a value may re-enter. */
+    for (i = 0; i < other->table->nentries; i++) {
+        key = ENTRY_KEY(other->table, i);
+        if (key == NULL)
+            continue;
+
+        value = ENTRY_VALUE(other->table, i);
+
+        Py_INCREF(key);
+        Py_INCREF(value);
+
+        status = IdentityDict__setitem__((PyObject *)this, key, value);
+
+        Py_DECREF(key);
+        Py_DECREF(value);
+
+        if (status == -1)
+            return -1;
+    }
+
+    return 0;
+}
+
+/* Add every item of the dict `other` */
+static int
+merge_dict(IdentityDict *this, PyObject *other)
+{
+    PyObject *key, *value;
+    Py_ssize_t pos = 0;
+    int status;
+
+    if (reserve(this, this->used + PyDict_GET_SIZE(other)) == -1)
+        return -1;
+
+    while (PyDict_Next(other, &pos, &key, &value)) {
+        Py_INCREF(key);
+        Py_INCREF(value);
+
+        status = IdentityDict__setitem__((PyObject *)this, key, value);
+
+        Py_DECREF(key);
+        Py_DECREF(value);
+
+        if (status == -1)
+            return -1;
+    }
+
+    return 0;
+}
+
+/* Add `other[key]` for every key in `other.keys()` */
+static int
+merge_mapping(IdentityDict *this, PyObject *other)
+{
+    PyObject *keys, *key, *value;
+    Py_ssize_t i, n;
+    int status;
+
+    keys = PyMapping_Keys(other);
+    if (keys == NULL)
+        return -1;
+
+    n = PyList_GET_SIZE(keys);
+
+    if (reserve(this, this->used + n) == -1)
+        goto error;
+
+    for (i = 0; i < n; i++) {
+        key = PyList_GET_ITEM(keys, i);
+
+        value = PyObject_GetItem(other, key);
+        if (value == NULL)
+            goto error;
+
+        status = IdentityDict__setitem__((PyObject *)this, key, value);
+
+        Py_DECREF(value);
+
+        if (status == -1)
+            goto error;
+    }
+
+    Py_DECREF(keys);
+    return 0;
+
+  error:
+    Py_DECREF(keys);
+    return -1;
+}
+
+/* Add every (key, value) pair `other` yields */
+static int
+merge_pairs(IdentityDict *this, PyObject *other)
+{
+    PyObject *iterator, *item, *pair;
+    Py_ssize_t i, hint;
+    int status;
+
+    iterator = PyObject_GetIter(other);
+    if (iterator == NULL)
+        return -1;
+
+    hint = PyObject_LengthHint(other, 0);
+    if (hint == -1)
+        goto error;
+
+    if (reserve(this, this->used + hint) == -1)
+        goto error;
+
+    for (i = 0; (item = PyIter_Next(iterator)) != NULL; i++) {
+        pair = PySequence_Fast(item, "");
+        Py_DECREF(item);
+
+        if (pair == NULL) {
+            if (PyErr_ExceptionMatches(PyExc_TypeError))
+                PyErr_Format(PyExc_TypeError,
+                             "cannot convert IdentityDict update "
+                             "sequence element #%zd to a sequence", i);
+            goto error;
+        }
+
+        if (PySequence_Fast_GET_SIZE(pair) != 2) {
+            PyErr_Format(PyExc_ValueError,
+                         "IdentityDict update sequence element #%zd "
+                         "has length %zd; 2 is required",
+                         i, PySequence_Fast_GET_SIZE(pair));
+            Py_DECREF(pair);
+            goto error;
+        }
+
+        status = IdentityDict__setitem__((PyObject *)this,
+                                         PySequence_Fast_GET_ITEM(pair, 0),
+                                         PySequence_Fast_GET_ITEM(pair, 1));
+
+        Py_DECREF(pair);
+
+        if (status == -1)
+            goto error;
+    }
+
+    if (PyErr_Occurred())
+        goto error;
+
+    Py_DECREF(iterator);
+    return 0;
+
+  error:
+    Py_DECREF(iterator);
+    return -1;
+}
+
+/* Add the items of `other`, sizing the table for all of them up front */
+static int
+merge(IdentityDict *this, PyObject *other)
+{
+    if (PyObject_TypeCheck(other, &IdentityDict_type)) {
+        if (other == (PyObject *)this)
+            return 0;
+
+        return merge_entries(this, (IdentityDict *)other);
+    }
+
+    if (PyDict_CheckExact(other))
+        return merge_dict(this, other);
+
+    if (PyObject_HasAttrString(other, "keys"))
+        return merge_mapping(this, other);
+
+    return merge_pairs(this, other);
+}
+
+PyDoc_STRVAR(IdentityDict_update__doc__,
+"Add the items of `other` and `kwargs`, replacing the values of keys already present.\n"
+"\n"
+"IdentityDict.update([other], **kwargs)\n"
+"\n"
+"`other` may be an IdentityDict, a mapping, or an iterable of (key, value) pairs.");
+
+/* Manually for now, as this one's too out there for argument clinic. */
+#define IDENTITYDICT_UPDATE_METHODDEF    \
+    {"update", (PyCFunction)IdentityDict_update, METH_VARARGS|METH_KEYWORDS, IdentityDict_update__doc__},
+
+static PyObject *
+IdentityDict_update(PyObject *self, PyObject *args, PyObject *kwargs)
+{
+    IdentityDict *this = (IdentityDict *)self;
+    PyObject *other = NULL;
+
+    if (!PyArg_UnpackTuple(args, "update", 0, 1, &other))
+        return NULL;
+
+    if (other != NULL && merge(this, other) == -1)
+        return NULL;
+
+    if (kwargs != NULL && merge_dict(this, kwargs) == -1)
+        return NULL;
+
+    Py_RETURN_NONE;
+}
+
+PyDoc_STRVAR(IdentityDict_fromkeys__doc__,
+"Return a new IdentityDict with keys from `iterable`, each mapped to `value`.\n"
+"\n"
+"IdentityDict.fromkeys(iterable, value=None)");
+
+#define IDENTITYDICT_FROMKEYS_METHODDEF    \
+    {"fromkeys", (PyCFunction)IdentityDict_fromkeys, METH_VARARGS|METH_CLASS, IdentityDict_fromkeys__doc__},
+
+static PyObject *
+IdentityDict_fromkeys(PyObject *cls, PyObject *args)
+{
+    PyObject *iterable;
+    PyObject *value = Py_None;
+    PyObject *self, *iterator, *key;
+    IdentityDict *this;
+    Py_ssize_t hint;
+    int status;
+
+    if (!PyArg_UnpackTuple(args, "fromkeys", 1, 2, &iterable, &value))
+        return NULL;
+
+    self = PyObject_CallNoArgs(cls);
+    if (self == NULL)
+        return NULL;
+
+    if (!PyObject_TypeCheck(self, &IdentityDict_type)) {
+        PyErr_Format(PyExc_TypeError, "%R() returned a non-IdentityDict", cls);
+        Py_DECREF(self);
+        return NULL;
+    }
+
+    this = (IdentityDict *)self;
+
+    iterator = PyObject_GetIter(iterable);
+    if (iterator == NULL) {
+        Py_DECREF(self);
+        return NULL;
+    }
+
+    hint = PyObject_LengthHint(iterable, 0);
+    if (hint == -1 || reserve(this, hint) == -1)
+        goto error;
+
+    while ((key = PyIter_Next(iterator)) != NULL) {
+        status = IdentityDict__setitem__(self, key, value);
+
+        Py_DECREF(key);
+
+        if (status == -1)
+            goto error;
+    }
+
+    if (PyErr_Occurred())
+        goto error;
+
+    Py_DECREF(iterator);
+    return self;
+
+  error:
+    Py_DECREF(iterator);
+    Py_DECREF(self);
+    return NULL;
+}
+
+/*[clinic]
+module IdentityDict
+
+IdentityDict.clear
+
+Remove all items from D.
+[clinic]*/
+
+PyDoc_STRVAR(IdentityDict_clear__doc__,
+"Remove all items from D.\n"
+"\n"
+"IdentityDict.clear()");
+
+#define IDENTITYDICT_CLEAR_METHODDEF    \
+    {"clear", (PyCFunction)IdentityDict_clear, METH_NOARGS, IdentityDict_clear__doc__},
+
+static PyObject *
+IdentityDict_clear(PyObject *self)
+/*[clinic checksum: 735c297484b6301ab6db91e67b195cd122d817c8]*/
+{
+    IdentityDict *this = (IdentityDict *)self;
+    Table *old_table = this->table;
+    SmallTable old_small;
+
+    /* Swap first, as the decrefs may re-enter: back to the inline table,
+       so a small table's entries move out of the way. */
+    if (IS_SMALL(old_table)) {
+        old_small = this->small;
+        old_table = (Table *)&old_small;
+    }
+
+    this->table = Table_init_small(SMALL_TABLE(this));
+    this->used = 0;
+    this->version++;
+
+    if (this->shared != NULL) {
+        Py_CLEAR(this->shared);
+        Py_RETURN_NONE;
+    }
+
+    Table_free(old_table);
+
+    Py_RETURN_NONE;
+}
+
+/*[clinic]
+module IdentityDict
+
+IdentityDict.copy
+
+Return a shallow copy of D.
+[clinic]*/
+
+PyDoc_STRVAR(IdentityDict_copy__doc__,
+"Return a shallow copy of D.\n"
+"\n"
+"IdentityDict.copy()");
+
+#define IDENTITYDICT_COPY_METHODDEF    \
+    {"copy", (PyCFunction)IdentityDict_copy, METH_NOARGS, IdentityDict_copy__doc__},
+
+static PyObject *
+IdentityDict_copy(PyObject *self)
+/*[clinic checksum: 9dd173fedc5b12bd096378f66b7b9c4127e98150]*/
+{
+    IdentityDict *this = (IdentityDict *)self;
+    IdentityDict *copy;
+    Table *table;
+
+    if (IS_SMALL(this->table)) {
+        copy = IdentityDict_alloc();
+        if (copy == NULL)
+            return NULL;
+
+        table = SMALL_TABLE(copy);
+        Table_copy_to(table, this->table);
+    } else {
+        table = Table_copy(this->table);
+        if (table == NULL)
+            return NULL;
+
+        copy = IdentityDict_alloc();
+        if (copy == NULL) {
+            Table_free(table);
+            return NULL;
+        }
+    }
+
+    copy->table = table;
+    copy->used = this->used;
+    copy->shared = NULL;
+    copy->version = 0;
+    copy->max_load = this->max_load;
+    copy->growth_factor = this->growth_factor;
+    copy->min_load = this->min_load;
+
+    STATS_CLEAR(&copy->stats);
+
+    /* Deleted entries are at least half of them: leave those behind. */
+    if (this->used * 2 <= table->nentries)
+        compact(copy);
+
+    PyObject_GC_Track(copy);
+
+    return (PyObject *)copy;
+}
+
+/* SharedTable
+
+   Owns a table shared by snapshots, so that the collector sees its items
+   once, not once per dict, and they go with the last dict to let go.
+*/
+
+static PyObject *
+SharedTable_new(Table *table)
+{
+    SharedTable *this = PyObject_GC_New(SharedTable, &SharedTable_type);
+    if (this == NULL)
+        return NULL;
+
+    this->table = table;
+
+    PyObject_GC_Track(this);
+
+    return (PyObject *)this;
+}
+
+static void
+SharedTable__del__(PyObject *self)
+{
+    Table *table = ((SharedTable *)self)->table;
+
+    PyObject_GC_UnTrack(self);
+    Py_TRASHCAN_BEGIN(self, SharedTable__del__)
+
+    /* Unless taken over by `unshare_table()` */
+    if (table != NULL)
+        Table_free(table);
+
+    PyObject_GC_Del(self);
+
+    Py_TRASHCAN_END
+}
+
+static int
+SharedTable__traverse__(PyObject *self, visitproc visit, void *arg)
+{
+    Table *table = ((SharedTable *)self)->table;
+
+    Py_ssize_t i, nentries;
+
+    if (table == NULL)
+        return 0;
+
+    for (i = 0, nentries = table->nentries; i < nentries; i++) {
+        if (ENTRY_KEY(table, i) != NULL) {
+            Py_VISIT(ENTRY_KEY(table, i));
+            Py_VISIT(ENTRY_VALUE(table, i));
+        }
+    }
+
+    return 0;
+}
+
+static PyTypeObject
+SharedTable_type = {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    "b._collections.SharedTable",   /* tp_name */
+    sizeof(SharedTable),            /* tp_basicsize */
+    0,                              /* tp_itemsize */
+    SharedTable__del__,             /* tp_dealloc */
+    0,                              /* tp_print */
+    0,                              /* tp_getattr */
+    0,                              /* tp_setattr */
+    0,                              /* tp_reserved */
+    0,                              /* tp_repr */
+    0,                              /* tp_as_number */
+    0,                              /* tp_as_sequence */
+    0,                              /* tp_as_mapping */
+    0,                              /* tp_hash  */
+    0,                              /* tp_call */
+    0,                              /* tp_str */
+    0,                              /* tp_getattro */
+    0,                              /* tp_setattro */
+    0,                              /* tp_as_buffer */
+    Py_TPFLAGS_DEFAULT |
+    Py_TPFLAGS_HAVE_GC,             /* tp_flags */
+    0,                              /* tp_doc */
+    SharedTable__traverse__,        /* tp_traverse */
+};
+
+/* Give `this` a table of its own, before changing it.
+
+   The entries keep their positions, so lookups made before still hold.
+*/
+static int
+unshare_table(IdentityDict *this)
+{
+    SharedTable *shared = (SharedTable *)this->shared;
+    Table *table;
+
+    if (Py_REFCNT(shared) == 1) {
+        /* The others are gone: take it over. */
+        table = shared->table;
+        shared->table = NULL;
+    } else {
+        table = Table_copy(shared->table);
+        if (table == NULL)
+            return -1;
+    }
+
+    this->table = table;
+    this->shared = NULL;
+
+    Py_DECREF(shared);
+
+    return 0;
+}
+
+PyDoc_STRVAR(IdentityDict_snapshot__doc__,
+"Return a copy of D that shares its table until either of them is changed.\n"
+"\n"
+"IdentityDict.snapshot()\n"
+"\n"
+"Taking one is O(1); the first change to D or any of its snapshots copies the table.");
+
+#define IDENTITYDICT_SNAPSHOT_METHODDEF    \
+    {"snapshot", (PyCFunction)IdentityDict_snapshot, METH_NOARGS, IdentityDict_snapshot__doc__},
+
+static PyObject *
+IdentityDict_snapshot(PyObject *self)
+{
+    IdentityDict *this = (IdentityDict *)self;
+    IdentityDict *snapshot;
+
+    /* Inline, so no table to share, and no bigger than a copy's */
+    if (IS_SMALL(this->table))
+        return IdentityDict_copy(self);
+
+    if (this->shared == NULL) {
+        this->shared = SharedTable_new(this->table);
+        if (this->shared == NULL)
+            return NULL;
+    }
+
+    snapshot = IdentityDict_alloc();
+    if (snapshot == NULL)
+        return NULL;
+
+    Py_INCREF(this->shared);
+
+    snapshot->table = this->table;
+    snapshot->used = this->used;
+    snapshot->shared = this->shared;
+    snapshot->version = 0;
+    snapshot->max_load = this->max_load;
+    snapshot->growth_factor = this->growth_factor;
+    snapshot->min_load = this->min_load;
+
+    STATS_CLEAR(&snapshot->stats);
+
+    PyObject_GC_Track(snapshot);
+
+    return (PyObject *)snapshot;
+}
+
+/* Make room for `n` keys in all */
+static int
+reserve(IdentityDict *this, Py_ssize_t n)
+{
+    Table *table = this->table;
+    Py_ssize_t size;
+
+    if (table->usable >= n - this->used)
+        return 0;
+
+    if (UNSHARE(this) == -1)
+        return -1;
+
+    size = n <= IDENTITYDICT_SMALL ? 0 : size_for(n, this->max_load);
+    if (size == -1)
+        return -1;
+
+    if (size <= table->size) {
+        /* Big enough, once the deleted entries are squeezed out */
+        compact(this);
+        return 0;
+    }
+
+    return grow(this, size);
+}
+
+PyDoc_STRVAR(IdentityDict_reserve__doc__,
+"Make room for `n` keys in all, so adding keys up to that many never resizes.\n"
+"\n"
+"IdentityDict.reserve(n)");
+
+#define IDENTITYDICT_RESERVE_METHODDEF    \
+    {"reserve", (PyCFunction)IdentityDict_reserve, METH_O, IdentityDict_reserve__doc__},
+
+static PyObject *
+IdentityDict_reserve(PyObject *self, PyObject *arg)
+{
+    Py_ssize_t n = PyNumber_AsSsize_t(arg, PyExc_OverflowError);
+
+    if (n == -1 && PyErr_Occurred())
+        return NULL;
+
+    if (n < 0) {
+        PyErr_SetString(PyExc_ValueError, "reserve() of a negative count");
+        return NULL;
+    }
+
+    if (reserve((IdentityDict *)self, n) == -1)
+        return NULL;
+
+    Py_RETURN_NONE;
+}
+
+PyDoc_STRVAR(IdentityDict_shrink_to_fit__doc__,
+"Release the table space neither held by keys nor needed to hold them.\n"
+"\n"
+"IdentityDict.shrink_to_fit()");
+
+#define IDENTITYDICT_SHRINK_TO_FIT_METHODDEF    \
+    {"shrink_to_fit", (PyCFunction)IdentityDict_shrink_to_fit, METH_NOARGS, IdentityDict_shrink_to_fit__doc__},
+
+static PyObject *
+IdentityDict_shrink_to_fit(PyObject *self)
+{
+    IdentityDict *this = (IdentityDict *)self;
+    Table *table = this->table;
+
+    Py_ssize_t size = this->used <= IDENTITYDICT_SMALL ? 0 : size_for(this->used, this->max_load);
+    if (size == -1)
+        return NULL;
+
+    if ((size < table->size || table->nentries > this->used) && UNSHARE(this) == -1)
+        return NULL;
+
+    if (size < table->size) {
+        if (resize(this, size) == -1)
+            return NULL;
+    } else if (table->nentries > this->used) {
+        compact(this);
+    }
+
+    Py_RETURN_NONE;
+}
+
+/* Bytes of the heap table of `this`, unless shared with snapshots: then
+   none of them count, as for dicts that share their keys */
+static Py_ssize_t
+table_sizeof(IdentityDict *this)
+{
+    Table *table = this->table;
+
+    if (IS_SMALL(table) || (this->shared != NULL && Py_REFCNT(this->shared) > 1))
+        return 0;
+
+    return TABLE_HEAD_SIZE(table->size) + TABLE_CAPACITY(table) * sizeof(Entry);
+}
+
+PyDoc_STRVAR(IdentityDict__sizeof____doc__,
+"Size of D in memory, in bytes, its table included.\n"
+"\n"
+"IdentityDict.__sizeof__()");
+
+#define IDENTITYDICT___SIZEOF___METHODDEF    \
+    {"__sizeof__", (PyCFunction)IdentityDict__sizeof__, METH_NOARGS, IdentityDict__sizeof____doc__},
+
+static PyObject *
+IdentityDict__sizeof__(PyObject *self, PyObject *_)
+{
+    return PyLong_FromSsize_t(Py_TYPE(self)->tp_basicsize + table_sizeof((IdentityDict *)self));
+}
+
+#ifdef TABLE_STATS
+PyDoc_STRVAR(IdentityDict__stats__doc__,
+"Return the lookup and growth statistics of D, and the state of its table.\n"
+"\n"
+"IdentityDict._stats()\n"
+"\n"
+"hits and misses count lookups by the groups they probed, the last count\n"
+"also all longer probes; an inline table counts as one group.");
+
+#define IDENTITYDICT__STATS_METHODDEF    \
+    {"_stats", (PyCFunction)IdentityDict__stats, METH_NOARGS, IdentityDict__stats__doc__},
+
+static PyObject *
+IdentityDict__stats(PyObject *self, PyObject *_)
+{
+    IdentityDict *this = (IdentityDict *)self;
+    Table *table = this->table;
+
+    return stats_dict(&this->stats, table->size, this->used,
+                      table->nentries - this->used);
+}
+#else
+#define IDENTITYDICT__STATS_METHODDEF
+#endif
+
+static PyMethodDef
+IdentityDict_methods[] = {
+    IDENTITYDICT_GET_METHODDEF
+    IDENTITYDICT_SETDEFAULT_METHODDEF
+    IDENTITYDICT_GET_OR_INSERT_METHODDEF
+    IDENTITYDICT_GET_MANY_METHODDEF
+    IDENTITYDICT_CONTAINS_MANY_METHODDEF
+    IDENTITYDICT_POP_METHODDEF
+    IDENTITYDICT_POPITEM_METHODDEF
+    IDENTITYDICT_KEYS_METHODDEF
+    IDENTITYDICT_ITEMS_METHODDEF
+    IDENTITYDICT_VALUES_METHODDEF
+    IDENTITYDICT_UPDATE_METHODDEF
+    IDENTITYDICT_FROMKEYS_METHODDEF
+    IDENTITYDICT_CLEAR_METHODDEF
+    IDENTITYDICT_COPY_METHODDEF
+    IDENTITYDICT_SNAPSHOT_METHODDEF
+    IDENTITYDICT_RESERVE_METHODDEF
+    IDENTITYDICT_SHRINK_TO_FIT_METHODDEF
+    IDENTITYDICT___SIZEOF___METHODDEF
+    IDENTITYDICT__STATS_METHODDEF
+    {NULL, NULL} /* sentinel */
+};
+
+static PyObject *
+IdentityDict_max_load(PyObject *self, void *_)
+{
+    return PyFloat_FromDouble(((IdentityDict *)self)->max_load);
+}
+
+static PyObject *
+IdentityDict_growth_factor(PyObject *self, void *_)
+{
+    return PyLong_FromSsize_t(((IdentityDict *)self)->growth_factor);
+}
+
+static PyObject *
+IdentityDict_min_load(PyObject *self, void *_)
+{
+    return PyFloat_FromDouble(((IdentityDict *)self)->min_load);
+}
+
+static PyGetSetDef
+IdentityDict_getset[] = {
+    {"max_load", IdentityDict_max_load, NULL,
+     "Fraction of its slots the table fills before it grows."},
+    {"growth_factor", IdentityDict_growth_factor, NULL,
+     "How many times over the table grows when full."},
+    {"min_load", IdentityDict_min_load, NULL,
+     "Fraction of its slots below which deleting shrinks the table; 0 for never."},
+    {0}
+};
+
+static PyMappingMethods
+IdentityDict_as_mapping = {
+    IdentityDict__len__,      /* mp_length */
+    IdentityDict__getitem__,  /* mp_subscript */
+    IdentityDict__setitem__,  /* mp_ass_subscript */
+};
+
+static PySequenceMethods
+IdentityDict_as_sequence = {
+    0,                          /* sq_length */
+    0,                          /* sq_concat */
+    0,                          /* sq_repeat */
+    0,                          /* sq_item */
+    0,                          /* sq_slice */
+    0,                          /* sq_ass_item */
+    0,                          /* sq_ass_slice */
+    IdentityDict__contains__,   /* sq_contains */
+    0,                          /* sq_inplace_concat */
+    0,                          /* sq_inplace_repeat */
+};
+
+static PyTypeObject
+IdentityDict_type = {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    "b._collections.IdentityDict", /* tp_name */
+    sizeof(IdentityDict),      /* tp_basicsize */
+    0,                         /* tp_itemsize */
+    IdentityDict__del__,       /* tp_dealloc */
+    0,                         /* tp_print */
+    0,                         /* tp_getattr */
+    0,                         /* tp_setattr */
+    0,                         /* tp_reserved */
+    0,                         /* tp_repr */
+    0,                         /* tp_as_number */
+    &IdentityDict_as_sequence, /* tp_as_sequence */
+    &IdentityDict_as_mapping,  /* tp_as_mapping */
+    0,                         /* tp_hash  */
+    0,                         /* tp_call */
+    0,                         /* tp_str */
+    0,                         /* tp_getattro */
+    0,                         /* tp_setattro */
+    0,                         /* tp_as_buffer */
+    Py_TPFLAGS_DEFAULT |
+    Py_TPFLAGS_BASETYPE |
+    Py_TPFLAGS_HAVE_GC,        /* tp_flags */
+    IdentityDict__doc__,       /* tp_doc */
+    IdentityDict__traverse__,  /* tp_traverse */
+    IdentityDict__clear__,     /* tp_clear */
+    0,                         /* tp_richcompare */
+    0,                         /* tp_weaklistoffset */
+    IdentityDict__iter__,      /* tp_iter */
+    0,                         /* tp_iternext */
+    IdentityDict_methods,      /* tp_methods */
+    0,                         /* tp_members */
+    IdentityDict_getset,       /* tp_getset */
+    0,                         /* tp_base */
+    0,                         /* tp_dict */
+    0,                         /* tp_descr_get */
+    0,                         /* tp_descr_set */
+    0,                         /* tp_dictoffset */
+    0,                         /* tp_init */
+    0,                         /* tp_alloc */
+    IdentityDict__new__,       /* tp_new */
+};
+
+/* IdentityDefaultDict */
+
+typedef struct {
+    IdentityDict dict;
+    PyObject *default_factory;
+} IdentityDefaultDict;
+
+PyDoc_STRVAR(IdentityDefaultDict__doc__,
+"IdentityDict that fills in a missing key with default_factory().\n"
+"\n"
+"IdentityDefaultDict(default_factory=None, *, capacity=0, max_load=2/3, growth_factor=2, min_load=1/12)\n"
+"\n"
+"Without a default_factory, a missing key raises KeyError.");
+
+static PyObject *
+IdentityDefaultDict__new__(PyTypeObject *type, PyObject *args, PyObject *kwargs)
+{
+    static char *kwlist[] = {"default_factory", "capacity", "max_load", "growth_factor", "min_load", NULL};
+
+    PyObject *self, *default_factory = Py_None;
+    Py_ssize_t capacity = 0;
+    double max_load = DEFAULT_MAX_LOAD;
+    Py_ssize_t growth_factor = DEFAULT_GROWTH_FACTOR;
+    double min_load = MIN_LOAD_DEFAULT;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "|O$ndnd:IdentityDefaultDict", kwlist,
+                                     &default_factory, &capacity, &max_load, &growth_factor, &min_load))
+        return NULL;
+
+    if (default_factory != Py_None && !PyCallable_Check(default_factory)) {
+        PyErr_SetString(PyExc_TypeError, "first argument must be callable or None");
+        return NULL;
+    }
+
+    self = IdentityDict_new(type, capacity, max_load, growth_factor, min_load);
+    if (self == NULL)
+        return NULL;
+
+    Py_INCREF(default_factory);
+    ((IdentityDefaultDict *)self)->default_factory = default_factory;
+
+    return self;
+}
+
+static void
+IdentityDefaultDict__del__(PyObject *self)
+{
+    PyObject_GC_UnTrack(self);
+    Py_CLEAR(((IdentityDefaultDict *)self)->default_factory);
+    IdentityDict__del__(self);
+}
+
+static int
+IdentityDefaultDict__traverse__(PyObject *self, visitproc visit, void *arg)
+{
+    Py_VISIT(((IdentityDefaultDict *)self)->default_factory);
+    return IdentityDict__traverse__(self, visit, arg);
+}
+
+static int
+IdentityDefaultDict__clear__(PyObject *self)
+{
+    Py_CLEAR(((IdentityDefaultDict *)self)->default_factory);
+    return IdentityDict__clear__(self);
+}
+
+static PyObject *
+IdentityDefaultDict__getitem__(PyObject *self, PyObject *key)
+{
+    PyObject *default_factory = ((IdentityDefaultDict *)self)->default_factory;
+
+    if (default_factory == NULL || default_factory == Py_None)
+        return IdentityDict__getitem__(self, key);
+
+    return get_or_insert((IdentityDict *)self, key, default_factory);
+}
+
+static PyObject *
+IdentityDefaultDict_default_factory(PyObject *self, void *_)
+{
+    PyObject *default_factory = ((IdentityDefaultDict *)self)->default_factory;
+
+    if (default_factory == NULL)
+        default_factory = Py_None;
+
+    Py_INCREF(default_factory);
+    return default_factory;
+}
+
+static int
+IdentityDefaultDict_set_default_factory(PyObject *self, PyObject *value, void *_)
+{
+    if (value == NULL)
+        value = Py_None;
+
+    if (value != Py_None && !PyCallable_Check(value)) {
+        PyErr_SetString(PyExc_TypeError, "default_factory must be callable or None");
+        return -1;
+    }
+
+    Py_INCREF(value);
+    Py_XSETREF(((IdentityDefaultDict *)self)->default_factory, value);
+
+    return 0;
+}
+
+PyDoc_STRVAR(IdentityDefaultDict_copy__doc__,
+"Return a shallow copy of D, with the same default_factory.\n"
+"\n"
+"IdentityDefaultDict.copy()");
+
+static PyObject *
+IdentityDefaultDict_copy(PyObject *self, PyObject *_)
+{
+    IdentityDict *this = (IdentityDict *)self;
+    PyObject *copy = IdentityDict_new(Py_TYPE(self), this->used, this->max_load,
+                                      this->growth_factor, this->min_load);
+
+    if (copy == NULL)
+        return NULL;
+
+    ((IdentityDefaultDict *)copy)->default_factory =
+        IdentityDefaultDict_default_factory(self, NULL);
+
+    if (merge_entries((IdentityDict *)copy, this) == -1) {
+        Py_DECREF(copy);
+        return NULL;
+    }
+
+    return copy;
+}
+
+static PyMethodDef
+IdentityDefaultDict_methods[] = {
+    {"copy", IdentityDefaultDict_copy, METH_NOARGS, IdentityDefaultDict_copy__doc__},
+    {NULL, NULL} /* sentinel */
+};
+
+static PyGetSetDef
+IdentityDefaultDict_getset[] = {
+    {"default_factory", IdentityDefaultDict_default_factory, IdentityDefaultDict_set_default_factory,
+     "Called without arguments for the value of a missing key, if not None."},
+    {0}
+};
+
+static PyMappingMethods
+IdentityDefaultDict_as_mapping = {
+    IdentityDict__len__,            /* mp_length */
+    IdentityDefaultDict__getitem__, /* mp_subscript */
+    IdentityDict__setitem__,        /* mp_ass_subscript */
+};
+
+static PyTypeObject
+IdentityDefaultDict_type = {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    "b._collections.IdentityDefaultDict", /* tp_name */
+    sizeof(IdentityDefaultDict),    /* tp_basicsize */
+    0,                              /* tp_itemsize */
+    IdentityDefaultDict__del__,     /* tp_dealloc */
+    0,                              /* tp_print */
+    0,                              /* tp_getattr */
+    0,                              /* tp_setattr */
+    0,                              /* tp_reserved */
+    0,                              /* tp_repr */
+    0,                              /* tp_as_number */
+    0,                              /* tp_as_sequence */
+    &IdentityDefaultDict_as_mapping, /* tp_as_mapping */
+    0,                              /* tp_hash  */
+    0,                              /* tp_call */
+    0,                              /* tp_str */
+    0,                              /* tp_getattro */
+    0,                              /* tp_setattro */
+    0,                              /* tp_as_buffer */
+    Py_TPFLAGS_DEFAULT |
+    Py_TPFLAGS_BASETYPE |
+    Py_TPFLAGS_HAVE_GC,             /* tp_flags */
+    IdentityDefaultDict__doc__,     /* tp_doc */
+    IdentityDefaultDict__traverse__, /* tp_traverse */
+    IdentityDefaultDict__clear__,   /* tp_clear */
+    0,                              /* tp_richcompare */
+    0,                              /* tp_weaklistoffset */
+    0,                              /* tp_iter */
+    0,                              /* tp_iternext */
+    IdentityDefaultDict_methods,    /* tp_methods */
+    0,                              /* tp_members */
+    IdentityDefaultDict_getset,     /* tp_getset */
+    &IdentityDict_type,             /* tp_base */
+    0,                              /* tp_dict */
+    0,                              /* tp_descr_get */
+    0,                              /* tp_descr_set */
+    0,                              /* tp_dictoffset */
+    0,                              /* tp_init */
+    0,                              /* tp_alloc */
+    IdentityDefaultDict__new__,     /* tp_new */
+};
+
+/* IdentityDictIterator */
+
+typedef struct {
+    PyObject_HEAD
+    IdentityDict *dict;
+    Py_ssize_t index;
+} IdentityDictIterator;
+
+static PyObject *
+IdentityDictIterator_new(PyTypeObject *type, IdentityDict *dict)
+{
+    IdentityDictIterator *this = PyObject_GC_New(IdentityDictIterator, type);
+    if (this == NULL)
+        return NULL;
+
+    Py_INCREF(dict);
+
+    this->dict = dict;
+    this->index = 0;
+
+    PyObject_GC_Track(this);
+
+    return (PyObject *)this;
+}
+
+static void
+IdentityDictIterator__del__(PyObject *self)
+{
+    PyObject_GC_UnTrack(self);
+    Py_XDECREF(((IdentityDictIterator *)self)->dict);
+    PyObject_GC_Del(self);
+}
+
+static int
+IdentityDictIterator__traverse__(PyObject *self, visitproc visit, void *arg)
+{
+    Py_VISIT(((IdentityDictIterator *)self)->dict);
+    return 0;
+}
+
+static PyObject *
+IdentityDictIterator__length_hint__(PyObject *self, PyObject *args)
+{
+    IdentityDictIterator *this = (IdentityDictIterator *)self;
+    IdentityDict *dict = this->dict;
+    Py_ssize_t length;
+
+    if (dict == NULL) {
+        length = 0;
+    } else {
+        /* TODO: account for count already iterated */
+        length = IdentityDict__len__((PyObject *)dict);
+    }
+
+    return PyLong_FromSsize_t(length);
+}
+
+/* Iterator __next__ */
+
+static PyObject *
+IdentityDictKeysIterator__next__(PyObject *self)
+{
+    IdentityDictIterator *this = (IdentityDictIterator *)self;
+    IdentityDict *dict = this->dict;
+
+    if (dict == NULL)
+        return NULL;
+
+    Py_ssize_t i, nentries;
+
+    PyObject *key;
+
+    for (i = this->index, nentries = dict->table->nentries; i < nentries; i++) {
+        key = ENTRY_KEY(dict->table, i);
+
+        if (key != NULL) {
+            Py_INCREF(key);
+            this->index = i + 1;
+            return key;
+        }
+    }
+
+    /* Exhausted */
+    Py_DECREF(dict);
+    this->dict = NULL;
+    return NULL;
+}
+
+static PyObject *
+IdentityDictItemsIterator__next__(PyObject *self)
+{
+    IdentityDictIterator *this = (IdentityDictIterator *)self;
+    IdentityDict *dict = this->dict;
+
+    if (dict == NULL)
+        return NULL;
+
+    Py_ssize_t i, nentries;
+
+    PyObject *key, *item, *value;
+
+    for (i = this->index, nentries = dict->table->nentries; i < nentries; i++) {
+        key = ENTRY_KEY(dict->table, i);
+
+        if (key != NULL) {
+            value = ENTRY_VALUE(dict->table, i);
+
+            item = PyTuple_New(2);
+            if (item == NULL)
+                return NULL;
+
+            Py_INCREF(key);
+            Py_INCREF(value);
+
+            /* "steals" references */
+            PyTuple_SET_ITEM(item, 0, key);
+            PyTuple_SET_ITEM(item, 1, value);
+
+            this->index = i + 1;
+
+            return item;
+        }
+    }
+
+    /* Exhausted */
+    Py_DECREF(dict);
+    this->dict = NULL;
+    return NULL;
+}
+
+static PyObject *
+IdentityDictValuesIterator__next__(PyObject *self)
+{
+    IdentityDictIterator *this = (IdentityDictIterator *)self;
+    IdentityDict *dict = this->dict;
+
+    if (dict == NULL)
+        return NULL;
+
+    Py_ssize_t i, nentries;
+
+    PyObject *key, *value;
+
+    for (i = this->index, nentries = dict->table->nentries; i < nentries; i++) {
+        key = ENTRY_KEY(dict->table, i);
+
+        if (key != NULL) {
+            value = ENTRY_VALUE(dict->table, i);
+
+            Py_INCREF(value);
+
+            this->index = i + 1;
+
+            return value;
+        }
+    }
+
+    /* Exhausted */
+    Py_DECREF(dict);
+    this->dict = NULL;
+    return NULL;
+}
+
+static PyMethodDef
+IdentityDictIterator_methods[] = {
+    {"__length_hint__", IdentityDictIterator__length_hint__, METH_NOARGS, NULL},
+    {NULL, NULL} /* sentinel */
+};
+
+static PyTypeObject
+IdentityDictKeysIterator_type = {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    "b._collections.IdentityDictKeysIterator", /* tp_name */
+    sizeof(IdentityDictIterator),       /* tp_basicsize */
+    0,                                  /* tp_itemsize */
+    IdentityDictIterator__del__,        /* tp_dealloc */
+    0,                                  /* tp_print */
+    0,                                  /* tp_getattr */
+    0,                                  /* tp_setattr */
+    0,                                  /* tp_reserved */
+    0,                                  /* tp_repr */
+    0,                                  /* tp_as_number */
+    0,                                  /* tp_as_sequence */
+    0,                                  /* tp_as_mapping */
+    0,                                  /* tp_hash  */
+    0,                                  /* tp_call */
+    0,                                  /* tp_str */
+    PyObject_GenericGetAttr,            /* tp_getattro */
+    0,                                  /* tp_setattro */
+    0,                                  /* tp_as_buffer */
+    Py_TPFLAGS_DEFAULT |
+    Py_TPFLAGS_HAVE_GC,                 /* tp_flags */
+    0,                                  /* tp_doc */
+    IdentityDictIterator__traverse__,   /* tp_traverse */
+    0,                                  /* tp_clear */
+    0,                                  /* tp_richcompare */
+    0,                                  /* tp_weaklistoffset */
+    PyObject_SelfIter,                  /* tp_iter */
+    IdentityDictKeysIterator__next__,   /* tp_iternext */
+    IdentityDictIterator_methods,       /* tp_methods */
+};
+
+static PyTypeObject
+IdentityDictItemsIterator_type = {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    "b._collections.IdentityDictItemsIterator", /* tp_name */
+    sizeof(IdentityDictIterator),       /* tp_basicsize */
+    0,                                  /* tp_itemsize */
+    IdentityDictIterator__del__,        /* tp_dealloc */
+    0,                                  /* tp_print */
+    0,                                  /* tp_getattr */
+    0,                                  /* tp_setattr */
+    0,                                  /* tp_reserved */
+    0,                                  /* tp_repr */
+    0,                                  /* tp_as_number */
+    0,                                  /* tp_as_sequence */
+    0,                                  /* tp_as_mapping */
+    0,                                  /* tp_hash  */
+    0,                                  /* tp_call */
+    0,                                  /* tp_str */
+    PyObject_GenericGetAttr,            /* tp_getattro */
+    0,                                  /* tp_setattro */
+    0,                                  /* tp_as_buffer */
+    Py_TPFLAGS_DEFAULT |
+    Py_TPFLAGS_HAVE_GC,                 /* tp_flags */
+    0,                                  /* tp_doc */
+    IdentityDictIterator__traverse__,   /* tp_traverse */
+    0,                                  /* tp_clear */
+    0,                                  /* tp_richcompare */
+    0,                                  /* tp_weaklistoffset */
+    PyObject_SelfIter,                  /* tp_iter */
+    IdentityDictItemsIterator__next__,  /* tp_iternext */
+    IdentityDictIterator_methods,       /* tp_methods */
+};
+
+static PyTypeObject
+IdentityDictValuesIterator_type = {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    "b._collections.IdentityDictValuesIterator", /* tp_name */
+    sizeof(IdentityDictIterator),       /* tp_basicsize */
+    0,                                  /* tp_itemsize */
+    IdentityDictIterator__del__,        /* tp_dealloc */
+    0,                                  /* tp_print */
+    0,                                  /* tp_getattr */
+    0,                                  /* tp_setattr */
+    0,                                  /* tp_reserved */
+    0,                                  /* tp_repr */
+    0,                                  /* tp_as_number */
+    0,                                  /* tp_as_sequence */
+    0,                                  /* tp_as_mapping */
+    0,                                  /* tp_hash  */
+    0,                                  /* tp_call */
+    0,                                  /* tp_str */
+    PyObject_GenericGetAttr,            /* tp_getattro */
+    0,                                  /* tp_setattro */
+    0,                                  /* tp_as_buffer */
+    Py_TPFLAGS_DEFAULT |
+    Py_TPFLAGS_HAVE_GC,                 /* tp_flags */
+    0,                                  /* tp_doc */
+    IdentityDictIterator__traverse__,   /* tp_traverse */
+    0,                                  /* tp_clear */
+    0,                                  /* tp_richcompare */
+    0,                                  /* tp_weaklistoffset */
+    PyObject_SelfIter,                  /* tp_iter */
+    IdentityDictValuesIterator__next__, /* tp_iternext */
+    IdentityDictIterator_methods,       /* tp_methods */
+};
+
+/* Views */
+
+typedef struct {
+    PyObject_HEAD
+    IdentityDict *dict;
+} IdentityDictView;
+
+static PyObject *
+IdentityDictView_new(PyTypeObject *type, IdentityDict *dict)
+{
+    IdentityDictView *this = PyObject_GC_New(IdentityDictView, type);
+    if (this == NULL)
+        return NULL;
+
+    Py_INCREF(dict);
+
+    this->dict = dict;
+
+    PyObject_GC_Track(this);
+
+    return (PyObject *)this;
+}
+
+static void
+IdentityDictView__del__(PyObject *self)
+{
+    PyObject_GC_UnTrack(self);
+    Py_XDECREF(((IdentityDictView *)self)->dict);
+    PyObject_GC_Del(self);
+}
+
+static int
+IdentityDictView__traverse__(PyObject *self, visitproc visit, void *arg)
+{
+    Py_VISIT(((IdentityDictView *)self)->dict);
+    return 0;
+}
+
+static Py_ssize_t
+IdentityDictView__len__(PyObject *self)
+{
+    return IdentityDict__len__((PyObject *)((IdentityDictView *)self)->dict);
+}
+
+/* View __contains__
+
+   By identity throughout, values included, so nothing calls `__eq__`.
+*/
+
+static int
+IdentityDictKeys__contains__(PyObject *self, PyObject *key)
+{
+    IdentityDict *dict = ((IdentityDictView *)self)->dict;
+    size_t slot;
+
+    return lookup(dict, key, hash_int(key), &slot) >= 0;
+}
+
+static int
+IdentityDictItems__contains__(PyObject *self, PyObject *item)
+{
+    IdentityDict *dict = ((IdentityDictView *)self)->dict;
+    PyObject *key;
+    Py_ssize_t ix;
+    size_t slot;
+
+    if (!PyTuple_Check(item) || PyTuple_GET_SIZE(item) != 2)
+        return 0;
+
+    key = PyTuple_GET_ITEM(item, 0);
+
+    ix = lookup(dict, key, hash_int(key), &slot);
+
+    return ix >= 0 && ENTRY_VALUE(dict->table, ix) == PyTuple_GET_ITEM(item, 1);
+}
+
+static int
+IdentityDictValues__contains__(PyObject *self, PyObject *value)
+{
+    Table *table = ((IdentityDictView *)self)->dict->table;
+    Py_ssize_t i, nentries;
+
+    for (i = 0, nentries = table->nentries; i < nentries; i++) {
+        if (ENTRY_KEY(table, i) != NULL && ENTRY_VALUE(table, i) == value)
+            return 1;
+    }
+
+    return 0;
+}
+
+/* View set algebra
+
+   Keys views combine with keys views, IdentityDicts and iterables of
+   keys; items views with items views and iterables of (key, value)
+   pairs, an item matching only the same key with the same value.  The
+   result is a new IdentityDict, each key with its value from the left
+   operand if there, else the right, else None.  Each operation iterates
+   the smaller side, probing the larger or a copy of it.
+*/
+
+enum {VIEW_AND, VIEW_OR, VIEW_SUB, VIEW_XOR};
+
+/* The IdentityDict behind the keys or items view `operand`, else a new one
+   of the keys or items it iterates */
+static IdentityDict *
+view_operand(PyObject *operand, PyTypeObject *type)
+{
+    PyObject *args, *dict;
+
+    if (Py_TYPE(operand) == type) {
+        dict = (PyObject *)((IdentityDictView *)operand)->dict;
+        Py_INCREF(dict);
+        return (IdentityDict *)dict;
+    }
+
+    if (type == &IdentityDictKeys_type) {
+        if (PyObject_TypeCheck(operand, &IdentityDict_type)) {
+            Py_INCREF(operand);
+            return (IdentityDict *)operand;
+        }
+
+        args = PyTuple_Pack(1, operand);
+        if (args == NULL)
+            return NULL;
+
+        dict = IdentityDict_fromkeys((PyObject *)&IdentityDict_type, args);
+
+        Py_DECREF(args);
+        return (IdentityDict *)dict;
+    }
+
+    dict = IdentityDict_new(&IdentityDict_type, 0, DEFAULT_MAX_LOAD, DEFAULT_GROWTH_FACTOR, MIN_LOAD_DEFAULT);
+    if (dict == NULL)
+        return NULL;
+
+    if (merge_pairs((IdentityDict *)dict, operand) == -1) {
+        Py_DECREF(dict);
+        return NULL;
+    }
+
+    return (IdentityDict *)dict;
+}
+
+/* The value of `key` in `dict`, borrowed, else NULL */
+static inline PyObject *
+view_find(IdentityDict *dict, PyObject *key)
+{
+    size_t slot;
+    Py_ssize_t ix = lookup(dict, key, hash_int(key), &slot);
+
+    return ix < 0 ? NULL : ENTRY_VALUE(dict->table, ix);
+}
+
+/* `result[key] = value`, or `del result[key]` for a NULL `value`, holding
+   references to both throughout, as the entry they come from may go */
+static inline int
+view_put(PyObject *result, PyObject *key, PyObject *value)
+{
+    int status;
+
+    Py_INCREF(key);
+    Py_XINCREF(value);
+
+    status = IdentityDict__setitem__(result, key, value);
+
+    Py_DECREF(key);
+    Py_XDECREF(value);
+
+    return status;
+}
+
+/* `a op b`, for `items` views or else keys views.
+
+   Walks the smaller side, either into an empty IdentityDict (&, and -
+   with `a` the smaller) checking the other side, or over a copy of the
+   other side (|, ^, and - with `b` the smaller) changing it.
+*/
+static PyObject *
+view_combine(IdentityDict *a, IdentityDict *b, int op, int items)
+{
+    IdentityDict *walk = a->used <= b->used ? a : b;
+    IdentityDict *other = walk == a ? b : a;
+    int from_empty = op == VIEW_AND || (op == VIEW_SUB && walk == a);
+
+    PyObject *result, *key, *value, *found;
+    Py_ssize_t i;
+    int status, in_other;
+
+    if (from_empty)
+        result = IdentityDict_new(&IdentityDict_type, 0, DEFAULT_MAX_LOAD, DEFAULT_GROWTH_FACTOR, MIN_LOAD_DEFAULT);
+    else
+        result = IdentityDict_copy((PyObject *)other);
+
+    if (result == NULL)
+        return NULL;
+
+    /* Reload the table each time round, as changing `result` may re-enter. */
+    for (i = 0; i < walk->table->nentries; i++) {
+        key = ENTRY_KEY(walk->table, i);
+        if (key == NULL)
+            continue;
+
+        value = ENTRY_VALUE(walk->table, i);
+
+        found = view_find(from_empty ? other : (IdentityDict *)result, key);
+        in_other = found != NULL && (!items || found == value);
+
+        switch (op) {
+        case VIEW_AND:
+            status = in_other ? view_put(result, key, walk == a ? value : found) : 0;
+            break;
+        case VIEW_OR:
+            /* The left value wins */
+            status = walk == a || !in_other ? view_put(result, key, value) : 0;
+            break;
+        case VIEW_SUB:
+            if (walk == a)
+                status = in_other ? 0 : view_put(result, key, value);
+            else
+                status = in_other ? view_put(result, key, NULL) : 0;
+            break;
+        default:
+            status = view_put(result, key, in_other ? NULL : value);
+        }
+
+        if (status == -1) {
+            Py_DECREF(result);
+            return NULL;
+        }
+    }
+
+    return result;
+}
+
+static PyObject *
+view_operator(PyObject *left, PyObject *right, PyTypeObject *type, int op)
+{
+    IdentityDict *a, *b;
+    PyObject *result;
+
+    a = view_operand(left, type);
+    if (a == NULL)
+        return NULL;
+
+    b = view_operand(right, type);
+    if (b == NULL) {
+        Py_DECREF(a);
+        return NULL;
+    }
+
+    result = view_combine(a, b, op, type == &IdentityDictItems_type);
+
+    Py_DECREF(a);
+    Py_DECREF(b);
+
+    return result;
+}
+
+static PyObject *
+IdentityDictKeys__and__(PyObject *left, PyObject *right)
+{
+    return view_operator(left, right, &IdentityDictKeys_type, VIEW_AND);
+}
+
+static PyObject *
+IdentityDictKeys__or__(PyObject *left, PyObject *right)
+{
+    return view_operator(left, right, &IdentityDictKeys_type, VIEW_OR);
+}
+
+static PyObject *
+IdentityDictKeys__sub__(PyObject *left, PyObject *right)
+{
+    return view_operator(left, right, &IdentityDictKeys_type, VIEW_SUB);
+}
+
+static PyObject *
+IdentityDictKeys__xor__(PyObject *left, PyObject *right)
+{
+    return view_operator(left, right, &IdentityDictKeys_type, VIEW_XOR);
+}
+
+static PyObject *
+IdentityDictItems__and__(PyObject *left, PyObject *right)
+{
+    return view_operator(left, right, &IdentityDictItems_type, VIEW_AND);
+}
+
+static PyObject *
+IdentityDictItems__sub__(PyObject *left, PyObject *right)
+{
+    return view_operator(left, right, &IdentityDictItems_type, VIEW_SUB);
+}
+
+/* View __iter__ */
+
+static PyObject *
+IdentityDictKeys__iter__(PyObject *self)
+{
+    return IdentityDictIterator_new(
+        &IdentityDictKeysIterator_type,
+        ((IdentityDictView *)self)->dict
+        );
+}
+
+
+static PyObject *
+IdentityDictItems__iter__(PyObject *self)
+{
+    return IdentityDictIterator_new(
+        &IdentityDictItemsIterator_type,
+        ((IdentityDictView *)self)->dict
+        );
+}
+
+
+static PyObject *
+IdentityDictValues__iter__(PyObject *self)
+{
+    return IdentityDictIterator_new(
+        &IdentityDictValuesIterator_type,
+        ((IdentityDictView *)self)->dict
+        );
+}
+
+/* View as_sequence */
+
+static PySequenceMethods
+IdentityDictKeys_as_sequence = {
+    IdentityDictView__len__,         /* sq_length */
+    0,                               /* sq_concat */
+    0,                               /* sq_repeat */
+    0,                               /* sq_item */
+    0,                               /* sq_slice */
+    0,                               /* sq_ass_item */
+    0,                               /* sq_ass_slice */
+    IdentityDictKeys__contains__,    /* sq_contains */
+};
+
+static PySequenceMethods
+IdentityDictItems_as_sequence = {
+    IdentityDictView__len__,         /* sq_length */
+    0,                               /* sq_concat */
+    0,                               /* sq_repeat */
+    0,                               /* sq_item */
+    0,                               /* sq_slice */
+    0,                               /* sq_ass_item */
+    0,                               /* sq_ass_slice */
+    IdentityDictItems__contains__,   /* sq_contains */
+};
+
+static PySequenceMethods
+IdentityDictValues_as_sequence = {
+    IdentityDictView__len__,         /* sq_length */
+    0,                               /* sq_concat */
+    0,                               /* sq_repeat */
+    0,                               /* sq_item */
+    0,                               /* sq_slice */
+    0,                               /* sq_ass_item */
+    0,                               /* sq_ass_slice */
+    IdentityDictValues__contains__,  /* sq_contains */
+};
+
+/* View as_number, for the set algebra */
+
+static PyNumberMethods
+IdentityDictKeys_as_number = {
+    0,                               /* nb_add */
+    IdentityDictKeys__sub__,         /* nb_subtract */
+    0,                               /* nb_multiply */
+    0,                               /* nb_remainder */
+    0,                               /* nb_divmod */
+    0,                               /* nb_power */
+    0,                               /* nb_negative */
+    0,                               /* nb_positive */
+    0,                               /* nb_absolute */
+    0,                               /* nb_bool */
+    0,                               /* nb_invert */
+    0,                               /* nb_lshift */
+    0,                               /* nb_rshift */
+    IdentityDictKeys__and__,         /* nb_and */
+    IdentityDictKeys__xor__,         /* nb_xor */
+    IdentityDictKeys__or__,          /* nb_or */
+};
+
+static PyNumberMethods
+IdentityDictItems_as_number = {
+    0,                               /* nb_add */
+    IdentityDictItems__sub__,        /* nb_subtract */
+    0,                               /* nb_multiply */
+    0,                               /* nb_remainder */
+    0,                               /* nb_divmod */
+    0,                               /* nb_power */
+    0,                               /* nb_negative */
+    0,                               /* nb_positive */
+    0,                               /* nb_absolute */
+    0,                               /* nb_bool */
+    0,                               /* nb_invert */
+    0,                               /* nb_lshift */
+    0,                               /* nb_rshift */
+    IdentityDictItems__and__,        /* nb_and */
+};
+
+/* View type */
+
+static PyTypeObject
+IdentityDictKeys_type = {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    "b._collections.IdentityDictKeys", /* tp_name */
+    sizeof(IdentityDictView),       /* tp_basicsize */
+    0,                              /* tp_itemsize */
+    IdentityDictView__del__,        /* tp_dealloc */
+    0,                              /* tp_print */
+    0,                              /* tp_getattr */
+    0,                              /* tp_setattr */
+    0,                              /* tp_reserved */
+    0,                              /* tp_repr */
+    &IdentityDictKeys_as_number,    /* tp_as_number */
+    &IdentityDictKeys_as_sequence,  /* tp_as_sequence */
+    0,                              /* tp_as_mapping */
+    0,                              /* tp_hash  */
+    0,                              /* tp_call */
+    0,                              /* tp_str */
+    PyObject_GenericGetAttr,        /* tp_getattro */
+    0,                              /* tp_setattro */
+    0,                              /* tp_as_buffer */
+    Py_TPFLAGS_DEFAULT |
+    Py_TPFLAGS_HAVE_GC,             /* tp_flags */
+    0,                              /* tp_doc */
+    IdentityDictView__traverse__,   /* tp_traverse */
+    0,                              /* tp_clear */
+    0,                              /* tp_richcompare */
+    0,                              /* tp_weaklistoffset */
+    IdentityDictKeys__iter__,       /* tp_iter */
+};
+
+static PyTypeObject
+IdentityDictItems_type = {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    "b._collections.IdentityDictItems", /* tp_name */
+    sizeof(IdentityDictView),       /* tp_basicsize */
+    0,                              /* tp_itemsize */
+    IdentityDictView__del__,        /* tp_dealloc */
+    0,                              /* tp_print */
+    0,                              /* tp_getattr */
+    0,                              /* tp_setattr */
+    0,                              /* tp_reserved */
+    0,                              /* tp_repr */
+    &IdentityDictItems_as_number,   /* tp_as_number */
+    &IdentityDictItems_as_sequence, /* tp_as_sequence */
+    0,                              /* tp_as_mapping */
+    0,                              /* tp_hash  */
+    0,                              /* tp_call */
+    0,                              /* tp_str */
+    PyObject_GenericGetAttr,        /* tp_getattro */
+    0,                              /* tp_setattro */
+    0,                              /* tp_as_buffer */
+    Py_TPFLAGS_DEFAULT |
+    Py_TPFLAGS_HAVE_GC,             /* tp_flags */
+    0,                              /* tp_doc */
+    IdentityDictView__traverse__,   /* tp_traverse */
+    0,                              /* tp_clear */
+    0,                              /* tp_richcompare */
+    0,                              /* tp_weaklistoffset */
+    IdentityDictItems__iter__,      /* tp_iter */
+};
+
+static PyTypeObject
+IdentityDictValues_type = {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    "b._collections.IdentityDictValues", /* tp_name */
+    sizeof(IdentityDictView),       /* tp_basicsize */
+    0,                              /* tp_itemsize */
+    IdentityDictView__del__,        /* tp_dealloc */
+    0,                              /* tp_print */
+    0,                              /* tp_getattr */
+    0,                              /* tp_setattr */
+    0,                              /* tp_reserved */
+    0,                              /* tp_repr */
+    0,                              /* tp_as_number */
+    &IdentityDictValues_as_sequence,/* tp_as_sequence */
+    0,                              /* tp_as_mapping */
+    0,                              /* tp_hash  */
+    0,                              /* tp_call */
+    0,                              /* tp_str */
+    PyObject_GenericGetAttr,        /* tp_getattro */
+    0,                              /* tp_setattro */
+    0,                              /* tp_as_buffer */
+    Py_TPFLAGS_DEFAULT |
+    Py_TPFLAGS_HAVE_GC,             /* tp_flags */
+    0,                              /* tp_doc */
+    IdentityDictView__traverse__,   /* tp_traverse */
+    0,                              /* tp_clear */
+    0,                              /* tp_richcompare */
+    0,                              /* tp_weaklistoffset */
+    IdentityDictValues__iter__,     /* tp_iter */
+};
+
+/* WeakIdentityRef
+
+   What a WeakIdentityDict keeps for each key: a weak reference to it,
+   calling back to the dict on its death, which also owns the value.  The
+   key's address stays behind, so that the callback can still find the
+   entry after the key is gone.
+*/
+
+typedef struct {
+    PyWeakReference ref;
+    PyObject *key;
+    PyObject *value;
+} WeakIdentityRef;
+
+static void
+WeakIdentityRef__del__(PyObject *self)
+{
+    PyObject *value = ((WeakIdentityRef *)self)->value;
+
+    /* Unhooked from the key before the value goes, as that may re-enter. */
+    _PyWeakref_RefType.tp_dealloc(self);
+
+    Py_XDECREF(value);
+}
+
+static int
+WeakIdentityRef__traverse__(PyObject *self, visitproc visit, void *arg)
+{
+    Py_VISIT(((WeakIdentityRef *)self)->value);
+
+    return _PyWeakref_RefType.tp_traverse(self, visit, arg);
+}
+
+static int
+WeakIdentityRef__clear__(PyObject *self)
+{
+    Py_CLEAR(((WeakIdentityRef *)self)->value);
+
+    return _PyWeakref_RefType.tp_clear(self);
+}
+
+static PyTypeObject
+WeakIdentityRef_type = {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    "b._collections.WeakIdentityRef", /* tp_name */
+    sizeof(WeakIdentityRef),        /* tp_basicsize */
+    0,                              /* tp_itemsize */
+    WeakIdentityRef__del__,         /* tp_dealloc */
+    0,                              /* tp_print */
+    0,                              /* tp_getattr */
+    0,                              /* tp_setattr */
+    0,                              /* tp_reserved */
+    0,                              /* tp_repr */
+    0,                              /* tp_as_number */
+    0,                              /* tp_as_sequence */
+    0,                              /* tp_as_mapping */
+    0,                              /* tp_hash  */
+    0,                              /* tp_call */
+    0,                              /* tp_str */
+    0,                              /* tp_getattro */
+    0,                              /* tp_setattro */
+    0,                              /* tp_as_buffer */
+    Py_TPFLAGS_DEFAULT |
+    Py_TPFLAGS_HAVE_GC,             /* tp_flags */
+    0,                              /* tp_doc */
+    WeakIdentityRef__traverse__,    /* tp_traverse */
+    WeakIdentityRef__clear__,       /* tp_clear */
+    0,                              /* tp_richcompare */
+    0,                              /* tp_weaklistoffset */
+    0,                              /* tp_iter */
+    0,                              /* tp_iternext */
+    0,                              /* tp_methods */
+    0,                              /* tp_members */
+    0,                              /* tp_getset */
+    0,                              /* tp_base: weakref, set on import */
+};
+
+/* WeakIdentityDict
+
+   The IdentityDict table, keyed on borrowed key addresses, with each
+   entry's value a WeakIdentityRef.  A dying key's callback finds and
+   deletes its entry by the same lookup as any other, so nothing is ever
+   scanned for dead keys, and nothing in here keeps a key alive.
+*/
+
+typedef struct {
+    IdentityDict dict;
+    PyObject *remove;
+    PyObject *weakreflist;
+} WeakIdentityDict;
+
+#define WEAK_REF(table, ix) ((WeakIdentityRef *)ENTRY_VALUE(table, ix))
+
+/* Return the position of the entry for `key`, else IX_EMPTY.
+
+   An entry whose key died without its callback deleting it (the callback
+   failed) can only be met again by a new object at the same address, so
+   counts as missing, and is taken over by `WeakIdentityDict__setitem__`.
+*/
+static inline Py_ssize_t
+weak_lookup(WeakIdentityDict *this, PyObject *key, Py_hash_t hash, size_t *slot)
+{
+    Table *table = this->dict.table;
+    Py_ssize_t ix = lookup(&this->dict, key, hash, slot);
+
+    if (ix >= 0 && PyWeakref_GET_OBJECT(ENTRY_VALUE(table, ix)) != key)
+        return IX_EMPTY;
+
+    return ix;
+}
+
+/* Delete the entry at `ix`, in `slot` */
+static void
+weak_delete(WeakIdentityDict *this, Py_ssize_t ix, size_t slot)
+{
+    Table *table = this->dict.table;
+    PyObject *ref = ENTRY_VALUE(table, ix);
+
+    /* Slot first, as the decref may re-enter. */
+    ENTRY_KEY(table, ix) = NULL;
+    ENTRY_VALUE(table, ix) = NULL;
+
+    mark_deleted(&this->dict, slot);
+
+    this->dict.used--;
+
+    maybe_shrink(&this->dict);
+
+    Py_DECREF(ref);
+}
+
+/* The callback of every WeakIdentityRef of the dict `selfref` refers to */
+static PyObject *
+WeakIdentityDict__remove(PyObject *selfref, PyObject *ref)
+{
+    PyObject *self = PyWeakref_GET_OBJECT(selfref);
+    WeakIdentityDict *this = (WeakIdentityDict *)self;
+    PyObject *key = ((WeakIdentityRef *)ref)->key;
+
+    Py_ssize_t ix;
+    size_t slot;
+
+    /* The dict died first */
+    if (self == Py_None)
+        Py_RETURN_NONE;
+
+    ix = lookup(&this->dict, key, hash_int(key), &slot);
+
+    if (ix >= 0 && ENTRY_VALUE(this->dict.table, ix) == ref) {
+        Py_INCREF(self);
+        weak_delete(this, ix, slot);
+        Py_DECREF(self);
+    }
+
+    Py_RETURN_NONE;
+}
+
+static PyMethodDef
+WeakIdentityDict_remove_def = {
+    "_remove", WeakIdentityDict__remove, METH_O, NULL
+};
+
+PyDoc_STRVAR(WeakIdentityDict__doc__,
+"Mapping by identity that holds its keys weakly.\n"
+"\n"
+"WeakIdentityDict(*, capacity=0, max_load=2/3, growth_factor=2, min_load=1/12)\n"
+"\n"
+"An item goes as soon as its key is collected; keys must be weakly referenceable.");
+
+static PyObject *
+WeakIdentityDict__new__(PyTypeObject *type, PyObject *args, PyObject *kwargs)
+{
+    PyObject *self = IdentityDict__new__(type, args, kwargs);
+    PyObject *selfref;
+    WeakIdentityDict *this = (WeakIdentityDict *)self;
+
+    if (self == NULL)
+        return NULL;
+
+    this->remove = NULL;
+    this->weakreflist = NULL;
+
+    selfref = PyWeakref_NewRef(self, NULL);
+    if (selfref == NULL)
+        goto error;
+
+    this->remove = PyCFunction_New(&WeakIdentityDict_remove_def, selfref);
+
+    Py_DECREF(selfref);
+
+    if (this->remove == NULL)
+        goto error;
+
+    return self;
+
+  error:
+    Py_DECREF(self);
+    return NULL;
+}
+
+static void
+WeakIdentityDict__del__(PyObject *self)
+{
+    WeakIdentityDict *this = (WeakIdentityDict *)self;
+    Table *table = this->dict.table;
+
+    Py_ssize_t i, nentries;
+
+    PyObject_GC_UnTrack(self);
+    Py_TRASHCAN_BEGIN(self, WeakIdentityDict__del__)
+
+    /* Callbacks from here on find the dict gone. */
+    if (this->weakreflist != NULL)
+        PyObject_ClearWeakRefs(self);
+
+    for (i = 0, nentries = table->nentries; i < nentries; i++)
+        Py_XDECREF(ENTRY_VALUE(table, i));
+
+    Py_XDECREF(this->remove);
+
+    Table_release(table);
+
+    Py_TYPE(self)->tp_free(self);
+
+    Py_TRASHCAN_END
+}
+
+static int
+WeakIdentityDict__traverse__(PyObject *self, visitproc visit, void *arg)
+{
+    WeakIdentityDict *this = (WeakIdentityDict *)self;
+    Table *table = this->dict.table;
+
+    Py_ssize_t i, nentries;
+
+    for (i = 0, nentries = table->nentries; i < nentries; i++)
+        Py_VISIT(ENTRY_VALUE(table, i));
+
+    Py_VISIT(this->remove);
+
+    return 0;
+}
+
+/* As `IdentityDict__clear__` */
+static int
+WeakIdentityDict__clear__(PyObject *self)
+{
+    WeakIdentityDict *this = (WeakIdentityDict *)self;
+    Table *table;
+
+    PyObject *ref;
+    Py_ssize_t i;
+
+    for (i = 0; i < this->dict.table->nentries; i++) {
+        ref = ENTRY_VALUE(this->dict.table, i);
+        if (ref == NULL)
+            continue;
+
+        ENTRY_KEY(this->dict.table, i) = NULL;
+        ENTRY_VALUE(this->dict.table, i) = NULL;
+
+        this->dict.used--;
+
+        Py_DECREF(ref);
+    }
+
+    if (this->dict.used == 0) {
+        table = this->dict.table;
+
+        if (!IS_SMALL(table) && this->dict.min_load > 0.0) {
+            resize(&this->dict, 0);
+            return 0;
+        }
+
+        memset(table->ctrl, CTRL_EMPTY, table->size);
+
+        table->usable = TABLE_CAPACITY(table);
+        table->nentries = 0;
+
+        this->dict.version++;
+    }
+
+    return 0;
+}
+
+static PyObject *
+WeakIdentityDict__getitem__(PyObject *self, PyObject *key)
+{
+    WeakIdentityDict *this = (WeakIdentityDict *)self;
+
+    PyObject *value;
+    Py_ssize_t ix;
+    size_t slot;
+
+    ix = weak_lookup(this, key, hash_int(key), &slot);
+
+    if (ix < 0) {
+        _PyErr_SetKeyError(key);
+        return NULL;
+    }
+
+    value = WEAK_REF(this->dict.table, ix)->value;
+    Py_INCREF(value);
+    return value;
+}
+
+static int
+WeakIdentityDict__setitem__(PyObject *self, PyObject *key, PyObject *value)
+{
+    WeakIdentityDict *this = (WeakIdentityDict *)self;
+
+    PyObject *ref, *old;
+    Py_ssize_t ix;
+    size_t slot;
+
+    Py_hash_t hash = hash_int(key);
+
+    ix = weak_lookup(this, key, hash, &slot);
+
+    if (value == NULL) {
+        if (ix < 0) {
+            _PyErr_SetKeyError(key);
+            return -1;
+        }
+
+        weak_delete(this, ix, slot);
+        return 0;
+    }
+
+    if (ix >= 0) {
+        old = WEAK_REF(this->dict.table, ix)->value;
+
+        Py_INCREF(value);
+        WEAK_REF(this->dict.table, ix)->value = value;
+
+        Py_DECREF(old);
+        return 0;
+    }
+
+    ref = PyObject_CallFunctionObjArgs((PyObject *)&WeakIdentityRef_type, key, this->remove, NULL);
+    if (ref == NULL)
+        return -1;
+
+    Py_INCREF(value);
+
+    ((WeakIdentityRef *)ref)->key = key;
+    ((WeakIdentityRef *)ref)->value = value;
+
+    /* A dead key's entry at the same address: take it over. */
+    ix = lookup(&this->dict, key, hash, &slot);
+
+    if (ix >= 0) {
+        old = ENTRY_VALUE(this->dict.table, ix);
+        ENTRY_VALUE(this->dict.table, ix) = ref;
+
+        Py_DECREF(old);
+        return 0;
+    }
+
+    if (append((IdentityDict *)this, key, hash, ref) == -1) {
+        Py_DECREF(ref);
+        return -1;
+    }
+
+    return 0;
+}
+
+static int
+WeakIdentityDict__contains__(PyObject *self, PyObject *key)
+{
+    size_t slot;
+
+    return weak_lookup((WeakIdentityDict *)self, key, hash_int(key), &slot) >= 0;
+}
+
+/* A list of the live keys, values or (key, value) pairs, in insertion order */
+enum {WEAK_KEYS, WEAK_VALUES, WEAK_ITEMS};
+
+static PyObject *
+weak_list(WeakIdentityDict *this, int what)
+{
+    Table *table = this->dict.table;
+
+    PyObject *list, *key, *item;
+    Py_ssize_t i, nentries;
+    int status;
+
+    list = PyList_New(0);
+    if (list == NULL)
+        return NULL;
+
+    for (i = 0, nentries = table->nentries; i < nentries; i++) {
+        if (ENTRY_VALUE(table, i) == NULL)
+            continue;
+
+        key = PyWeakref_GET_OBJECT(ENTRY_VALUE(table, i));
+        if (key != ENTRY_KEY(table, i))
+            continue;
+
+        switch (what) {
+        case WEAK_KEYS:
+            status = PyList_Append(list, key);
+            break;
+        case WEAK_VALUES:
+            status = PyList_Append(list, WEAK_REF(table, i)->value);
+            break;
+        default:
+            item = PyTuple_Pack(2, key, WEAK_REF(table, i)->value);
+            if (item == NULL)
+                goto error;
+
+            status = PyList_Append(list, item);
+            Py_DECREF(item);
+        }
+
+        if (status == -1)
+            goto error;
+    }
+
+    return list;
+
+  error:
+    Py_DECREF(list);
+    return NULL;
+}
+
+/* Over a snapshot of the keys, as any of them may die mid-iteration */
+static PyObject *
+WeakIdentityDict__iter__(PyObject *self)
+{
+    PyObject *keys = weak_list((WeakIdentityDict *)self, WEAK_KEYS);
+    PyObject *iterator;
+
+    if (keys == NULL)
+        return NULL;
+
+    iterator = PyObject_GetIter(keys);
+    Py_DECREF(keys);
+    return iterator;
+}
+
+PyDoc_STRVAR(WeakIdentityDict_get__doc__,
+"self[key] if key in self, else default (which is None if not provided).\n"
+"\n"
+"WeakIdentityDict.get(key, default=None)");
+
+static PyObject *
+WeakIdentityDict_get(PyObject *self, PyObject *const *args, Py_ssize_t nargs)
+{
+    WeakIdentityDict *this = (WeakIdentityDict *)self;
+
+    PyObject *value;
+    Py_ssize_t ix;
+    size_t slot;
+
+    if (!_PyArg_CheckPositional("get", nargs, 1, 2))
+        return NULL;
+
+    ix = weak_lookup(this, args[0], hash_int(args[0]), &slot);
+
+    if (ix >= 0)
+        value = WEAK_REF(this->dict.table, ix)->value;
+    else
+        value = nargs > 1 ? args[1] : Py_None;
+
+    Py_INCREF(value);
+    return value;
+}
+
+PyDoc_STRVAR(WeakIdentityDict_pop__doc__,
+"Remove a specified key and return its corresponding value.\n"
+"\n"
+"WeakIdentityDict.pop(key, default=None)\n"
+"\n"
+"If absent and `default` is provided, return `default`.\n"
+"If absent and `default` is NOT provided, raise `KeyError`.");
+
+static PyObject *
+WeakIdentityDict_pop(PyObject *self, PyObject *const *args, Py_ssize_t nargs)
+{
+    WeakIdentityDict *this = (WeakIdentityDict *)self;
+
+    PyObject *value;
+    Py_ssize_t ix;
+    size_t slot;
+
+    if (!_PyArg_CheckPositional("pop", nargs, 1, 2))
+        return NULL;
+
+    ix = weak_lookup(this, args[0], hash_int(args[0]), &slot);
+
+    if (ix < 0) {
+        if (nargs < 2) {
+            _PyErr_SetKeyError(args[0]);
+            return NULL;
+        }
+
+        Py_INCREF(args[1]);
+        return args[1];
+    }
+
+    value = WEAK_REF(this->dict.table, ix)->value;
+    Py_INCREF(value);
+
+    weak_delete(this, ix, slot);
+
+    return value;
+}
+
+PyDoc_STRVAR(WeakIdentityDict_keys__doc__,
+"Return a list of the live keys.\n"
+"\n"
+"WeakIdentityDict.keys()");
+
+static PyObject *
+WeakIdentityDict_keys(PyObject *self, PyObject *_)
+{
+    return weak_list((WeakIdentityDict *)self, WEAK_KEYS);
+}
+
+PyDoc_STRVAR(WeakIdentityDict_values__doc__,
+"Return a list of the values of the live keys.\n"
+"\n"
+"WeakIdentityDict.values()");
+
+static PyObject *
+WeakIdentityDict_values(PyObject *self, PyObject *_)
+{
+    return weak_list((WeakIdentityDict *)self, WEAK_VALUES);
+}
+
+PyDoc_STRVAR(WeakIdentityDict_items__doc__,
+"Return a list of the (key, value) pairs of the live keys.\n"
+"\n"
+"WeakIdentityDict.items()");
+
+static PyObject *
+WeakIdentityDict_items(PyObject *self, PyObject *_)
+{
+    return weak_list((WeakIdentityDict *)self, WEAK_ITEMS);
+}
+
+PyDoc_STRVAR(WeakIdentityDict_clear__doc__,
+"Remove all items from D.\n"
+"\n"
+"WeakIdentityDict.clear()");
+
+static PyObject *
+WeakIdentityDict_clear(PyObject *self, PyObject *_)
+{
+    WeakIdentityDict__clear__(self);
+
+    Py_RETURN_NONE;
+}
+
+static PyMethodDef
+WeakIdentityDict_methods[] = {
+    {"get", (PyCFunction)(void(*)(void))WeakIdentityDict_get, METH_FASTCALL, WeakIdentityDict_get__doc__},
+    {"pop", (PyCFunction)(void(*)(void))WeakIdentityDict_pop, METH_FASTCALL, WeakIdentityDict_pop__doc__},
+    {"keys", WeakIdentityDict_keys, METH_NOARGS, WeakIdentityDict_keys__doc__},
+    {"values", WeakIdentityDict_values, METH_NOARGS, WeakIdentityDict_values__doc__},
+    {"items", WeakIdentityDict_items, METH_NOARGS, WeakIdentityDict_items__doc__},
+    {"clear", WeakIdentityDict_clear, METH_NOARGS, WeakIdentityDict_clear__doc__},
+    {"__sizeof__", IdentityDict__sizeof__, METH_NOARGS, IdentityDict__sizeof____doc__},
+    {NULL, NULL} /* sentinel */
+};
+
+static PyMappingMethods
+WeakIdentityDict_as_mapping = {
+    IdentityDict__len__,          /* mp_length */
+    WeakIdentityDict__getitem__,  /* mp_subscript */
+    WeakIdentityDict__setitem__,  /* mp_ass_subscript */
+};
+
+static PySequenceMethods
+WeakIdentityDict_as_sequence = {
+    0,                              /* sq_length */
+    0,                              /* sq_concat */
+    0,                              /* sq_repeat */
+    0,                              /* sq_item */
+    0,                              /* sq_slice */
+    0,                              /* sq_ass_item */
+    0,                              /* sq_ass_slice */
+    WeakIdentityDict__contains__,   /* sq_contains */
+    0,                              /* sq_inplace_concat */
+    0,                              /* sq_inplace_repeat */
+};
+
+static PyTypeObject
+WeakIdentityDict_type = {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    "b._collections.WeakIdentityDict", /* tp_name */
+    sizeof(WeakIdentityDict),       /* tp_basicsize */
+    0,                              /* tp_itemsize */
+    WeakIdentityDict__del__,        /* tp_dealloc */
+    0,                              /* tp_print */
+    0,                              /* tp_getattr */
+    0,                              /* tp_setattr */
+    0,                              /* tp_reserved */
+    0,                              /* tp_repr */
+    0,                              /* tp_as_number */
+    &WeakIdentityDict_as_sequence,  /* tp_as_sequence */
+    &WeakIdentityDict_as_mapping,   /* tp_as_mapping */
+    0,                              /* tp_hash  */
+    0,                              /* tp_call */
+    0,                              /* tp_str */
+    0,                              /* tp_getattro */
+    0,                              /* tp_setattro */
+    0,                              /* tp_as_buffer */
+    Py_TPFLAGS_DEFAULT |
+    Py_TPFLAGS_HAVE_GC,             /* tp_flags */
+    WeakIdentityDict__doc__,        /* tp_doc */
+    WeakIdentityDict__traverse__,   /* tp_traverse */
+    WeakIdentityDict__clear__,      /* tp_clear */
+    0,                              /* tp_richcompare */
+    offsetof(WeakIdentityDict, weakreflist), /* tp_weaklistoffset */
+    WeakIdentityDict__iter__,       /* tp_iter */
+    0,                              /* tp_iternext */
+    WeakIdentityDict_methods,       /* tp_methods */
+    0,                              /* tp_members */
+    0,                              /* tp_getset */
+    0,                              /* tp_base */
+    0,                              /* tp_dict */
+    0,                              /* tp_descr_get */
+    0,                              /* tp_descr_set */
+    0,                              /* tp_dictoffset */
+    0,                              /* tp_init */
+    0,                              /* tp_alloc */
+    WeakIdentityDict__new__,        /* tp_new */
+};
+
+/* ConcurrentIdentityDict
+
+   IdentityDicts for shards, picked between by the high bits of
+   `hash_int()`, which the shards' own tables leave alone.  Every
+   operation holds its shard's lock: on free-threaded builds the shard's
+   critical section, otherwise the GIL, which nothing here lets go of
+   before the table is consistent again.
+
+   Reads lock too.  An optimistic read, checked against a version counter
+   after the fact, can race a resize that frees the table it is probing;
+   the deferred freeing that makes that safe for dict isn't open to
+   extensions.
+*/
+
+#ifndef CONCURRENT_SHARD_BITS
+#define CONCURRENT_SHARD_BITS 4
+#endif
+
+#if CONCURRENT_SHARD_BITS < 1
+#error "CONCURRENT_SHARD_BITS must be at least 1"
+#endif
+
+#define NUM_SHARDS (1 << CONCURRENT_SHARD_BITS)
+
+#ifdef Py_BEGIN_CRITICAL_SECTION
+/* The free-threaded expansion leaves the ';' to the caller */
+#define LOCK_SHARD(shard) Py_BEGIN_CRITICAL_SECTION(shard);
+#define UNLOCK_SHARD() Py_END_CRITICAL_SECTION()
+#else
+#define LOCK_SHARD(shard) {
+#define UNLOCK_SHARD() }
+#endif
+
+typedef struct {
+    PyObject_HEAD
+    PyObject *shards[NUM_SHARDS];
+} ConcurrentIdentityDict;
+
+/* The top bits of the hash once more multiplied through: those of
+   hash_int() itself are the same for nearly every heap pointer */
+#if SIZEOF_SIZE_T > 4
+#define SHARD_MIX ((size_t)0x9e3779b97f4a7c15ULL)
+#else
+#define SHARD_MIX ((size_t)0x9e3779b9UL)
+#endif
+
+#define SHARD(this, hash) \
+    ((this)->shards[((size_t)(hash) * SHARD_MIX) >> (8 * sizeof(size_t) - CONCURRENT_SHARD_BITS)])
+
+PyDoc_STRVAR(ConcurrentIdentityDict__doc__,
+"Mapping by identity, safe to share between threads.\n"
+"\n"
+"ConcurrentIdentityDict()\n"
+"\n"
+"Split into shards, each behind its own lock, so threads only contend\n"
+"for keys that land in the same shard.");
+
+static PyObject *
+ConcurrentIdentityDict__new__(PyTypeObject *type, PyObject *args, PyObject *kwargs)
+{
+    static char *kwlist[] = {NULL};
+
+    ConcurrentIdentityDict *this;
+    int i;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, ":ConcurrentIdentityDict", kwlist))
+        return NULL;
+
+    this = (ConcurrentIdentityDict *)type->tp_alloc(type, 0);
+    if (this == NULL)
+        return NULL;
+
+    for (i = 0; i < NUM_SHARDS; i++) {
+        this->shards[i] = PyObject_CallNoArgs((PyObject *)&IdentityDict_type);
+        if (this->shards[i] == NULL) {
+            Py_DECREF(this);
+            return NULL;
+        }
+    }
+
+    return (PyObject *)this;
+}
+
+static void
+ConcurrentIdentityDict__del__(PyObject *self)
+{
+    ConcurrentIdentityDict *this = (ConcurrentIdentityDict *)self;
+    int i;
+
+    PyObject_GC_UnTrack(self);
+    Py_TRASHCAN_BEGIN(self, ConcurrentIdentityDict__del__)
+
+    for (i = 0; i < NUM_SHARDS; i++)
+        Py_XDECREF(this->shards[i]);
+
+    Py_TYPE(self)->tp_free(self);
+
+    Py_TRASHCAN_END
+}
+
+static int
+ConcurrentIdentityDict__traverse__(PyObject *self, visitproc visit, void *arg)
+{
+    ConcurrentIdentityDict *this = (ConcurrentIdentityDict *)self;
+    int i;
+
+    for (i = 0; i < NUM_SHARDS; i++)
+        Py_VISIT(this->shards[i]);
+
+    return 0;
+}
+
+/* Empties the shards, but keeps them */
+static int
+ConcurrentIdentityDict__clear__(PyObject *self)
+{
+    ConcurrentIdentityDict *this = (ConcurrentIdentityDict *)self;
+    PyObject *shard;
+    int i;
+
+    for (i = 0; i < NUM_SHARDS; i++) {
+        shard = this->shards[i];
+        if (shard == NULL)
+            continue;
+
+        LOCK_SHARD(shard)
+        IdentityDict__clear__(shard);
+        UNLOCK_SHARD()
+    }
+
+    return 0;
+}
+
+static PyObject *
+ConcurrentIdentityDict__getitem__(PyObject *self, PyObject *key)
+{
+    Py_hash_t hash = hash_int(key);
+    PyObject *shard = SHARD((ConcurrentIdentityDict *)self, hash);
+
+    Table *table;
+    PyObject *value;
+    Py_ssize_t ix;
+    size_t slot;
+
+    LOCK_SHARD(shard)
+
+    table = ((IdentityDict *)shard)->table;
+    ix = lookup((IdentityDict *)shard, key, hash, &slot);
+
+    value = ix < 0 ? NULL : ENTRY_VALUE(table, ix);
+    Py_XINCREF(value);
+
+    UNLOCK_SHARD()
+
+    if (value == NULL)
+        _PyErr_SetKeyError(key);
+
+    return value;
+}
+
+static int
+ConcurrentIdentityDict__setitem__(PyObject *self, PyObject *key, PyObject *value)
+{
+    PyObject *shard = SHARD((ConcurrentIdentityDict *)self, hash_int(key));
+    int status;
+
+    LOCK_SHARD(shard)
+    status = IdentityDict__setitem__(shard, key, value);
+    UNLOCK_SHARD()
+
+    return status;
+}
+
+static int
+ConcurrentIdentityDict__contains__(PyObject *self, PyObject *key)
+{
+    PyObject *shard = SHARD((ConcurrentIdentityDict *)self, hash_int(key));
+    int status;
+
+    LOCK_SHARD(shard)
+    status = IdentityDict__contains__(shard, key);
+    UNLOCK_SHARD()
+
+    return status;
+}
+
+static Py_ssize_t
+ConcurrentIdentityDict__len__(PyObject *self)
+{
+    ConcurrentIdentityDict *this = (ConcurrentIdentityDict *)self;
+    PyObject *shard;
+    Py_ssize_t length = 0;
+    int i;
+
+    for (i = 0; i < NUM_SHARDS; i++) {
+        shard = this->shards[i];
+
+        LOCK_SHARD(shard)
+        length += ((IdentityDict *)shard)->used;
+        UNLOCK_SHARD()
+    }
+
+    return length;
+}
+
+/* A list of the keys, values or (key, value) pairs, a shard at a time */
+enum {CONCURRENT_KEYS, CONCURRENT_VALUES, CONCURRENT_ITEMS};
+
+static PyObject *
+concurrent_list(ConcurrentIdentityDict *this, int what)
+{
+    PyObject *list, *shard, *item;
+    Table *table;
+    Py_ssize_t i;
+    int n, status = 0;
+
+    list = PyList_New(0);
+    if (list == NULL)
+        return NULL;
+
+    for (n = 0; n < NUM_SHARDS && status == 0; n++) {
+        shard = this->shards[n];
+
+        LOCK_SHARD(shard)
+
+        /* Reloaded each time, as appending may collect, and re-enter */
+        for (i = 0; i < ((IdentityDict *)shard)->table->nentries && status == 0; i++) {
+            table = ((IdentityDict *)shard)->table;
+
+            if (ENTRY_KEY(table, i) == NULL)
+                continue;
+
+            switch (what) {
+            case CONCURRENT_KEYS:
+                status = PyList_Append(list, ENTRY_KEY(table, i));
+                break;
+            case CONCURRENT_VALUES:
+                status = PyList_Append(list, ENTRY_VALUE(table, i));
+                break;
+            default:
+                item = PyTuple_Pack(2, ENTRY_KEY(table, i), ENTRY_VALUE(table, i));
+                if (item == NULL) {
+                    status = -1;
+                    break;
+                }
+
+                status = PyList_Append(list, item);
+                Py_DECREF(item);
+            }
+        }
+
+        UNLOCK_SHARD()
+    }
+
+    if (status == -1) {
+        Py_DECREF(list);
+        return NULL;
+    }
+
+    return list;
+}
+
+/* Over a snapshot of the keys, as other threads may change them */
+static PyObject *
+ConcurrentIdentityDict__iter__(PyObject *self)
+{
+    PyObject *keys = concurrent_list((ConcurrentIdentityDict *)self, CONCURRENT_KEYS);
+    PyObject *iterator;
+
+    if (keys == NULL)
+        return NULL;
+
+    iterator = PyObject_GetIter(keys);
+    Py_DECREF(keys);
+    return iterator;
+}
+
+PyDoc_STRVAR(ConcurrentIdentityDict_get__doc__,
+"self[key] if key in self, else default (which is None if not provided).\n"
+"\n"
+"ConcurrentIdentityDict.get(key, default=None)");
+
+static PyObject *
+ConcurrentIdentityDict_get(PyObject *self, PyObject *const *args, Py_ssize_t nargs)
+{
+    PyObject *shard, *value;
+
+    if (!_PyArg_CheckPositional("get", nargs, 1, 2))
+        return NULL;
+
+    shard = SHARD((ConcurrentIdentityDict *)self, hash_int(args[0]));
+
+    LOCK_SHARD(shard)
+    value = IdentityDict_get_impl(shard, args[0], nargs > 1 ? args[1] : NULL);
+    UNLOCK_SHARD()
+
+    return value;
+}
+
+PyDoc_STRVAR(ConcurrentIdentityDict_setdefault__doc__,
+"self[key] if key in self, else set to and return default (which is None if not provided).\n"
+"\n"
+"ConcurrentIdentityDict.setdefault(key, default=None)\n"
+"\n"
+"Atomic: of threads racing to set the same key, all get the one value that won.");
+
+static PyObject *
+ConcurrentIdentityDict_setdefault(PyObject *self, PyObject *const *args, Py_ssize_t nargs)
+{
+    PyObject *shard, *value;
+
+    if (!_PyArg_CheckPositional("setdefault", nargs, 1, 2))
+        return NULL;
+
+    shard = SHARD((ConcurrentIdentityDict *)self, hash_int(args[0]));
+
+    LOCK_SHARD(shard)
+    value = IdentityDict_setdefault_impl(shard, args[0], nargs > 1 ? args[1] : NULL);
+    UNLOCK_SHARD()
+
+    return value;
+}
+
+PyDoc_STRVAR(ConcurrentIdentityDict_pop__doc__,
+"Remove a specified key and return its corresponding value.\n"
+"\n"
+"ConcurrentIdentityDict.pop(key, default=None)\n"
+"\n"
+"If absent and `default` is provided, return `default`.\n"
+"If absent and `default` is NOT provided, raise `KeyError`.");
+
+static PyObject *
+ConcurrentIdentityDict_pop(PyObject *self, PyObject *const *args, Py_ssize_t nargs)
+{
+    PyObject *shard, *value;
+
+    if (!_PyArg_CheckPositional("pop", nargs, 1, 2))
+        return NULL;
+
+    shard = SHARD((ConcurrentIdentityDict *)self, hash_int(args[0]));
+
+    LOCK_SHARD(shard)
+    value = IdentityDict_pop_impl(shard, args[0], nargs > 1 ? args[1] : NULL);
+    UNLOCK_SHARD()
+
+    return value;
+}
+
+PyDoc_STRVAR(ConcurrentIdentityDict_keys__doc__,
+"Return a list of the keys.\n"
+"\n"
+"ConcurrentIdentityDict.keys()");
+
+static PyObject *
+ConcurrentIdentityDict_keys(PyObject *self, PyObject *_)
+{
+    return concurrent_list((ConcurrentIdentityDict *)self, CONCURRENT_KEYS);
+}
+
+PyDoc_STRVAR(ConcurrentIdentityDict_values__doc__,
+"Return a list of the values.\n"
+"\n"
+"ConcurrentIdentityDict.values()");
+
+static PyObject *
+ConcurrentIdentityDict_values(PyObject *self, PyObject *_)
+{
+    return concurrent_list((ConcurrentIdentityDict *)self, CONCURRENT_VALUES);
+}
+
+PyDoc_STRVAR(ConcurrentIdentityDict_items__doc__,
+"Return a list of the (key, value) pairs.\n"
+"\n"
+"ConcurrentIdentityDict.items()");
+
+static PyObject *
+ConcurrentIdentityDict_items(PyObject *self, PyObject *_)
+{
+    return concurrent_list((ConcurrentIdentityDict *)self, CONCURRENT_ITEMS);
+}
+
+PyDoc_STRVAR(ConcurrentIdentityDict_clear__doc__,
+"Remove all items from D.\n"
+"\n"
+"ConcurrentIdentityDict.clear()\n"
+"\n"
+"A shard at a time, so items other threads add meanwhile may survive it.");
+
+static PyObject *
+ConcurrentIdentityDict_clear(PyObject *self, PyObject *_)
+{
+    ConcurrentIdentityDict *this = (ConcurrentIdentityDict *)self;
+    PyObject *shard;
+    int i;
+
+    for (i = 0; i < NUM_SHARDS; i++) {
+        shard = this->shards[i];
+
+        LOCK_SHARD(shard)
+        /* Never fails: clearing doesn't allocate */
+        Py_XDECREF(IdentityDict_clear(shard));
+        UNLOCK_SHARD()
+    }
+
+    Py_RETURN_NONE;
+}
+
+PyDoc_STRVAR(ConcurrentIdentityDict__sizeof____doc__,
+"Size of D in memory, in bytes, its shards and their tables included.\n"
+"\n"
+"ConcurrentIdentityDict.__sizeof__()");
+
+static PyObject *
+ConcurrentIdentityDict__sizeof__(PyObject *self, PyObject *_)
+{
+    ConcurrentIdentityDict *this = (ConcurrentIdentityDict *)self;
+    Py_ssize_t size = Py_TYPE(self)->tp_basicsize;
+    PyObject *shard;
+    int i;
+
+    for (i = 0; i < NUM_SHARDS; i++) {
+        shard = this->shards[i];
+
+        LOCK_SHARD(shard)
+        size += Py_TYPE(shard)->tp_basicsize + table_sizeof((IdentityDict *)shard);
+        UNLOCK_SHARD()
+    }
+
+    return PyLong_FromSsize_t(size);
+}
+
+PyDoc_STRVAR(ConcurrentIdentityDict__shard_lens__doc__,
+"Return a list of how many keys each shard holds, to check their spread.\n"
+"\n"
+"ConcurrentIdentityDict._shard_lens()");
+
+static PyObject *
+ConcurrentIdentityDict__shard_lens(PyObject *self, PyObject *_)
+{
+    ConcurrentIdentityDict *this = (ConcurrentIdentityDict *)self;
+    PyObject *list = PyList_New(NUM_SHARDS);
+    PyObject *len;
+    int i;
+
+    if (list == NULL)
+        return NULL;
+
+    for (i = 0; i < NUM_SHARDS; i++) {
+        len = PyLong_FromSsize_t(IdentityDict__len__(this->shards[i]));
+        if (len == NULL) {
+            Py_DECREF(list);
+            return NULL;
+        }
+
+        PyList_SET_ITEM(list, i, len);
+    }
+
+    return list;
+}
+
+static PyMethodDef
+ConcurrentIdentityDict_methods[] = {
+    {"get", (PyCFunction)(void(*)(void))ConcurrentIdentityDict_get, METH_FASTCALL, ConcurrentIdentityDict_get__doc__},
+    {"setdefault", (PyCFunction)(void(*)(void))ConcurrentIdentityDict_setdefault, METH_FASTCALL, ConcurrentIdentityDict_setdefault__doc__},
+    {"pop", (PyCFunction)(void(*)(void))ConcurrentIdentityDict_pop, METH_FASTCALL, ConcurrentIdentityDict_pop__doc__},
+    {"keys", ConcurrentIdentityDict_keys, METH_NOARGS, ConcurrentIdentityDict_keys__doc__},
+    {"values", ConcurrentIdentityDict_values, METH_NOARGS, ConcurrentIdentityDict_values__doc__},
+    {"items", ConcurrentIdentityDict_items, METH_NOARGS, ConcurrentIdentityDict_items__doc__},
+    {"clear", ConcurrentIdentityDict_clear, METH_NOARGS, ConcurrentIdentityDict_clear__doc__},
+    {"__sizeof__", ConcurrentIdentityDict__sizeof__, METH_NOARGS, ConcurrentIdentityDict__sizeof____doc__},
+    {"_shard_lens", ConcurrentIdentityDict__shard_lens, METH_NOARGS, ConcurrentIdentityDict__shard_lens__doc__},
+    {NULL, NULL} /* sentinel */
+};
+
+static PyMappingMethods
+ConcurrentIdentityDict_as_mapping = {
+    ConcurrentIdentityDict__len__,      /* mp_length */
+    ConcurrentIdentityDict__getitem__,  /* mp_subscript */
+    ConcurrentIdentityDict__setitem__,  /* mp_ass_subscript */
+};
+
+static PySequenceMethods
+ConcurrentIdentityDict_as_sequence = {
+    0,                                  /* sq_length */
+    0,                                  /* sq_concat */
+    0,                                  /* sq_repeat */
+    0,                                  /* sq_item */
+    0,                                  /* sq_slice */
+    0,                                  /* sq_ass_item */
+    0,                                  /* sq_ass_slice */
+    ConcurrentIdentityDict__contains__, /* sq_contains */
+    0,                                  /* sq_inplace_concat */
+    0,                                  /* sq_inplace_repeat */
+};
+
+static PyTypeObject
+ConcurrentIdentityDict_type = {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    "b._collections.ConcurrentIdentityDict", /* tp_name */
+    sizeof(ConcurrentIdentityDict),     /* tp_basicsize */
+    0,                                  /* tp_itemsize */
+    ConcurrentIdentityDict__del__,      /* tp_dealloc */
+    0,                                  /* tp_print */
+    0,                                  /* tp_getattr */
+    0,                                  /* tp_setattr */
+    0,                                  /* tp_reserved */
+    0,                                  /* tp_repr */
+    0,                                  /* tp_as_number */
+    &ConcurrentIdentityDict_as_sequence, /* tp_as_sequence */
+    &ConcurrentIdentityDict_as_mapping, /* tp_as_mapping */
+    0,                                  /* tp_hash  */
+    0,                                  /* tp_call */
+    0,                                  /* tp_str */
+    0,                                  /* tp_getattro */
+    0,                                  /* tp_setattro */
+    0,                                  /* tp_as_buffer */
+    Py_TPFLAGS_DEFAULT |
+    Py_TPFLAGS_HAVE_GC,                 /* tp_flags */
+    ConcurrentIdentityDict__doc__,      /* tp_doc */
+    ConcurrentIdentityDict__traverse__, /* tp_traverse */
+    ConcurrentIdentityDict__clear__,    /* tp_clear */
+    0,                                  /* tp_richcompare */
+    0,                                  /* tp_weaklistoffset */
+    ConcurrentIdentityDict__iter__,     /* tp_iter */
+    0,                                  /* tp_iternext */
+    ConcurrentIdentityDict_methods,     /* tp_methods */
+    0,                                  /* tp_members */
+    0,                                  /* tp_getset */
+    0,                                  /* tp_base */
+    0,                                  /* tp_dict */
+    0,                                  /* tp_descr_get */
+    0,                                  /* tp_descr_set */
+    0,                                  /* tp_dictoffset */
+    0,                                  /* tp_init */
+    0,                                  /* tp_alloc */
+    ConcurrentIdentityDict__new__,      /* tp_new */
+};
+
+/* Int64Dict
+
+   Keyed by int64_t, unboxed, in slots of their own with the values,
+   probed by control bytes as IdentityDict's tables are (see hash.h).
+   Any int in range is a key; the exact ints nearly all keys are convert
+   without allocating.
+*/
+
+typedef struct {
+    int64_t key;
+    PyObject *value;
+} Int64Entry;
+
+/* `ctrl` holds a control byte per slot, and is followed in the same
+   allocation by the slots themselves, `entries`. */
+typedef struct {
+    PyObject_HEAD
+    Py_ssize_t size;
+    Py_ssize_t usable;
+    Py_ssize_t used;
+    int8_t *ctrl;
+    Int64Entry *entries;
+} Int64Dict;
+
+/* Slots marked CTRL_DELETED: neither live nor available to `usable` */
+#define INT64_DELETED(this) (USABLE((this)->size) - (this)->usable - (this)->used)
+
+/* Raised past the alignment bits hash_fibonacci() drops, so runs of
+   IDs don't share hashes */
+#define HASH_INT64(key) hash_int((void *)ROTR((size_t)(key), 8 * sizeof(size_t) - 4))
+
+/* 1 with `*value` set for an int `key` in range, 0 for one out of
+   range, else -1 */
+static inline int
+int64_key(PyObject *key, int64_t *value)
+{
+    PyObject *index;
+    long long n;
+    int overflow;
+
+    if (PyLong_CheckExact(key)) {
+        n = PyLong_AsLongLongAndOverflow(key, &overflow);
+    } else {
+        index = PyNumber_Index(key);
+        if (index == NULL)
+            return -1;
+
+        n = PyLong_AsLongLongAndOverflow(index, &overflow);
+        Py_DECREF(index);
+    }
+
+    if (overflow)
+        return 0;
+
+    *value = n;
+    return 1;
+}
+
+static int8_t *
+int64_alloc(Py_ssize_t size)
+{
+    int8_t *ctrl = table_malloc(size + size * sizeof(Int64Entry));
+    if (ctrl == NULL) {
+        PyErr_NoMemory();
+        return NULL;
+    }
+
+    memset(ctrl, CTRL_EMPTY, size);
+
+    return ctrl;
+}
+
+/* Slot holding `key`, else -1 */
+static inline Py_ssize_t
+int64_lookup(Int64Dict *this, int64_t key, Py_hash_t hash)
+{
+    Int64Entry *entries = this->entries;
+    Py_ssize_t slot;
+    size_t groups;
+
+#define INT64_IS_KEY(i) (entries[i].key == key)
+    GROUP_LOOKUP(slot, this->ctrl, this->size, hash, groups, INT64_IS_KEY);
+#undef INT64_IS_KEY
+
+    return slot;
+}
+
+/* Move the live slots to a new table of `new_size` */
+static int
+int64_resize(Int64Dict *this, Py_ssize_t new_size)
+{
+    int8_t *old_ctrl = this->ctrl;
+    int8_t *new_ctrl = int64_alloc(new_size);
+
+    Int64Entry *old_entries = this->entries;
+    Int64Entry *new_entries;
+
+    register Py_ssize_t i;
+    register size_t j;
+
+    Py_hash_t hash;
+
+    if (new_ctrl == NULL)
+        return -1;
+
+    new_entries = (Int64Entry *)&new_ctrl[new_size];
+
+    for (i = 0; i < this->size; i++) {
+        if (old_ctrl[i] < 0)
+            continue;
+
+        hash = HASH_INT64(old_entries[i].key);
+
+        j = group_find_free(new_ctrl, new_size, hash);
+
+        new_ctrl[j] = H2(hash);
+        new_entries[j] = old_entries[i];
+    }
+
+    table_free(old_ctrl);
+
+    this->ctrl = new_ctrl;
+    this->entries = new_entries;
+    this->size = new_size;
+    this->usable = USABLE(new_size) - this->used;
+
+    return 0;
+}
+
+/* Add `key`, known to be absent, with a new reference to `value` */
+static int
+int64_insert(Int64Dict *this, int64_t key, Py_hash_t hash, PyObject *value)
+{
+    size_t slot = group_find_free(this->ctrl, this->size, hash);
+
+    /* Reusing a deleted slot leaves `usable` alone. */
+    if (this->ctrl[slot] == CTRL_EMPTY) {
+        if (this->usable <= 0) {
+            /* Deleted slots are at least as many as live ones: rehash
+               at the same size to reclaim them. */
+            if (int64_resize(this, INT64_DELETED(this) >= this->used ? this->size : this->size * 2) == -1)
+                return -1;
+
+            slot = group_find_free(this->ctrl, this->size, hash);
+        }
+
+        this->usable--;
+    }
+
+    Py_INCREF(value);
+
+    this->ctrl[slot] = H2(hash);
+    this->entries[slot].key = key;
+    this->entries[slot].value = value;
+
+    this->used++;
+
+    return 0;
+}
+
+/* Empty the slot of a live key, and return its value's reference */
+static PyObject *
+int64_delete(Int64Dict *this, Py_ssize_t slot)
+{
+    PyObject *value = this->entries[slot].value;
+
+    this->ctrl[slot] = CTRL_DELETED;
+    this->entries[slot].value = NULL;
+    this->used--;
+
+    return value;
+}
+
+PyDoc_STRVAR(Int64Dict__doc__,
+"Mapping from 64-bit ints, stored unboxed.\n"
+"\n"
+"Int64Dict(*, capacity=0)\n"
+"\n"
+"Keys are ints from -2**63 to 2**63 - 1, or objects with __index__;\n"
+"iterating makes ints of them afresh.");
+
+static PyObject *
+Int64Dict__new__(PyTypeObject *type, PyObject *args, PyObject *kwargs)
+{
+    static char *kwlist[] = {"capacity", NULL};
+
+    Py_ssize_t capacity = 0, size;
+    Int64Dict *this;
+    int8_t *ctrl;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "|$n:Int64Dict", kwlist,
+                                     &capacity))
+        return NULL;
+
+    if (capacity < 0) {
+        PyErr_SetString(PyExc_ValueError, "Int64Dict() of a negative capacity");
+        return NULL;
+    }
+
+    size = size_for(capacity, DEFAULT_MAX_LOAD);
+    if (size == -1)
+        return NULL;
+
+    ctrl = int64_alloc(size);
+    if (ctrl == NULL)
+        return NULL;
+
+    this = (Int64Dict *)type->tp_alloc(type, 0);
+    if (this == NULL) {
+        table_free(ctrl);
+        return NULL;
+    }
+
+    this->ctrl = ctrl;
+    this->entries = (Int64Entry *)&ctrl[size];
+    this->size = size;
+    this->usable = USABLE(size);
+    this->used = 0;
+
+    return (PyObject *)this;
+}
+
+/* Drops the values one at a time, reloading the table, as dropping may
+   re-enter */
+static int
+Int64Dict__clear__(PyObject *self)
+{
+    Int64Dict *this = (Int64Dict *)self;
+    Py_ssize_t i;
+
+    for (i = 0; i < this->size; i++) {
+        if (this->ctrl[i] >= 0)
+            Py_DECREF(int64_delete(this, i));
+    }
+
+    /* Nothing re-entered to add more: reset the control bytes too. */
+    if (this->used == 0) {
+        memset(this->ctrl, CTRL_EMPTY, this->size);
+        this->usable = USABLE(this->size);
+    }
+
+    return 0;
+}
+
+static void
+Int64Dict__del__(PyObject *self)
+{
+    Int64Dict *this = (Int64Dict *)self;
+    Py_ssize_t i;
+
+    PyObject_GC_UnTrack(self);
+    Py_TRASHCAN_BEGIN(self, Int64Dict__del__)
+
+    for (i = 0; i < this->size; i++) {
+        if (this->ctrl[i] >= 0)
+            Py_DECREF(this->entries[i].value);
+    }
+
+    table_free(this->ctrl);
+
+    Py_TYPE(self)->tp_free(self);
+
+    Py_TRASHCAN_END
+}
+
+static int
+Int64Dict__traverse__(PyObject *self, visitproc visit, void *arg)
+{
+    Int64Dict *this = (Int64Dict *)self;
+    Py_ssize_t i;
+
+    for (i = 0; i < this->size; i++) {
+        if (this->ctrl[i] >= 0)
+            Py_VISIT(this->entries[i].value);
+    }
+
+    return 0;
+}
+
+static Py_ssize_t
+Int64Dict__len__(PyObject *self)
+{
+    return ((Int64Dict *)self)->used;
+}
+
+/* Slot of `key`, else -1, with an error set if it isn't a key at all */
+static inline Py_ssize_t
+int64_find(Int64Dict *this, PyObject *key)
+{
+    int64_t n;
+
+    switch (int64_key(key, &n)) {
+    case 1:
+        return int64_lookup(this, n, HASH_INT64(n));
+    case 0:
+        return -1;
+    default:
+        return -2;
+    }
+}
+
+static PyObject *
+Int64Dict__getitem__(PyObject *self, PyObject *key)
+{
+    Int64Dict *this = (Int64Dict *)self;
+    Py_ssize_t slot = int64_find(this, key);
+    PyObject *value;
+
+    if (slot < 0) {
+        if (slot == -1)
+            _PyErr_SetKeyError(key);
+        return NULL;
+    }
+
+    value = this->entries[slot].value;
+    Py_INCREF(value);
+    return value;
+}
+
+static int
+Int64Dict__setitem__(PyObject *self, PyObject *key, PyObject *value)
+{
+    Int64Dict *this = (Int64Dict *)self;
+    PyObject *old_value;
+    Py_ssize_t slot;
+    Py_hash_t hash;
+    int64_t n;
+
+    if (value == NULL) {
+        slot = int64_find(this, key);
+        if (slot < 0) {
+            if (slot == -1)
+                _PyErr_SetKeyError(key);
+            return -1;
+        }
+
+        Py_DECREF(int64_delete(this, slot));
+        return 0;
+    }
+
+    switch (int64_key(key, &n)) {
+    case 1:
+        break;
+    case 0:
+        PyErr_SetString(PyExc_OverflowError, "Int64Dict key out of range");
+        return -1;
+    default:
+        return -1;
+    }
+
+    hash = HASH_INT64(n);
+    slot = int64_lookup(this, n, hash);
+
+    if (slot < 0)
+        return int64_insert(this, n, hash, value);
+
+    /* Slot first, as the decref may re-enter. */
+    old_value = this->entries[slot].value;
+    Py_INCREF(value);
+    this->entries[slot].value = value;
+    Py_DECREF(old_value);
+
+    return 0;
+}
+
+static int
+Int64Dict__contains__(PyObject *self, PyObject *key)
+{
+    Py_ssize_t slot = int64_find((Int64Dict *)self, key);
+
+    return slot == -2 ? -1 : slot >= 0;
+}
+
+static PyObject * Int64DictIterator_new(Int64Dict *dict);
+
+static PyObject *
+Int64Dict__iter__(PyObject *self)
+{
+    return Int64DictIterator_new((Int64Dict *)self);
+}
+
+PyDoc_STRVAR(Int64Dict_get__doc__,
+"self[key] if key in self, else default (which is None if not provided).\n"
+"\n"
+"Int64Dict.get(key, default=None)");
+
+static PyObject *
+Int64Dict_get(PyObject *self, PyObject *const *args, Py_ssize_t nargs)
+{
+    Int64Dict *this = (Int64Dict *)self;
+    PyObject *value;
+    Py_ssize_t slot;
+
+    if (!_PyArg_CheckPositional("get", nargs, 1, 2))
+        return NULL;
+
+    slot = int64_find(this, args[0]);
+
+    if (slot == -2)
+        return NULL;
+
+    value = slot >= 0 ? this->entries[slot].value : nargs > 1 ? args[1] : Py_None;
+    Py_INCREF(value);
+    return value;
+}
+
+PyDoc_STRVAR(Int64Dict_setdefault__doc__,
+"self[key] if key in self, else set to and return default (which is None if not provided).\n"
+"\n"
+"Int64Dict.setdefault(key, default=None)");
+
+static PyObject *
+Int64Dict_setdefault(PyObject *self, PyObject *const *args, Py_ssize_t nargs)
+{
+    Int64Dict *this = (Int64Dict *)self;
+    PyObject *value;
+    Py_ssize_t slot;
+
+    if (!_PyArg_CheckPositional("setdefault", nargs, 1, 2))
+        return NULL;
+
+    slot = int64_find(this, args[0]);
+
+    if (slot == -2)
+        return NULL;
+
+    if (slot >= 0) {
+        value = this->entries[slot].value;
+    } else {
+        value = nargs > 1 ? args[1] : Py_None;
+        if (Int64Dict__setitem__(self, args[0], value) == -1)
+            return NULL;
+    }
+
+    Py_INCREF(value);
+    return value;
+}
+
+PyDoc_STRVAR(Int64Dict_pop__doc__,
+"Remove a specified key and return its corresponding value.\n"
+"\n"
+"Int64Dict.pop(key, default=None)\n"
+"\n"
+"If absent and `default` is provided, return `default`.\n"
+"If absent and `default` is NOT provided, raise `KeyError`.");
+
+static PyObject *
+Int64Dict_pop(PyObject *self, PyObject *const *args, Py_ssize_t nargs)
+{
+    Int64Dict *this = (Int64Dict *)self;
+    Py_ssize_t slot;
+
+    if (!_PyArg_CheckPositional("pop", nargs, 1, 2))
+        return NULL;
+
+    slot = int64_find(this, args[0]);
+
+    if (slot >= 0)
+        return int64_delete(this, slot);
+
+    if (slot == -2)
+        return NULL;
+
+    if (nargs < 2) {
+        _PyErr_SetKeyError(args[0]);
+        return NULL;
+    }
+
+    Py_INCREF(args[1]);
+    return args[1];
+}
+
+/* A list of the keys, values or (key, value) pairs */
+enum {INT64_KEYS, INT64_VALUES, INT64_ITEMS};
+
+static PyObject *
+int64_list(Int64Dict *this, int what)
+{
+    PyObject *list, *key, *item;
+    Py_ssize_t i;
+    int status = 0;
+
+    list = PyList_New(0);
+    if (list == NULL)
+        return NULL;
+
+    /* Reloaded each time, as appending may collect, and re-enter */
+    for (i = 0; i < this->size && status == 0; i++) {
+        if (this->ctrl[i] < 0)
+            continue;
+
+        if (what == INT64_VALUES) {
+            status = PyList_Append(list, this->entries[i].value);
+            continue;
+        }
+
+        key = PyLong_FromLongLong(this->entries[i].key);
+        if (key == NULL) {
+            status = -1;
+            break;
+        }
+
+        if (what == INT64_KEYS) {
+            item = key;
+        } else {
+            item = PyTuple_Pack(2, key, this->entries[i].value);
+            Py_DECREF(key);
+            if (item == NULL) {
+                status = -1;
+                break;
+            }
+        }
+
+        status = PyList_Append(list, item);
+        Py_DECREF(item);
+    }
+
+    if (status == -1) {
+        Py_DECREF(list);
+        return NULL;
+    }
+
+    return list;
+}
+
+PyDoc_STRVAR(Int64Dict_keys__doc__,
+"Return a list of the keys.\n"
+"\n"
+"Int64Dict.keys()");
+
+static PyObject *
+Int64Dict_keys(PyObject *self, PyObject *_)
+{
+    return int64_list((Int64Dict *)self, INT64_KEYS);
+}
+
+PyDoc_STRVAR(Int64Dict_values__doc__,
+"Return a list of the values.\n"
+"\n"
+"Int64Dict.values()");
+
+static PyObject *
+Int64Dict_values(PyObject *self, PyObject *_)
+{
+    return int64_list((Int64Dict *)self, INT64_VALUES);
+}
+
+PyDoc_STRVAR(Int64Dict_items__doc__,
+"Return a list of the (key, value) pairs.\n"
+"\n"
+"Int64Dict.items()");
+
+static PyObject *
+Int64Dict_items(PyObject *self, PyObject *_)
+{
+    return int64_list((Int64Dict *)self, INT64_ITEMS);
+}
+
+PyDoc_STRVAR(Int64Dict_clear__doc__,
+"Remove all items from D.\n"
+"\n"
+"Int64Dict.clear()");
+
+static PyObject *
+Int64Dict_clear(PyObject *self, PyObject *_)
+{
+    Int64Dict__clear__(self);
+    Py_RETURN_NONE;
+}
+
+PyDoc_STRVAR(Int64Dict__sizeof____doc__,
+"Size of D in memory, in bytes, its table included.\n"
+"\n"
+"Int64Dict.__sizeof__()");
+
+static PyObject *
+Int64Dict__sizeof__(PyObject *self, PyObject *_)
+{
+    Int64Dict *this = (Int64Dict *)self;
+
+    return PyLong_FromSsize_t(Py_TYPE(self)->tp_basicsize +
+                              this->size + this->size * sizeof(Int64Entry));
+}
+
+static PyMethodDef
+Int64Dict_methods[] = {
+    {"get", (PyCFunction)(void(*)(void))Int64Dict_get, METH_FASTCALL, Int64Dict_get__doc__},
+    {"setdefault", (PyCFunction)(void(*)(void))Int64Dict_setdefault, METH_FASTCALL, Int64Dict_setdefault__doc__},
+    {"pop", (PyCFunction)(void(*)(void))Int64Dict_pop, METH_FASTCALL, Int64Dict_pop__doc__},
+    {"keys", Int64Dict_keys, METH_NOARGS, Int64Dict_keys__doc__},
+    {"values", Int64Dict_values, METH_NOARGS, Int64Dict_values__doc__},
+    {"items", Int64Dict_items, METH_NOARGS, Int64Dict_items__doc__},
+    {"clear", Int64Dict_clear, METH_NOARGS, Int64Dict_clear__doc__},
+    {"__sizeof__", Int64Dict__sizeof__, METH_NOARGS, Int64Dict__sizeof____doc__},
+    {NULL, NULL} /* sentinel */
+};
+
+static PyMappingMethods
+Int64Dict_as_mapping = {
+    Int64Dict__len__,               /* mp_length */
+    Int64Dict__getitem__,           /* mp_subscript */
+    Int64Dict__setitem__,           /* mp_ass_subscript */
+};
+
+static PySequenceMethods
+Int64Dict_as_sequence = {
+    0,                              /* sq_length */
+    0,                              /* sq_concat */
+    0,                              /* sq_repeat */
+    0,                              /* sq_item */
+    0,                              /* sq_slice */
+    0,                              /* sq_ass_item */
+    0,                              /* sq_ass_slice */
+    Int64Dict__contains__,          /* sq_contains */
+    0,                              /* sq_inplace_concat */
+    0,                              /* sq_inplace_repeat */
+};
+
+static PyTypeObject
+Int64Dict_type = {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    "b._collections.Int64Dict",     /* tp_name */
+    sizeof(Int64Dict),              /* tp_basicsize */
+    0,                              /* tp_itemsize */
+    Int64Dict__del__,               /* tp_dealloc */
+    0,                              /* tp_print */
+    0,                              /* tp_getattr */
+    0,                              /* tp_setattr */
+    0,                              /* tp_reserved */
+    0,                              /* tp_repr */
+    0,                              /* tp_as_number */
+    &Int64Dict_as_sequence,         /* tp_as_sequence */
+    &Int64Dict_as_mapping,          /* tp_as_mapping */
+    0,                              /* tp_hash  */
+    0,                              /* tp_call */
+    0,                              /* tp_str */
+    0,                              /* tp_getattro */
+    0,                              /* tp_setattro */
+    0,                              /* tp_as_buffer */
+    Py_TPFLAGS_DEFAULT |
+    Py_TPFLAGS_HAVE_GC,             /* tp_flags */
+    Int64Dict__doc__,               /* tp_doc */
+    Int64Dict__traverse__,          /* tp_traverse */
+    Int64Dict__clear__,             /* tp_clear */
+    0,                              /* tp_richcompare */
+    0,                              /* tp_weaklistoffset */
+    Int64Dict__iter__,              /* tp_iter */
+    0,                              /* tp_iternext */
+    Int64Dict_methods,              /* tp_methods */
+    0,                              /* tp_members */
+    0,                              /* tp_getset */
+    0,                              /* tp_base */
+    0,                              /* tp_dict */
+    0,                              /* tp_descr_get */
+    0,                              /* tp_descr_set */
+    0,                              /* tp_dictoffset */
+    0,                              /* tp_init */
+    0,                              /* tp_alloc */
+    Int64Dict__new__,               /* tp_new */
+};
+
+/* Int64DictIterator
+
+   Over the keys, by slot, reloading the table each step, as it may have
+   been resized since.
+*/
+
+typedef struct {
+    PyObject_HEAD
+    Int64Dict *dict;
+    Py_ssize_t slot;
+} Int64DictIterator;
+
+static PyTypeObject Int64DictIterator_type;
+
+static PyObject *
+Int64DictIterator_new(Int64Dict *dict)
+{
+    Int64DictIterator *this = PyObject_GC_New(Int64DictIterator, &Int64DictIterator_type);
+    if (this == NULL)
+        return NULL;
+
+    Py_INCREF(dict);
+
+    this->dict = dict;
+    this->slot = 0;
+
+    PyObject_GC_Track(this);
+
+    return (PyObject *)this;
+}
+
+static void
+Int64DictIterator__del__(PyObject *self)
+{
+    PyObject_GC_UnTrack(self);
+    Py_XDECREF(((Int64DictIterator *)self)->dict);
+    PyObject_GC_Del(self);
+}
+
+static int
+Int64DictIterator__traverse__(PyObject *self, visitproc visit, void *arg)
+{
+    Py_VISIT(((Int64DictIterator *)self)->dict);
+    return 0;
+}
+
+static PyObject *
+Int64DictIterator__next__(PyObject *self)
+{
+    Int64DictIterator *this = (Int64DictIterator *)self;
+    Int64Dict *dict = this->dict;
+    Py_ssize_t i;
+
+    if (dict == NULL)
+        return NULL;
+
+    for (i = this->slot; i < dict->size; i++) {
+        if (dict->ctrl[i] >= 0) {
+            this->slot = i + 1;
+            return PyLong_FromLongLong(dict->entries[i].key);
+        }
+    }
+
+    /* Exhausted */
+    Py_DECREF(dict);
+    this->dict = NULL;
+    return NULL;
+}
+
+static PyTypeObject
+Int64DictIterator_type = {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    "b._collections.Int64DictIterator", /* tp_name */
+    sizeof(Int64DictIterator),      /* tp_basicsize */
+    0,                              /* tp_itemsize */
+    Int64DictIterator__del__,       /* tp_dealloc */
+    0,                              /* tp_print */
+    0,                              /* tp_getattr */
+    0,                              /* tp_setattr */
+    0,                              /* tp_reserved */
+    0,                              /* tp_repr */
+    0,                              /* tp_as_number */
+    0,                              /* tp_as_sequence */
+    0,                              /* tp_as_mapping */
+    0,                              /* tp_hash  */
+    0,                              /* tp_call */
+    0,                              /* tp_str */
+    0,                              /* tp_getattro */
+    0,                              /* tp_setattro */
+    0,                              /* tp_as_buffer */
+    Py_TPFLAGS_DEFAULT |
+    Py_TPFLAGS_HAVE_GC,             /* tp_flags */
+    0,                              /* tp_doc */
+    Int64DictIterator__traverse__,  /* tp_traverse */
+    0,                              /* tp_clear */
+    0,                              /* tp_richcompare */
+    0,                              /* tp_weaklistoffset */
+    PyObject_SelfIter,              /* tp_iter */
+    Int64DictIterator__next__,      /* tp_iternext */
+};
+
+/* IdentitySet
+
+   Objects, compared by identity, in slots of bare key pointers probed by
+   control bytes as Int64Dict's and Memoizer's are (see hash.h), on
+   hash_int(): a byte and a pointer a slot, where an IdentityDict of None
+   values takes an index and an entry of two pointers as well.  It takes
+   IdentityDict's load policy, but always the group probe, whatever
+   TABLE_ENGINE is.
+*/
+
+/* `ctrl` holds a control byte per slot, and is followed in the same
+   allocation by the slots themselves, `keys`. */
+typedef struct {
+    PyObject_HEAD
+    Py_ssize_t size;
+    Py_ssize_t usable;
+    Py_ssize_t used;
+    int8_t *ctrl;
+    PyObject **keys;
+    /* As IdentityDict's */
+    double max_load;
+    Py_ssize_t growth_factor;
+    double min_load;
+    /* Live iterators: while there are any, deleting doesn't shrink the
+       table, so they don't skip keys that moved */
+    Py_ssize_t iterators;
+#ifdef TABLE_STATS
+    TableStats stats;
+#endif
+} IdentitySet;
+
+#define IDSET_CAPACITY(this) usable_at((this)->size, (this)->max_load)
+
+/* Slots marked CTRL_DELETED: neither live nor available to `usable` */
+#define IDSET_DELETED(this) (IDSET_CAPACITY(this) - (this)->usable - (this)->used)
+
+static PyTypeObject IdentitySet_type;
+
+static int8_t *
+idset_alloc(Py_ssize_t size)
+{
+    int8_t *ctrl = table_malloc(size + size * sizeof(PyObject *));
+    if (ctrl == NULL) {
+        PyErr_NoMemory();
+        return NULL;
+    }
+
+    memset(ctrl, CTRL_EMPTY, size);
+
+    return ctrl;
+}
+
+/* Slot holding `key`, else -1 */
+static inline Py_ssize_t
+idset_lookup(IdentitySet *this, PyObject *key, Py_hash_t hash)
+{
+    PyObject **keys = this->keys;
+    Py_ssize_t slot;
+    size_t groups;
+
+#define IDSET_IS_KEY(i) (keys[i] == key)
+    GROUP_LOOKUP(slot, this->ctrl, this->size, hash, groups, IDSET_IS_KEY);
+#undef IDSET_IS_KEY
+
+    STATS_LOOKUP(&this->stats, slot >= 0, groups);
+
+    return slot;
+}
+
+/* Move the live slots to a new table of `new_size` */
+static int
+idset_resize(IdentitySet *this, Py_ssize_t new_size)
+{
+    int8_t *old_ctrl = this->ctrl;
+    int8_t *new_ctrl = idset_alloc(new_size);
+
+    PyObject **old_keys = this->keys;
+    PyObject **new_keys;
+
+    register Py_ssize_t i;
+    register size_t j;
+
+    Py_hash_t hash;
+
+    if (new_ctrl == NULL)
+        return -1;
+
+    new_keys = (PyObject **)&new_ctrl[new_size];
+
+    for (i = 0; i < this->size; i++) {
+        if (old_ctrl[i] < 0)
+            continue;
+
+        hash = hash_int(old_keys[i]);
+
+        j = group_find_free(new_ctrl, new_size, hash);
+
+        new_ctrl[j] = H2(hash);
+        new_keys[j] = old_keys[i];
+    }
+
+    table_free(old_ctrl);
+
+    this->ctrl = new_ctrl;
+    this->keys = new_keys;
+    this->size = new_size;
+    this->usable = IDSET_CAPACITY(this) - this->used;
+
+    return 0;
+}
+
+/* The size to grow to for one more key, else -1 with MemoryError set */
+static Py_ssize_t
+idset_grow_size(IdentitySet *this)
+{
+    Py_ssize_t size = this->size;
+
+    /* At a low enough max_load, one step may not make room for another */
+    do {
+        if (size > PY_SSIZE_T_MAX / (this->growth_factor * (Py_ssize_t)(1 + sizeof(PyObject *)))) {
+            PyErr_NoMemory();
+            return -1;
+        }
+
+        size *= this->growth_factor;
+    } while (usable_at(size, this->max_load) <= this->used);
+
+    return size;
+}
+
+/* Add `key`, known to be absent, with a new reference to it */
+static int
+idset_insert(IdentitySet *this, PyObject *key, Py_hash_t hash)
+{
+    size_t slot = group_find_free(this->ctrl, this->size, hash);
+
+    Py_ssize_t size;
+
+    /* Reusing a deleted slot leaves `usable` alone. */
+    if (this->ctrl[slot] == CTRL_EMPTY) {
+        if (this->usable <= 0) {
+            /* Deleted slots are at least as many as live ones: rehash
+               at the same size to reclaim them. */
+            if (IDSET_DELETED(this) >= this->used) {
+                if (idset_resize(this, this->size) == -1)
+                    return -1;
+            } else {
+                STATS_GROW_BEGIN(start);
+
+                size = idset_grow_size(this);
+                if (size == -1 || idset_resize(this, size) == -1)
+                    return -1;
+
+                STATS_GROW_END(&this->stats, start);
+            }
+
+            slot = group_find_free(this->ctrl, this->size, hash);
+        }
+
+        this->usable--;
+    }
+
+    Py_INCREF(key);
+
+    this->ctrl[slot] = H2(hash);
+    this->keys[slot] = key;
+
+    this->used++;
+
+    return 0;
+}
+
+/* Add `key` if absent */
+static int
+idset_add(IdentitySet *this, PyObject *key)
+{
+    Py_hash_t hash = hash_int(key);
+
+    if (idset_lookup(this, key, hash) >= 0)
+        return 0;
+
+    return idset_insert(this, key, hash);
+}
+
+/* Empty the slot of a live key, and return its reference */
+static PyObject *
+idset_delete(IdentitySet *this, Py_ssize_t slot)
+{
+    PyObject *key = this->keys[slot];
+
+    this->ctrl[slot] = CTRL_DELETED;
+    this->keys[slot] = NULL;
+    this->used--;
+
+    return key;
+}
+
+/* After a delete, as IdentityDict's maybe_shrink() */
+static void
+idset_maybe_shrink(IdentitySet *this)
+{
+    Py_ssize_t size;
+
+    if (this->iterators > 0 || !((double)this->used < this->size * this->min_load))
+        return;
+
+    size = size_for(this->used * 2, this->max_load);
+
+    if (size == -1 || (size < this->size && idset_resize(this, size) == -1))
+        PyErr_Clear();
+}
+
+/* An empty `type` with room for `capacity` keys, and the given load
+   policy */
+static IdentitySet *
+idset_new(PyTypeObject *type, Py_ssize_t capacity,
+          double max_load, Py_ssize_t growth_factor, double min_load)
+{
+    IdentitySet *this;
+    Py_ssize_t size;
+    int8_t *ctrl;
+
+    if (check_load_policy(max_load, growth_factor) == -1 ||
+        check_min_load(&min_load, max_load, growth_factor) == -1)
+        return NULL;
+
+    size = size_for(capacity, max_load);
+    if (size == -1)
+        return NULL;
+
+    ctrl = idset_alloc(size);
+    if (ctrl == NULL)
+        return NULL;
+
+    this = (IdentitySet *)type->tp_alloc(type, 0);
+    if (this == NULL) {
+        table_free(ctrl);
+        return NULL;
+    }
+
+    this->ctrl = ctrl;
+    this->keys = (PyObject **)&ctrl[size];
+    this->size = size;
+    this->used = 0;
+    this->max_load = max_load;
+    this->growth_factor = growth_factor;
+    this->min_load = min_load;
+    this->iterators = 0;
+    this->usable = IDSET_CAPACITY(this);
+
+    STATS_CLEAR(&this->stats);
+
+    return this;
+}
+
+/* Add each of `iterable` */
+static int
+idset_update(IdentitySet *this, PyObject *iterable)
+{
+    PyObject *iterator, *key;
+    int status = 0;
+
+    if (Py_TYPE(iterable) == &IdentitySet_type) {
+        IdentitySet *other = (IdentitySet *)iterable;
+        Py_ssize_t i;
+
+        /* Straight off the table, which adding never calls out from */
+        for (i = 0; i < other->size && status == 0; i++) {
+            if (other->ctrl[i] >= 0)
+                status = idset_add(this, other->keys[i]);
+        }
+
+        return status;
+    }
+
+    iterator = PyObject_GetIter(iterable);
+    if (iterator == NULL)
+        return -1;
+
+    while (status == 0 && (key = PyIter_Next(iterator)) != NULL) {
+        status = idset_add(this, key);
+        Py_DECREF(key);
+    }
+
+    Py_DECREF(iterator);
+
+    return status == 0 && PyErr_Occurred() ? -1 : status;
+}
+
+PyDoc_STRVAR(IdentitySet__doc__,
+"Set of objects, compared by identity, so unhashable ones too.\n"
+"\n"
+"IdentitySet(iterable=(), *, capacity=0, max_load=2/3, growth_factor=2, min_load=1/12)\n"
+"\n"
+"Use it where an IdentityDict would hold only None values, e.g. the\n"
+"visited set of a graph traversal: it keeps just a pointer a slot.\n"
+"The load policy is as IdentityDict's.");
+
+static PyObject *
+IdentitySet__new__(PyTypeObject *type, PyObject *args, PyObject *kwargs)
+{
+    static char *kwlist[] = {"iterable", "capacity", "max_load", "growth_factor", "min_load", NULL};
+
+    PyObject *iterable = NULL;
+    Py_ssize_t capacity = 0;
+    double max_load = DEFAULT_MAX_LOAD;
+    Py_ssize_t growth_factor = DEFAULT_GROWTH_FACTOR;
+    double min_load = MIN_LOAD_DEFAULT;
+    IdentitySet *this;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "|O$ndnd:IdentitySet", kwlist,
+                                     &iterable, &capacity, &max_load, &growth_factor, &min_load))
+        return NULL;
+
+    if (capacity < 0) {
+        PyErr_SetString(PyExc_ValueError, "IdentitySet() of a negative capacity");
+        return NULL;
+    }
+
+    this = idset_new(type, capacity, max_load, growth_factor, min_load);
+    if (this == NULL)
+        return NULL;
+
+    if (iterable != NULL && idset_update(this, iterable) == -1) {
+        Py_DECREF(this);
+        return NULL;
+    }
+
+    return (PyObject *)this;
+}
+
+/* Drops the keys one at a time, reloading the table, as dropping may
+   re-enter */
+static int
+IdentitySet__clear__(PyObject *self)
+{
+    IdentitySet *this = (IdentitySet *)self;
+    Py_ssize_t i;
+
+    for (i = 0; i < this->size; i++) {
+        if (this->ctrl[i] >= 0)
+            Py_DECREF(idset_delete(this, i));
+    }
+
+    /* Nothing re-entered to add more: reset the control bytes too, or
+       with shrinking on, go back to the least table. */
+    if (this->used == 0) {
+        if (this->min_load > 0.0 && this->iterators == 0 && this->size > INITIAL_SIZE) {
+            if (idset_resize(this, INITIAL_SIZE) == 0)
+                return 0;
+
+            PyErr_Clear();
+        }
+
+        memset(this->ctrl, CTRL_EMPTY, this->size);
+        this->usable = IDSET_CAPACITY(this);
+    }
+
+    return 0;
+}
+
+static void
+IdentitySet__del__(PyObject *self)
+{
+    IdentitySet *this = (IdentitySet *)self;
+    Py_ssize_t i;
+
+    PyObject_GC_UnTrack(self);
+    Py_TRASHCAN_BEGIN(self, IdentitySet__del__)
+
+    for (i = 0; i < this->size; i++) {
+        if (this->ctrl[i] >= 0)
+            Py_DECREF(this->keys[i]);
+    }
+
+    table_free(this->ctrl);
+
+    Py_TYPE(self)->tp_free(self);
+
+    Py_TRASHCAN_END
+}
+
+static int
+IdentitySet__traverse__(PyObject *self, visitproc visit, void *arg)
+{
+    IdentitySet *this = (IdentitySet *)self;
+    Py_ssize_t i;
+
+    for (i = 0; i < this->size; i++) {
+        if (this->ctrl[i] >= 0)
+            Py_VISIT(this->keys[i]);
+    }
+
+    return 0;
+}
+
+static Py_ssize_t
+IdentitySet__len__(PyObject *self)
+{
+    return ((IdentitySet *)self)->used;
+}
+
+static int
+IdentitySet__contains__(PyObject *self, PyObject *key)
+{
+    return idset_lookup((IdentitySet *)self, key, hash_int(key)) >= 0;
+}
+
+static PyObject * IdentitySetIterator_new(IdentitySet *set);
+
+static PyObject *
+IdentitySet__iter__(PyObject *self)
+{
+    return IdentitySetIterator_new((IdentitySet *)self);
+}
+
+/* Set algebra
+
+   Both operands must be IdentitySets, as both of set's must be sets.
+   Each result is a new IdentitySet, built by walking the operand that
+   makes for the fewest probes.
+*/
+
+/* A copy of `this`: its table as is, with new references to the keys */
+static IdentitySet *
+idset_copy(IdentitySet *this)
+{
+    IdentitySet *copy;
+    Py_ssize_t i;
+
+    copy = (IdentitySet *)IdentitySet_type.tp_alloc(&IdentitySet_type, 0);
+    if (copy == NULL)
+        return NULL;
+
+    copy->ctrl = idset_alloc(this->size);
+    if (copy->ctrl == NULL) {
+        copy->size = 0;
+        Py_DECREF(copy);
+        return NULL;
+    }
+
+    memcpy(copy->ctrl, this->ctrl, this->size + this->size * sizeof(PyObject *));
+
+    copy->keys = (PyObject **)&copy->ctrl[this->size];
+    copy->size = this->size;
+    copy->usable = this->usable;
+    copy->used = this->used;
+    copy->max_load = this->max_load;
+    copy->growth_factor = this->growth_factor;
+    copy->min_load = this->min_load;
+    copy->iterators = 0;
+
+    STATS_CLEAR(&copy->stats);
+
+    for (i = 0; i < copy->size; i++) {
+        if (copy->ctrl[i] >= 0)
+            Py_INCREF(copy->keys[i]);
+    }
+
+    return copy;
+}
+
+/* The keys of `a` that are in `b`, or with `in` 0, that aren't, under
+   the load policy of `a` */
+static PyObject *
+idset_filter(IdentitySet *a, IdentitySet *b, int in)
+{
+    IdentitySet *result = idset_new(&IdentitySet_type, in ? Py_MIN(a->used, b->used) : a->used,
+                                    a->max_load, a->growth_factor, a->min_load);
+    PyObject *key;
+    Py_ssize_t i;
+
+    if (result == NULL)
+        return NULL;
+
+    for (i = 0; i < a->size; i++) {
+        if (a->ctrl[i] < 0)
+            continue;
+
+        key = a->keys[i];
+
+        if (IdentitySet__contains__((PyObject *)b, key) == in &&
+            idset_add(result, key) == -1) {
+            Py_DECREF(result);
+            return NULL;
+        }
+    }
+
+    return (PyObject *)result;
+}
+
+static PyObject *
+IdentitySet__and__(PyObject *a, PyObject *b)
+{
+    if (Py_TYPE(a) != &IdentitySet_type || Py_TYPE(b) != &IdentitySet_type)
+        Py_RETURN_NOTIMPLEMENTED;
+
+    /* Walk the smaller */
+    if (((IdentitySet *)a)->used > ((IdentitySet *)b)->used)
+        return idset_filter((IdentitySet *)b, (IdentitySet *)a, 1);
+
+    return idset_filter((IdentitySet *)a, (IdentitySet *)b, 1);
+}
+
+static PyObject *
+IdentitySet__sub__(PyObject *a, PyObject *b)
+{
+    if (Py_TYPE(a) != &IdentitySet_type || Py_TYPE(b) != &IdentitySet_type)
+        Py_RETURN_NOTIMPLEMENTED;
+
+    return idset_filter((IdentitySet *)a, (IdentitySet *)b, 0);
+}
+
+static PyObject *
+IdentitySet__or__(PyObject *a, PyObject *b)
+{
+    IdentitySet *result;
+
+    if (Py_TYPE(a) != &IdentitySet_type || Py_TYPE(b) != &IdentitySet_type)
+        Py_RETURN_NOTIMPLEMENTED;
+
+    /* Copy the larger, and add the smaller */
+    if (((IdentitySet *)a)->used < ((IdentitySet *)b)->used) {
+        PyObject *swap = a;
+        a = b;
+        b = swap;
+    }
+
+    result = idset_copy((IdentitySet *)a);
+    if (result == NULL)
+        return NULL;
+
+    if (idset_update(result, b) == -1) {
+        Py_DECREF(result);
+        return NULL;
+    }
+
+    return (PyObject *)result;
+}
+
+static PyObject *
+IdentitySet__xor__(PyObject *a, PyObject *b)
+{
+    IdentitySet *result, *other;
+    PyObject *key;
+    Py_ssize_t i, slot;
+    Py_hash_t hash;
+
+    if (Py_TYPE(a) != &IdentitySet_type || Py_TYPE(b) != &IdentitySet_type)
+        Py_RETURN_NOTIMPLEMENTED;
+
+    /* Copy the larger, and toggle each of the smaller */
+    if (((IdentitySet *)a)->used < ((IdentitySet *)b)->used) {
+        PyObject *swap = a;
+        a = b;
+        b = swap;
+    }
+
+    result = idset_copy((IdentitySet *)a);
+    if (result == NULL)
+        return NULL;
+
+    other = (IdentitySet *)b;
+
+    for (i = 0; i < other->size; i++) {
+        if (other->ctrl[i] < 0)
+            continue;
+
+        key = other->keys[i];
+        hash = hash_int(key);
+        slot = idset_lookup(result, key, hash);
+
+        if (slot >= 0) {
+            /* Still held by `other` */
+            Py_DECREF(idset_delete(result, slot));
+        } else if (idset_insert(result, key, hash) == -1) {
+            Py_DECREF(result);
+            return NULL;
+        }
+    }
+
+    return (PyObject *)result;
+}
+
+static PyNumberMethods
+IdentitySet_as_number = {
+    0,                              /* nb_add */
+    IdentitySet__sub__,             /* nb_subtract */
+    0,                              /* nb_multiply */
+    0,                              /* nb_remainder */
+    0,                              /* nb_divmod */
+    0,                              /* nb_power */
+    0,                              /* nb_negative */
+    0,                              /* nb_positive */
+    0,                              /* nb_absolute */
+    0,                              /* nb_bool */
+    0,                              /* nb_invert */
+    0,                              /* nb_lshift */
+    0,                              /* nb_rshift */
+    IdentitySet__and__,             /* nb_and */
+    IdentitySet__xor__,             /* nb_xor */
+    IdentitySet__or__,              /* nb_or */
+};
+
+PyDoc_STRVAR(IdentitySet_add__doc__,
+"Add `key`, if not already there.\n"
 "\n"
-"IdentityDict.copy()");
+"IdentitySet.add(key)");
+
+static PyObject *
+IdentitySet_add(PyObject *self, PyObject *key)
+{
+    if (idset_add((IdentitySet *)self, key) == -1)
+        return NULL;
+
+    Py_RETURN_NONE;
+}
+
+PyDoc_STRVAR(IdentitySet_discard__doc__,
+"Remove `key`, if there.\n"
+"\n"
+"IdentitySet.discard(key)");
+
+static PyObject *
+IdentitySet_discard(PyObject *self, PyObject *key)
+{
+    IdentitySet *this = (IdentitySet *)self;
+    Py_ssize_t slot = idset_lookup(this, key, hash_int(key));
+
+    if (slot >= 0) {
+        Py_DECREF(idset_delete(this, slot));
+        idset_maybe_shrink(this);
+    }
+
+    Py_RETURN_NONE;
+}
+
+PyDoc_STRVAR(IdentitySet_remove__doc__,
+"Remove `key`; if not there, raise KeyError.\n"
+"\n"
+"IdentitySet.remove(key)");
+
+static PyObject *
+IdentitySet_remove(PyObject *self, PyObject *key)
+{
+    IdentitySet *this = (IdentitySet *)self;
+    Py_ssize_t slot = idset_lookup(this, key, hash_int(key));
+
+    if (slot < 0) {
+        _PyErr_SetKeyError(key);
+        return NULL;
+    }
+
+    Py_DECREF(idset_delete(this, slot));
+    idset_maybe_shrink(this);
+
+    Py_RETURN_NONE;
+}
+
+PyDoc_STRVAR(IdentitySet_update__doc__,
+"Add each object of `iterable`.\n"
+"\n"
+"IdentitySet.update(iterable)");
+
+static PyObject *
+IdentitySet_update(PyObject *self, PyObject *iterable)
+{
+    if (idset_update((IdentitySet *)self, iterable) == -1)
+        return NULL;
+
+    Py_RETURN_NONE;
+}
+
+PyDoc_STRVAR(IdentitySet_copy__doc__,
+"Return a shallow copy of S.\n"
+"\n"
+"IdentitySet.copy()");
+
+static PyObject *
+IdentitySet_copy(PyObject *self, PyObject *_)
+{
+    return (PyObject *)idset_copy((IdentitySet *)self);
+}
+
+PyDoc_STRVAR(IdentitySet_clear__doc__,
+"Remove all objects from S.\n"
+"\n"
+"IdentitySet.clear()");
+
+static PyObject *
+IdentitySet_clear(PyObject *self, PyObject *_)
+{
+    IdentitySet__clear__(self);
+    Py_RETURN_NONE;
+}
+
+PyDoc_STRVAR(IdentitySet__sizeof____doc__,
+"Size of S in memory, in bytes, its table included.\n"
+"\n"
+"IdentitySet.__sizeof__()");
+
+static PyObject *
+IdentitySet__sizeof__(PyObject *self, PyObject *_)
+{
+    IdentitySet *this = (IdentitySet *)self;
+
+    return PyLong_FromSsize_t(Py_TYPE(self)->tp_basicsize +
+                              this->size + this->size * sizeof(PyObject *));
+}
+
+#ifdef TABLE_STATS
+PyDoc_STRVAR(IdentitySet__stats__doc__,
+"Return the lookup and growth statistics of S, and the state of its table.\n"
+"\n"
+"IdentitySet._stats()");
+
+static PyObject *
+IdentitySet__stats(PyObject *self, PyObject *_)
+{
+    IdentitySet *this = (IdentitySet *)self;
+
+    return stats_dict(&this->stats, this->size, this->used, IDSET_DELETED(this));
+}
+#endif
+
+static PyMethodDef
+IdentitySet_methods[] = {
+    {"add", IdentitySet_add, METH_O, IdentitySet_add__doc__},
+    {"discard", IdentitySet_discard, METH_O, IdentitySet_discard__doc__},
+    {"remove", IdentitySet_remove, METH_O, IdentitySet_remove__doc__},
+    {"update", IdentitySet_update, METH_O, IdentitySet_update__doc__},
+    {"copy", IdentitySet_copy, METH_NOARGS, IdentitySet_copy__doc__},
+    {"clear", IdentitySet_clear, METH_NOARGS, IdentitySet_clear__doc__},
+    {"__sizeof__", IdentitySet__sizeof__, METH_NOARGS, IdentitySet__sizeof____doc__},
+#ifdef TABLE_STATS
+    {"_stats", IdentitySet__stats, METH_NOARGS, IdentitySet__stats__doc__},
+#endif
+    {NULL, NULL} /* sentinel */
+};
+
+static PyObject *
+IdentitySet_max_load(PyObject *self, void *_)
+{
+    return PyFloat_FromDouble(((IdentitySet *)self)->max_load);
+}
+
+static PyObject *
+IdentitySet_growth_factor(PyObject *self, void *_)
+{
+    return PyLong_FromSsize_t(((IdentitySet *)self)->growth_factor);
+}
+
+static PyObject *
+IdentitySet_min_load(PyObject *self, void *_)
+{
+    return PyFloat_FromDouble(((IdentitySet *)self)->min_load);
+}
+
+static PyGetSetDef
+IdentitySet_getset[] = {
+    {"max_load", IdentitySet_max_load, NULL,
+     "Fraction of its slots the table fills before it grows."},
+    {"growth_factor", IdentitySet_growth_factor, NULL,
+     "How many times over the table grows when full."},
+    {"min_load", IdentitySet_min_load, NULL,
+     "Fraction of its slots below which deleting shrinks the table; 0 for never."},
+    {0}
+};
+
+static PySequenceMethods
+IdentitySet_as_sequence = {
+    IdentitySet__len__,             /* sq_length */
+    0,                              /* sq_concat */
+    0,                              /* sq_repeat */
+    0,                              /* sq_item */
+    0,                              /* sq_slice */
+    0,                              /* sq_ass_item */
+    0,                              /* sq_ass_slice */
+    IdentitySet__contains__,        /* sq_contains */
+    0,                              /* sq_inplace_concat */
+    0,                              /* sq_inplace_repeat */
+};
+
+static PyTypeObject
+IdentitySet_type = {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    "b._collections.IdentitySet",   /* tp_name */
+    sizeof(IdentitySet),            /* tp_basicsize */
+    0,                              /* tp_itemsize */
+    IdentitySet__del__,             /* tp_dealloc */
+    0,                              /* tp_print */
+    0,                              /* tp_getattr */
+    0,                              /* tp_setattr */
+    0,                              /* tp_reserved */
+    0,                              /* tp_repr */
+    &IdentitySet_as_number,         /* tp_as_number */
+    &IdentitySet_as_sequence,       /* tp_as_sequence */
+    0,                              /* tp_as_mapping */
+    0,                              /* tp_hash  */
+    0,                              /* tp_call */
+    0,                              /* tp_str */
+    0,                              /* tp_getattro */
+    0,                              /* tp_setattro */
+    0,                              /* tp_as_buffer */
+    Py_TPFLAGS_DEFAULT |
+    Py_TPFLAGS_HAVE_GC,             /* tp_flags */
+    IdentitySet__doc__,             /* tp_doc */
+    IdentitySet__traverse__,        /* tp_traverse */
+    IdentitySet__clear__,           /* tp_clear */
+    0,                              /* tp_richcompare */
+    0,                              /* tp_weaklistoffset */
+    IdentitySet__iter__,            /* tp_iter */
+    0,                              /* tp_iternext */
+    IdentitySet_methods,            /* tp_methods */
+    0,                              /* tp_members */
+    IdentitySet_getset,             /* tp_getset */
+    0,                              /* tp_base */
+    0,                              /* tp_dict */
+    0,                              /* tp_descr_get */
+    0,                              /* tp_descr_set */
+    0,                              /* tp_dictoffset */
+    0,                              /* tp_init */
+    0,                              /* tp_alloc */
+    IdentitySet__new__,             /* tp_new */
+};
+
+/* IdentitySetIterator
+
+   Over the keys, by slot, reloading the table each step, as it may have
+   been resized since.
+*/
+
+typedef struct {
+    PyObject_HEAD
+    IdentitySet *set;
+    Py_ssize_t slot;
+} IdentitySetIterator;
+
+static PyTypeObject IdentitySetIterator_type;
+
+static PyObject *
+IdentitySetIterator_new(IdentitySet *set)
+{
+    IdentitySetIterator *this = PyObject_GC_New(IdentitySetIterator, &IdentitySetIterator_type);
+    if (this == NULL)
+        return NULL;
+
+    Py_INCREF(set);
+    set->iterators++;
+
+    this->set = set;
+    this->slot = 0;
+
+    PyObject_GC_Track(this);
+
+    return (PyObject *)this;
+}
+
+/* Let go of the set, and with the last iterator, let it shrink again */
+static void
+IdentitySetIterator_release(IdentitySetIterator *this)
+{
+    IdentitySet *set = this->set;
+
+    this->set = NULL;
+    set->iterators--;
+    Py_DECREF(set);
+}
+
+static void
+IdentitySetIterator__del__(PyObject *self)
+{
+    PyObject_GC_UnTrack(self);
+    if (((IdentitySetIterator *)self)->set != NULL)
+        IdentitySetIterator_release((IdentitySetIterator *)self);
+    PyObject_GC_Del(self);
+}
+
+static int
+IdentitySetIterator__traverse__(PyObject *self, visitproc visit, void *arg)
+{
+    Py_VISIT(((IdentitySetIterator *)self)->set);
+    return 0;
+}
+
+static PyObject *
+IdentitySetIterator__next__(PyObject *self)
+{
+    IdentitySetIterator *this = (IdentitySetIterator *)self;
+    IdentitySet *set = this->set;
+    PyObject *key;
+    Py_ssize_t i;
+
+    if (set == NULL)
+        return NULL;
+
+    for (i = this->slot; i < set->size; i++) {
+        if (set->ctrl[i] >= 0) {
+            this->slot = i + 1;
+            key = set->keys[i];
+            Py_INCREF(key);
+            return key;
+        }
+    }
+
+    /* Exhausted */
+    IdentitySetIterator_release(this);
+    return NULL;
+}
 
-#define IDENTITYDICT_COPY_METHODDEF    \
-    {"copy", (PyCFunction)IdentityDict_copy, METH_NOARGS, IdentityDict_copy__doc__},
+static PyTypeObject
+IdentitySetIterator_type = {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    "b._collections.IdentitySetIterator", /* tp_name */
+    sizeof(IdentitySetIterator),    /* tp_basicsize */
+    0,                              /* tp_itemsize */
+    IdentitySetIterator__del__,     /* tp_dealloc */
+    0,                              /* tp_print */
+    0,                              /* tp_getattr */
+    0,                              /* tp_setattr */
+    0,                              /* tp_reserved */
+    0,                              /* tp_repr */
+    0,                              /* tp_as_number */
+    0,                              /* tp_as_sequence */
+    0,                              /* tp_as_mapping */
+    0,                              /* tp_hash  */
+    0,                              /* tp_call */
+    0,                              /* tp_str */
+    0,                              /* tp_getattro */
+    0,                              /* tp_setattro */
+    0,                              /* tp_as_buffer */
+    Py_TPFLAGS_DEFAULT |
+    Py_TPFLAGS_HAVE_GC,             /* tp_flags */
+    0,                              /* tp_doc */
+    IdentitySetIterator__traverse__, /* tp_traverse */
+    0,                              /* tp_clear */
+    0,                              /* tp_richcompare */
+    0,                              /* tp_weaklistoffset */
+    PyObject_SelfIter,              /* tp_iter */
+    IdentitySetIterator__next__,    /* tp_iternext */
+};
 
-static PyObject *
-IdentityDict_copy(PyObject *self)
-/*[clinic checksum: 9dd173fedc5b12bd096378f66b7b9c4127e98150]*/
+/* PersistentIdentityMap
+
+   An immutable hash array mapped trie on `hash_int()`: each level down
+   takes HAMT_BITS more of the hash, and `set()` and `delete()` copy only
+   the nodes along one path, sharing all the rest with the map they were
+   made from.
+
+   A node's array holds key, value pairs, in the order of their bits in
+   `bitmap`; a pair whose key is NULL holds the node for its bit instead.
+   Keys whose whole hashes are equal end up in a collision node, with a
+   `bitmap` of 0, searched linearly.  No node but the empty root has
+   fewer than two pairs: deleting down to one moves it up a level.
+*/
+
+#define HAMT_BITS 5
+#define HAMT_MASK ((1 << HAMT_BITS) - 1)
+
+/* Bitmap levels for every bit of the hash, then a collision node */
+#define HAMT_MAX_DEPTH ((8 * SIZEOF_SIZE_T + HAMT_BITS - 1) / HAMT_BITS + 1)
+
+typedef struct {
+    PyObject_VAR_HEAD
+    uint32_t bitmap;
+    PyObject *array[1];
+} HamtNode;
+
+#define HAMT_BIT(hash, shift) ((uint32_t)1 << (((hash) >> (shift)) & HAMT_MASK))
+
+#define HAMT_IS_COLLISION(node) ((node)->bitmap == 0 && Py_SIZE(node) > 0)
+
+/* A lone pair, which belongs a level up */
+#define HAMT_IS_PAIR(node) (Py_SIZE(node) == 2 && (node)->array[0] != NULL)
+
+/* Overridable, to force collisions when testing, e.g. B_HAMT_HASH=0
+   ./setup.py build_ext */
+#ifndef HAMT_HASH
+#define HAMT_HASH(key) ((size_t)hash_int(key))
+#endif
+
+static PyTypeObject HamtNode_type;
+
+/* The root of every empty map */
+static HamtNode *hamt_empty;
+
+static inline Py_ssize_t
+hamt_index(uint32_t bitmap, uint32_t bit)
 {
-    PyErr_SetString(PyExc_NotImplementedError, "IdentityDict.copy");
-    return NULL;
+    bitmap &= bit - 1;
+#if defined(__GNUC__)
+    return 2 * __builtin_popcount(bitmap);
+#else
+    bitmap = bitmap - ((bitmap >> 1) & 0x55555555);
+    bitmap = (bitmap & 0x33333333) + ((bitmap >> 2) & 0x33333333);
+    return 2 * ((((bitmap + (bitmap >> 4)) & 0x0f0f0f0f) * 0x01010101) >> 24);
+#endif
 }
 
-static PyMethodDef
-IdentityDict_methods[] = {
-    IDENTITYDICT_GET_METHODDEF
-    IDENTITYDICT_SETDEFAULT_METHODDEF
-    IDENTITYDICT_POP_METHODDEF
-    IDENTITYDICT_POPITEM_METHODDEF
-    IDENTITYDICT_KEYS_METHODDEF
-    IDENTITYDICT_ITEMS_METHODDEF
-    IDENTITYDICT_VALUES_METHODDEF
-    IDENTITYDICT_UPDATE_METHODDEF
-    /* fromkeys? */
-    IDENTITYDICT_CLEAR_METHODDEF
-    IDENTITYDICT_COPY_METHODDEF
-    {NULL, NULL} /* sentinel */
-};
+/* An untracked node of `size` NULL slots, for the caller to fill and track */
+static HamtNode *
+HamtNode_new(uint32_t bitmap, Py_ssize_t size)
+{
+    HamtNode *node = PyObject_GC_NewVar(HamtNode, &HamtNode_type, size);
+    if (node == NULL)
+        return NULL;
 
-static PyMappingMethods
-IdentityDict_as_mapping = {
-    IdentityDict__len__,      /* mp_length */
-    IdentityDict__getitem__,  /* mp_subscript */
-    IdentityDict__setitem__,  /* mp_ass_subscript */
-};
+    node->bitmap = bitmap;
 
-static PySequenceMethods
-IdentityDict_as_sequence = {
-    0,                          /* sq_length */
-    0,                          /* sq_concat */
-    0,                          /* sq_repeat */
-    0,                          /* sq_item */
-    0,                          /* sq_slice */
-    0,                          /* sq_ass_item */
-    0,                          /* sq_ass_slice */
-    IdentityDict__contains__,   /* sq_contains */
-    0,                          /* sq_inplace_concat */
-    0,                          /* sq_inplace_repeat */
-};
+    memset(node->array, 0, size * sizeof(PyObject *));
+
+    return node;
+}
+
+static void
+HamtNode__del__(PyObject *self)
+{
+    HamtNode *node = (HamtNode *)self;
+    Py_ssize_t i;
+
+    PyObject_GC_UnTrack(self);
+    Py_TRASHCAN_BEGIN(self, HamtNode__del__)
+
+    for (i = 0; i < Py_SIZE(node); i++)
+        Py_XDECREF(node->array[i]);
+
+    PyObject_GC_Del(self);
+
+    Py_TRASHCAN_END
+}
+
+static int
+HamtNode__traverse__(PyObject *self, visitproc visit, void *arg)
+{
+    HamtNode *node = (HamtNode *)self;
+    Py_ssize_t i;
+
+    for (i = 0; i < Py_SIZE(node); i++)
+        Py_VISIT(node->array[i]);
+
+    return 0;
+}
 
 static PyTypeObject
-IdentityDict_type = {
+HamtNode_type = {
     PyVarObject_HEAD_INIT(NULL, 0)
-    "b._collections.IdentityDict", /* tp_name */
-    sizeof(IdentityDict),      /* tp_basicsize */
-    0,                         /* tp_itemsize */
-    IdentityDict__del__,       /* tp_dealloc */
-    0,                         /* tp_print */
-    0,                         /* tp_getattr */
-    0,                         /* tp_setattr */
-    0,                         /* tp_reserved */
-    0,                         /* tp_repr */
-    0,                         /* tp_as_number */
-    &IdentityDict_as_sequence, /* tp_as_sequence */
-    &IdentityDict_as_mapping,  /* tp_as_mapping */
-    0,                         /* tp_hash  */
-    0,                         /* tp_call */
-    0,                         /* tp_str */
-    0,                         /* tp_getattro */
-    0,                         /* tp_setattro */
-    0,                         /* tp_as_buffer */
-    Py_TPFLAGS_DEFAULT,        /* tp_flags */
-    IdentityDict__doc__,       /* tp_doc */
-    0,                         /* tp_traverse */
-    0,                         /* tp_clear */
-    0,                         /* tp_richcompare */
-    0,                         /* tp_weaklistoffset */
-    IdentityDict__iter__,      /* tp_iter */
-    0,                         /* tp_iternext */
-    IdentityDict_methods,      /* tp_methods */
-    0,                         /* tp_members */
-    0,                         /* tp_getset */
-    0,                         /* tp_base */
-    0,                         /* tp_dict */
-    0,                         /* tp_descr_get */
-    0,                         /* tp_descr_set */
-    0,                         /* tp_dictoffset */
-    0,                         /* tp_init */
-    0,                         /* tp_alloc */
-    IdentityDict__new__,       /* tp_new */
+    "b._collections.HamtNode",      /* tp_name */
+    offsetof(HamtNode, array),      /* tp_basicsize */
+    sizeof(PyObject *),             /* tp_itemsize */
+    HamtNode__del__,                /* tp_dealloc */
+    0,                              /* tp_print */
+    0,                              /* tp_getattr */
+    0,                              /* tp_setattr */
+    0,                              /* tp_reserved */
+    0,                              /* tp_repr */
+    0,                              /* tp_as_number */
+    0,                              /* tp_as_sequence */
+    0,                              /* tp_as_mapping */
+    0,                              /* tp_hash  */
+    0,                              /* tp_call */
+    0,                              /* tp_str */
+    0,                              /* tp_getattro */
+    0,                              /* tp_setattro */
+    0,                              /* tp_as_buffer */
+    Py_TPFLAGS_DEFAULT |
+    Py_TPFLAGS_HAVE_GC,             /* tp_flags */
+    0,                              /* tp_doc */
+    HamtNode__traverse__,           /* tp_traverse */
 };
 
-/* IdentityDictIterator */
+/* The value for `key`, borrowed, else NULL */
+static PyObject *
+hamt_find(HamtNode *node, size_t hash, PyObject *key)
+{
+    int shift;
+    uint32_t bit;
+    Py_ssize_t i;
+
+    for (shift = 0; ; shift += HAMT_BITS) {
+        if (HAMT_IS_COLLISION(node)) {
+            for (i = 0; i < Py_SIZE(node); i += 2)
+                if (node->array[i] == key)
+                    return node->array[i + 1];
+
+            return NULL;
+        }
+
+        bit = HAMT_BIT(hash, shift);
+
+        if (!(node->bitmap & bit))
+            return NULL;
+
+        i = hamt_index(node->bitmap, bit);
+
+        if (node->array[i] != NULL)
+            return node->array[i] == key ? node->array[i + 1] : NULL;
+
+        node = (HamtNode *)node->array[i + 1];
+    }
+}
+
+/* A copy of `node` with the pair at `i` replaced by `key` and `value`,
+   whose references it steals (`key` being NULL for a node) */
+static HamtNode *
+hamt_replace(HamtNode *node, Py_ssize_t i, PyObject *key, PyObject *value)
+{
+    HamtNode *copy;
+    Py_ssize_t j, n = Py_SIZE(node);
+
+    copy = HamtNode_new(node->bitmap, n);
+    if (copy == NULL) {
+        Py_XDECREF(key);
+        Py_DECREF(value);
+        return NULL;
+    }
+
+    for (j = 0; j < n; j++) {
+        copy->array[j] = node->array[j];
+        Py_XINCREF(copy->array[j]);
+    }
+
+    Py_XDECREF(copy->array[i]);
+    Py_DECREF(copy->array[i + 1]);
+
+    copy->array[i] = key;
+    copy->array[i + 1] = value;
+
+    PyObject_GC_Track(copy);
+
+    return copy;
+}
+
+/* A copy of `node` with `key` and `value` inserted as pair `i`, and
+   `bitmap` for its own */
+static HamtNode *
+hamt_insert(HamtNode *node, uint32_t bitmap, Py_ssize_t i, PyObject *key, PyObject *value)
+{
+    HamtNode *copy;
+    Py_ssize_t j, n = Py_SIZE(node);
+
+    copy = HamtNode_new(bitmap, n + 2);
+    if (copy == NULL)
+        return NULL;
+
+    for (j = 0; j < i; j++)
+        copy->array[j] = node->array[j];
+
+    copy->array[i] = key;
+    copy->array[i + 1] = value;
+
+    for (j = i; j < n; j++)
+        copy->array[j + 2] = node->array[j];
+
+    for (j = 0; j < n + 2; j++)
+        Py_XINCREF(copy->array[j]);
+
+    PyObject_GC_Track(copy);
+
+    return copy;
+}
+
+/* A copy of `node` without pair `i`, and `bitmap` for its own */
+static HamtNode *
+hamt_remove(HamtNode *node, uint32_t bitmap, Py_ssize_t i)
+{
+    HamtNode *copy;
+    Py_ssize_t j, n = Py_SIZE(node);
+
+    copy = HamtNode_new(bitmap, n - 2);
+    if (copy == NULL)
+        return NULL;
+
+    for (j = 0; j < i; j++)
+        copy->array[j] = node->array[j];
+
+    for (j = i + 2; j < n; j++)
+        copy->array[j - 2] = node->array[j];
+
+    for (j = 0; j < n - 2; j++)
+        Py_XINCREF(copy->array[j]);
+
+    PyObject_GC_Track(copy);
+
+    return copy;
+}
+
+/* The node at `shift` for two keys whose hashes agree below it */
+static HamtNode *
+hamt_pair(int shift,
+          size_t hash1, PyObject *key1, PyObject *value1,
+          size_t hash2, PyObject *key2, PyObject *value2)
+{
+    HamtNode *node, *child;
+    uint32_t bit1, bit2;
+
+    if (hash1 == hash2) {
+        node = HamtNode_new(0, 4);
+        if (node == NULL)
+            return NULL;
+    } else {
+        bit1 = HAMT_BIT(hash1, shift);
+        bit2 = HAMT_BIT(hash2, shift);
+
+        if (bit1 == bit2) {
+            child = hamt_pair(shift + HAMT_BITS, hash1, key1, value1, hash2, key2, value2);
+            if (child == NULL)
+                return NULL;
+
+            node = HamtNode_new(bit1, 2);
+            if (node == NULL) {
+                Py_DECREF(child);
+                return NULL;
+            }
+
+            node->array[1] = (PyObject *)child;
+
+            PyObject_GC_Track(node);
+            return node;
+        }
+
+        node = HamtNode_new(bit1 | bit2, 4);
+        if (node == NULL)
+            return NULL;
+
+        if (bit2 < bit1) {
+            PyObject *key = key1, *value = value1;
+
+            key1 = key2;
+            value1 = value2;
+            key2 = key;
+            value2 = value;
+        }
+    }
+
+    Py_INCREF(key1);
+    Py_INCREF(value1);
+    Py_INCREF(key2);
+    Py_INCREF(value2);
+
+    node->array[0] = key1;
+    node->array[1] = value1;
+    node->array[2] = key2;
+    node->array[3] = value2;
+
+    PyObject_GC_Track(node);
+
+    return node;
+}
+
+/* `node` at `shift`, with `key` mapped to `value`: `node` itself, with a
+   new reference, if it already is, and `*added` set if `key` is new */
+static HamtNode *
+hamt_assoc(HamtNode *node, int shift, size_t hash, PyObject *key, PyObject *value, int *added)
+{
+    HamtNode *child, *result;
+    PyObject *k, *v;
+    uint32_t bit;
+    Py_ssize_t i;
+
+    if (HAMT_IS_COLLISION(node)) {
+        size_t collision_hash = HAMT_HASH(node->array[0]);
+
+        if (hash != collision_hash) {
+            /* Part ways a level up, then carry on from there. */
+            HamtNode *parent = HamtNode_new(HAMT_BIT(collision_hash, shift), 2);
+            if (parent == NULL)
+                return NULL;
+
+            Py_INCREF(node);
+            parent->array[1] = (PyObject *)node;
+
+            PyObject_GC_Track(parent);
+
+            result = hamt_assoc(parent, shift, hash, key, value, added);
+
+            Py_DECREF(parent);
+            return result;
+        }
+
+        for (i = 0; i < Py_SIZE(node); i += 2) {
+            if (node->array[i] == key) {
+                if (node->array[i + 1] == value) {
+                    Py_INCREF(node);
+                    return node;
+                }
+
+                Py_INCREF(key);
+                Py_INCREF(value);
+                return hamt_replace(node, i, key, value);
+            }
+        }
+
+        *added = 1;
+        return hamt_insert(node, 0, Py_SIZE(node), key, value);
+    }
+
+    bit = HAMT_BIT(hash, shift);
+    i = hamt_index(node->bitmap, bit);
+
+    if (!(node->bitmap & bit)) {
+        *added = 1;
+        return hamt_insert(node, node->bitmap | bit, i, key, value);
+    }
+
+    k = node->array[i];
+    v = node->array[i + 1];
+
+    if (k == NULL) {
+        child = hamt_assoc((HamtNode *)v, shift + HAMT_BITS, hash, key, value, added);
+        if (child == NULL)
+            return NULL;
+
+        if (child == (HamtNode *)v) {
+            Py_DECREF(child);
+            Py_INCREF(node);
+            return node;
+        }
+
+        return hamt_replace(node, i, NULL, (PyObject *)child);
+    }
+
+    if (k == key) {
+        if (v == value) {
+            Py_INCREF(node);
+            return node;
+        }
+
+        Py_INCREF(key);
+        Py_INCREF(value);
+        return hamt_replace(node, i, key, value);
+    }
+
+    child = hamt_pair(shift + HAMT_BITS, HAMT_HASH(k), k, v, hash, key, value);
+    if (child == NULL)
+        return NULL;
+
+    *added = 1;
+    return hamt_replace(node, i, NULL, (PyObject *)child);
+}
+
+/* `node` at `shift`, without `key`: `node` itself, with a new reference,
+   if it hasn't got it, and `*removed` set if it had */
+static HamtNode *
+hamt_without(HamtNode *node, int shift, size_t hash, PyObject *key, int *removed)
+{
+    HamtNode *child;
+    PyObject *k, *v;
+    uint32_t bit;
+    Py_ssize_t i;
+
+    if (HAMT_IS_COLLISION(node)) {
+        for (i = 0; i < Py_SIZE(node); i += 2) {
+            if (node->array[i] == key) {
+                *removed = 1;
+                return hamt_remove(node, 0, i);
+            }
+        }
+
+        Py_INCREF(node);
+        return node;
+    }
+
+    bit = HAMT_BIT(hash, shift);
+
+    if (!(node->bitmap & bit)) {
+        Py_INCREF(node);
+        return node;
+    }
+
+    i = hamt_index(node->bitmap, bit);
+
+    k = node->array[i];
+    v = node->array[i + 1];
+
+    if (k == NULL) {
+        child = hamt_without((HamtNode *)v, shift + HAMT_BITS, hash, key, removed);
+        if (child == NULL)
+            return NULL;
+
+        if (child == (HamtNode *)v) {
+            Py_DECREF(child);
+            Py_INCREF(node);
+            return node;
+        }
+
+        if (HAMT_IS_PAIR(child)) {
+            k = child->array[0];
+            v = child->array[1];
+
+            Py_INCREF(k);
+            Py_INCREF(v);
+            Py_DECREF(child);
+
+            return hamt_replace(node, i, k, v);
+        }
+
+        return hamt_replace(node, i, NULL, (PyObject *)child);
+    }
+
+    if (k != key) {
+        Py_INCREF(node);
+        return node;
+    }
+
+    *removed = 1;
+    return hamt_remove(node, node->bitmap & ~bit, i);
+}
 
 typedef struct {
     PyObject_HEAD
-    IdentityDict *dict;
-    Py_ssize_t index;
-} IdentityDictIterator;
+    HamtNode *root;
+    Py_ssize_t count;
+} PersistentIdentityMap;
+
+static PyTypeObject PersistentIdentityMap_type;
 
+/* Steals `root` */
 static PyObject *
-IdentityDictIterator_new(PyTypeObject *type, IdentityDict *dict)
+PersistentIdentityMap_new(HamtNode *root, Py_ssize_t count)
 {
-    IdentityDictIterator *this = PyObject_New(IdentityDictIterator, type);
-    if (this == NULL)
+    PersistentIdentityMap *this = PyObject_GC_New(PersistentIdentityMap, &PersistentIdentityMap_type);
+    if (this == NULL) {
+        Py_DECREF(root);
         return NULL;
+    }
 
-    Py_INCREF(dict);
+    this->root = root;
+    this->count = count;
 
-    this->dict = dict;
-    this->index = 0;
+    PyObject_GC_Track(this);
 
     return (PyObject *)this;
 }
 
+PyDoc_STRVAR(PersistentIdentityMap__doc__,
+"Immutable mapping by identity; set() and delete() return new maps.\n"
+"\n"
+"PersistentIdentityMap()\n"
+"\n"
+"A new map shares all but O(log n) of its structure with the one it came from.");
+
+static PyObject *
+PersistentIdentityMap__new__(PyTypeObject *type, PyObject *args, PyObject *kwargs)
+{
+    if (!_PyArg_NoPositional("PersistentIdentityMap", args) ||
+        !_PyArg_NoKeywords("PersistentIdentityMap", kwargs))
+        return NULL;
+
+    Py_INCREF(hamt_empty);
+
+    return PersistentIdentityMap_new(hamt_empty, 0);
+}
+
 static void
-IdentityDictIterator__del__(PyObject *self)
+PersistentIdentityMap__del__(PyObject *self)
 {
-    Py_XDECREF(((IdentityDictIterator *)self)->dict);
-    PyObject_Del(self);
+    PyObject_GC_UnTrack(self);
+    Py_XDECREF(((PersistentIdentityMap *)self)->root);
+    PyObject_GC_Del(self);
+}
+
+static int
+PersistentIdentityMap__traverse__(PyObject *self, visitproc visit, void *arg)
+{
+    Py_VISIT(((PersistentIdentityMap *)self)->root);
+    return 0;
+}
+
+static int
+PersistentIdentityMap__clear__(PyObject *self)
+{
+    PersistentIdentityMap *this = (PersistentIdentityMap *)self;
+    HamtNode *root = this->root;
+
+    /* Empty, not NULL, as it may yet be used. */
+    Py_INCREF(hamt_empty);
+
+    this->root = hamt_empty;
+    this->count = 0;
+
+    Py_DECREF(root);
+
+    return 0;
+}
+
+static Py_ssize_t
+PersistentIdentityMap__len__(PyObject *self)
+{
+    return ((PersistentIdentityMap *)self)->count;
 }
 
 static PyObject *
-IdentityDictIterator__length_hint__(PyObject *self, PyObject *args)
+PersistentIdentityMap__getitem__(PyObject *self, PyObject *key)
 {
-    IdentityDictIterator *this = (IdentityDictIterator *)self;
-    IdentityDict *dict = this->dict;
-    Py_ssize_t length;
+    PyObject *value = hamt_find(((PersistentIdentityMap *)self)->root, HAMT_HASH(key), key);
 
-    if (dict == NULL) {
-        length = 0;
-    } else {
-        /* TODO: account for count already iterated */
-        length = IdentityDict__len__((PyObject *)dict);
+    if (value == NULL) {
+        _PyErr_SetKeyError(key);
+        return NULL;
     }
 
-    return PyLong_FromSsize_t(length);
+    Py_INCREF(value);
+    return value;
 }
 
-/* Iterator __next__ */
+static int
+PersistentIdentityMap__contains__(PyObject *self, PyObject *key)
+{
+    return hamt_find(((PersistentIdentityMap *)self)->root, HAMT_HASH(key), key) != NULL;
+}
+
+PyDoc_STRVAR(PersistentIdentityMap_get__doc__,
+"self[key] if key in self, else default (which is None if not provided).\n"
+"\n"
+"PersistentIdentityMap.get(key, default=None)");
 
 static PyObject *
-IdentityDictKeysIterator__next__(PyObject *self)
+PersistentIdentityMap_get(PyObject *self, PyObject *const *args, Py_ssize_t nargs)
 {
-    IdentityDictIterator *this = (IdentityDictIterator *)self;
-    IdentityDict *dict = this->dict;
+    PyObject *value;
 
-    if (dict == NULL)
+    if (!_PyArg_CheckPositional("get", nargs, 1, 2))
         return NULL;
 
-    Entry *entry_0 = (Entry *)&dict->entries[0];
-    Py_ssize_t i, size;
+    value = hamt_find(((PersistentIdentityMap *)self)->root, HAMT_HASH(args[0]), args[0]);
 
-    PyObject *key;
+    if (value == NULL)
+        value = nargs > 1 ? args[1] : Py_None;
 
-    for (i = this->index, size = dict->size; i < size; i++) {
-        key = entry_0[i].key;
+    Py_INCREF(value);
+    return value;
+}
 
-        if (key != NULL) {
-            Py_INCREF(key);
-            this->index = i + 1;
-            return key;
-        }
+PyDoc_STRVAR(PersistentIdentityMap_set__doc__,
+"Return a map with `key` mapped to `value`, and otherwise the same as this one.\n"
+"\n"
+"PersistentIdentityMap.set(key, value)");
+
+static PyObject *
+PersistentIdentityMap_set(PyObject *self, PyObject *const *args, Py_ssize_t nargs)
+{
+    PersistentIdentityMap *this = (PersistentIdentityMap *)self;
+    HamtNode *root;
+    int added = 0;
+
+    if (!_PyArg_CheckPositional("set", nargs, 2, 2))
+        return NULL;
+
+    root = hamt_assoc(this->root, 0, HAMT_HASH(args[0]), args[0], args[1], &added);
+    if (root == NULL)
+        return NULL;
+
+    if (root == this->root) {
+        Py_DECREF(root);
+        Py_INCREF(self);
+        return self;
     }
 
-    /* Exhausted */
-    Py_DECREF(dict);
-    this->dict = NULL;
-    return NULL;
+    return PersistentIdentityMap_new(root, this->count + added);
 }
 
+PyDoc_STRVAR(PersistentIdentityMap_delete__doc__,
+"Return a map without `key`, and otherwise the same as this one.\n"
+"\n"
+"PersistentIdentityMap.delete(key)\n"
+"\n"
+"Raise `KeyError` if absent.");
+
 static PyObject *
-IdentityDictItemsIterator__next__(PyObject *self)
+PersistentIdentityMap_delete(PyObject *self, PyObject *key)
 {
-    IdentityDictIterator *this = (IdentityDictIterator *)self;
-    IdentityDict *dict = this->dict;
+    PersistentIdentityMap *this = (PersistentIdentityMap *)self;
+    HamtNode *root;
+    int removed = 0;
 
-    if (dict == NULL)
+    root = hamt_without(this->root, 0, HAMT_HASH(key), key, &removed);
+    if (root == NULL)
+        return NULL;
+
+    if (!removed) {
+        Py_DECREF(root);
+        _PyErr_SetKeyError(key);
         return NULL;
+    }
 
-    Entry *entry_0 = (Entry *)&dict->entries[0];
-    Py_ssize_t i, size;
+    return PersistentIdentityMap_new(root, this->count - 1);
+}
 
-    PyObject *key, *item, *value;
+/* PersistentIdentityMapIterator
 
-    for (i = this->index, size = dict->size; i < size; i++) {
-        key = entry_0[i].key;
+   Depth first, keeping the path down in a stack of nodes borrowed from
+   `root`, which the iterator holds rather than the map.
+*/
 
-        if (key != NULL) {
-            value = entry_0[i].value;
+enum {HAMT_KEYS, HAMT_VALUES, HAMT_ITEMS};
 
-            item = PyTuple_New(2);
-            if (item == NULL)
-                return NULL;
+typedef struct {
+    PyObject_HEAD
+    HamtNode *root;
+    int kind;
+    int depth;
+    HamtNode *nodes[HAMT_MAX_DEPTH];
+    Py_ssize_t positions[HAMT_MAX_DEPTH];
+} PersistentIdentityMapIterator;
 
-            Py_INCREF(key);
-            Py_INCREF(value);
+static PyTypeObject PersistentIdentityMapIterator_type;
 
-            /* "steals" references */
-            PyTuple_SET_ITEM(item, 0, key);
-            PyTuple_SET_ITEM(item, 1, entry_0[i].value);
+static PyObject *
+PersistentIdentityMapIterator_new(PersistentIdentityMap *map, int kind)
+{
+    PersistentIdentityMapIterator *this = PyObject_GC_New(PersistentIdentityMapIterator,
+                                                          &PersistentIdentityMapIterator_type);
+    if (this == NULL)
+        return NULL;
 
-            this->index = i + 1;
+    Py_INCREF(map->root);
 
-            return item;
-        }
-    }
+    this->root = map->root;
+    this->kind = kind;
+    this->depth = 0;
+    this->nodes[0] = map->root;
+    this->positions[0] = 0;
 
-    /* Exhausted */
-    Py_DECREF(dict);
-    this->dict = NULL;
-    return NULL;
+    PyObject_GC_Track(this);
+
+    return (PyObject *)this;
 }
 
-static PyObject *
-IdentityDictValuesIterator__next__(PyObject *self)
+static void
+PersistentIdentityMapIterator__del__(PyObject *self)
 {
-    IdentityDictIterator *this = (IdentityDictIterator *)self;
-    IdentityDict *dict = this->dict;
-
-    if (dict == NULL)
-        return NULL;
+    PyObject_GC_UnTrack(self);
+    Py_XDECREF(((PersistentIdentityMapIterator *)self)->root);
+    PyObject_GC_Del(self);
+}
 
-    Entry *entry_0 = (Entry *)&dict->entries[0];
-    Py_ssize_t i, size;
+static int
+PersistentIdentityMapIterator__traverse__(PyObject *self, visitproc visit, void *arg)
+{
+    Py_VISIT(((PersistentIdentityMapIterator *)self)->root);
+    return 0;
+}
 
-    PyObject *key, *value;
+static PyObject *
+PersistentIdentityMapIterator__next__(PyObject *self)
+{
+    PersistentIdentityMapIterator *this = (PersistentIdentityMapIterator *)self;
+    HamtNode *node;
+    Py_ssize_t i;
 
-    for (i = this->index, size = dict->size; i < size; i++) {
-        key = entry_0[i].key;
+    while (this->depth >= 0) {
+        node = this->nodes[this->depth];
+        i = this->positions[this->depth];
 
-        if (key != NULL) {
-            value = entry_0[i].value;
+        if (i >= Py_SIZE(node)) {
+            this->depth--;
+            continue;
+        }
 
-            Py_INCREF(value);
+        this->positions[this->depth] = i + 2;
 
-            this->index = i + 1;
+        if (node->array[i] == NULL) {
+            this->depth++;
+            this->nodes[this->depth] = (HamtNode *)node->array[i + 1];
+            this->positions[this->depth] = 0;
+            continue;
+        }
 
-            return value;
+        switch (this->kind) {
+        case HAMT_KEYS:
+            Py_INCREF(node->array[i]);
+            return node->array[i];
+        case HAMT_VALUES:
+            Py_INCREF(node->array[i + 1]);
+            return node->array[i + 1];
+        default:
+            return PyTuple_Pack(2, node->array[i], node->array[i + 1]);
         }
     }
 
-    /* Exhausted */
-    Py_DECREF(dict);
-    this->dict = NULL;
     return NULL;
 }
 
-static PyMethodDef
-IdentityDictIterator_methods[] = {
-    {"__length_hint__", IdentityDictIterator__length_hint__, METH_NOARGS, NULL},
-    {NULL, NULL} /* sentinel */
-};
-
 static PyTypeObject
-IdentityDictKeysIterator_type = {
-    PyVarObject_HEAD_INIT(NULL, 0)
-    "b._collections.IdentityDictKeysIterator", /* tp_name */
-    sizeof(IdentityDictIterator),       /* tp_basicsize */
-    0,                                  /* tp_itemsize */
-    IdentityDictIterator__del__,        /* tp_dealloc */
-    0,                                  /* tp_print */
-    0,                                  /* tp_getattr */
-    0,                                  /* tp_setattr */
-    0,                                  /* tp_reserved */
-    0,                                  /* tp_repr */
-    0,                                  /* tp_as_number */
-    0,                                  /* tp_as_sequence */
-    0,                                  /* tp_as_mapping */
-    0,                                  /* tp_hash  */
-    0,                                  /* tp_call */
-    0,                                  /* tp_str */
-    PyObject_GenericGetAttr,            /* tp_getattro */
-    0,                                  /* tp_setattro */
-    0,                                  /* tp_as_buffer */
-    Py_TPFLAGS_DEFAULT,                 /* tp_flags */
-    0,                                  /* tp_doc */
-    0,                                  /* tp_traverse */
-    0,                                  /* tp_clear */
-    0,                                  /* tp_richcompare */
-    0,                                  /* tp_weaklistoffset */
-    PyObject_SelfIter,                  /* tp_iter */
-    IdentityDictKeysIterator__next__,   /* tp_iternext */
-    IdentityDictIterator_methods,       /* tp_methods */
-};
-
-static PyTypeObject
-IdentityDictItemsIterator_type = {
-    PyVarObject_HEAD_INIT(NULL, 0)
-    "b._collections.IdentityDictItemsIterator", /* tp_name */
-    sizeof(IdentityDictIterator),       /* tp_basicsize */
-    0,                                  /* tp_itemsize */
-    IdentityDictIterator__del__,        /* tp_dealloc */
-    0,                                  /* tp_print */
-    0,                                  /* tp_getattr */
-    0,                                  /* tp_setattr */
-    0,                                  /* tp_reserved */
-    0,                                  /* tp_repr */
-    0,                                  /* tp_as_number */
-    0,                                  /* tp_as_sequence */
-    0,                                  /* tp_as_mapping */
-    0,                                  /* tp_hash  */
-    0,                                  /* tp_call */
-    0,                                  /* tp_str */
-    PyObject_GenericGetAttr,            /* tp_getattro */
-    0,                                  /* tp_setattro */
-    0,                                  /* tp_as_buffer */
-    Py_TPFLAGS_DEFAULT,                 /* tp_flags */
-    0,                                  /* tp_doc */
-    0,                                  /* tp_traverse */
-    0,                                  /* tp_clear */
-    0,                                  /* tp_richcompare */
-    0,                                  /* tp_weaklistoffset */
-    PyObject_SelfIter,                  /* tp_iter */
-    IdentityDictItemsIterator__next__,  /* tp_iternext */
-    IdentityDictIterator_methods,       /* tp_methods */
-};
-
-static PyTypeObject
-IdentityDictValuesIterator_type = {
-    PyVarObject_HEAD_INIT(NULL, 0)
-    "b._collections.IdentityDictValuesIterator", /* tp_name */
-    sizeof(IdentityDictIterator),       /* tp_basicsize */
+PersistentIdentityMapIterator_type = {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    "b._collections.PersistentIdentityMapIterator", /* tp_name */
+    sizeof(PersistentIdentityMapIterator), /* tp_basicsize */
     0,                                  /* tp_itemsize */
-    IdentityDictIterator__del__,        /* tp_dealloc */
+    PersistentIdentityMapIterator__del__, /* tp_dealloc */
     0,                                  /* tp_print */
     0,                                  /* tp_getattr */
     0,                                  /* tp_setattr */
@@ -1124,233 +7068,129 @@ IdentityDictValuesIterator_type = {
     PyObject_GenericGetAttr,            /* tp_getattro */
     0,                                  /* tp_setattro */
     0,                                  /* tp_as_buffer */
-    Py_TPFLAGS_DEFAULT,                 /* tp_flags */
+    Py_TPFLAGS_DEFAULT |
+    Py_TPFLAGS_HAVE_GC,                 /* tp_flags */
     0,                                  /* tp_doc */
-    0,                                  /* tp_traverse */
+    PersistentIdentityMapIterator__traverse__, /* tp_traverse */
     0,                                  /* tp_clear */
     0,                                  /* tp_richcompare */
     0,                                  /* tp_weaklistoffset */
     PyObject_SelfIter,                  /* tp_iter */
-    IdentityDictValuesIterator__next__, /* tp_iternext */
-    IdentityDictIterator_methods,       /* tp_methods */
+    PersistentIdentityMapIterator__next__, /* tp_iternext */
 };
 
-/* Views */
-
-typedef struct {
-    PyObject_HEAD
-    IdentityDict *dict;
-} IdentityDictView;
-
 static PyObject *
-IdentityDictView_new(PyTypeObject *type, IdentityDict *dict)
-{
-    IdentityDictView *this = PyObject_New(IdentityDictView, type);
-    if (this == NULL)
-        return NULL;
-
-    Py_INCREF(dict);
-
-    this->dict = dict;
-
-    return (PyObject *)this;
-}
-
-static void
-IdentityDictView__del__(PyObject *self)
-{
-    Py_XDECREF(((IdentityDictView *)self)->dict);
-    PyObject_Del(self);
-}
-
-static Py_ssize_t
-IdentityDictView__len__(PyObject *self)
+PersistentIdentityMap__iter__(PyObject *self)
 {
-    return IdentityDict__len__((PyObject *)((IdentityDictView *)self)->dict);
-}
-
-/* View __contains__ */
-
-static int
-IdentityDictKeys__contains__(PyObject *self, PyObject *key)
-{
-    PyErr_SetString(PyExc_NotImplementedError, "IdentityDictKeys.__contains__");
-    return -1;
-}
-
-static int
-IdentityDictItems__contains__(PyObject *self, PyObject *key)
-{
-    PyErr_SetString(PyExc_NotImplementedError, "IdentityDictItems.__contains__");
-    return -1;
-}
-
-static int
-IdentityDictValues__contains__(PyObject *self, PyObject *key)
-{
-    PyErr_SetString(PyExc_NotImplementedError, "IdentityDictValues.__contains__");
-    return -1;
+    return PersistentIdentityMapIterator_new((PersistentIdentityMap *)self, HAMT_KEYS);
 }
 
-/* View __iter__ */
+PyDoc_STRVAR(PersistentIdentityMap_keys__doc__,
+"Return an iterator over the keys.\n"
+"\n"
+"PersistentIdentityMap.keys()");
 
 static PyObject *
-IdentityDictKeys__iter__(PyObject *self)
+PersistentIdentityMap_keys(PyObject *self, PyObject *_)
 {
-    return IdentityDictIterator_new(
-        &IdentityDictKeysIterator_type,
-        ((IdentityDictView *)self)->dict
-        );
+    return PersistentIdentityMapIterator_new((PersistentIdentityMap *)self, HAMT_KEYS);
 }
 
+PyDoc_STRVAR(PersistentIdentityMap_values__doc__,
+"Return an iterator over the values.\n"
+"\n"
+"PersistentIdentityMap.values()");
 
 static PyObject *
-IdentityDictItems__iter__(PyObject *self)
+PersistentIdentityMap_values(PyObject *self, PyObject *_)
 {
-    return IdentityDictIterator_new(
-        &IdentityDictItemsIterator_type,
-        ((IdentityDictView *)self)->dict
-        );
+    return PersistentIdentityMapIterator_new((PersistentIdentityMap *)self, HAMT_VALUES);
 }
 
+PyDoc_STRVAR(PersistentIdentityMap_items__doc__,
+"Return an iterator over the (key, value) pairs.\n"
+"\n"
+"PersistentIdentityMap.items()");
 
 static PyObject *
-IdentityDictValues__iter__(PyObject *self)
+PersistentIdentityMap_items(PyObject *self, PyObject *_)
 {
-    return IdentityDictIterator_new(
-        &IdentityDictValuesIterator_type,
-        ((IdentityDictView *)self)->dict
-        );
+    return PersistentIdentityMapIterator_new((PersistentIdentityMap *)self, HAMT_ITEMS);
 }
 
-/* View as_sequence */
-
-static PySequenceMethods
-IdentityDictKeys_as_sequence = {
-    IdentityDictView__len__,         /* sq_length */
-    0,                               /* sq_concat */
-    0,                               /* sq_repeat */
-    0,                               /* sq_item */
-    0,                               /* sq_slice */
-    0,                               /* sq_ass_item */
-    0,                               /* sq_ass_slice */
-    IdentityDictKeys__contains__,    /* sq_contains */
+static PyMethodDef
+PersistentIdentityMap_methods[] = {
+    {"get", (PyCFunction)(void(*)(void))PersistentIdentityMap_get, METH_FASTCALL, PersistentIdentityMap_get__doc__},
+    {"set", (PyCFunction)(void(*)(void))PersistentIdentityMap_set, METH_FASTCALL, PersistentIdentityMap_set__doc__},
+    {"delete", PersistentIdentityMap_delete, METH_O, PersistentIdentityMap_delete__doc__},
+    {"keys", PersistentIdentityMap_keys, METH_NOARGS, PersistentIdentityMap_keys__doc__},
+    {"values", PersistentIdentityMap_values, METH_NOARGS, PersistentIdentityMap_values__doc__},
+    {"items", PersistentIdentityMap_items, METH_NOARGS, PersistentIdentityMap_items__doc__},
+    {NULL, NULL} /* sentinel */
 };
 
-static PySequenceMethods
-IdentityDictItems_as_sequence = {
-    IdentityDictView__len__,         /* sq_length */
-    0,                               /* sq_concat */
-    0,                               /* sq_repeat */
-    0,                               /* sq_item */
-    0,                               /* sq_slice */
-    0,                               /* sq_ass_item */
-    0,                               /* sq_ass_slice */
-    IdentityDictItems__contains__,   /* sq_contains */
+static PyMappingMethods
+PersistentIdentityMap_as_mapping = {
+    PersistentIdentityMap__len__,     /* mp_length */
+    PersistentIdentityMap__getitem__, /* mp_subscript */
+    0,                                /* mp_ass_subscript */
 };
 
 static PySequenceMethods
-IdentityDictValues_as_sequence = {
-    IdentityDictView__len__,         /* sq_length */
-    0,                               /* sq_concat */
-    0,                               /* sq_repeat */
-    0,                               /* sq_item */
-    0,                               /* sq_slice */
-    0,                               /* sq_ass_item */
-    0,                               /* sq_ass_slice */
-    IdentityDictValues__contains__,  /* sq_contains */
-};
-
-/* View type */
-
-static PyTypeObject
-IdentityDictKeys_type = {
-    PyVarObject_HEAD_INIT(NULL, 0)
-    "b._collections.IdentityDictKeys", /* tp_name */
-    sizeof(IdentityDictView),       /* tp_basicsize */
-    0,                              /* tp_itemsize */
-    IdentityDictView__del__,        /* tp_dealloc */
-    0,                              /* tp_print */
-    0,                              /* tp_getattr */
-    0,                              /* tp_setattr */
-    0,                              /* tp_reserved */
-    0,                              /* tp_repr */
-    0,                              /* tp_as_number */
-    &IdentityDictKeys_as_sequence,  /* tp_as_sequence */
-    0,                              /* tp_as_mapping */
-    0,                              /* tp_hash  */
-    0,                              /* tp_call */
-    0,                              /* tp_str */
-    PyObject_GenericGetAttr,        /* tp_getattro */
-    0,                              /* tp_setattro */
-    0,                              /* tp_as_buffer */
-    Py_TPFLAGS_DEFAULT,             /* tp_flags */
-    0,                              /* tp_doc */
-    0,                              /* tp_traverse */
-    0,                              /* tp_clear */
-    0,                              /* tp_richcompare */
-    0,                              /* tp_weaklistoffset */
-    IdentityDictKeys__iter__,       /* tp_iter */
-};
-
-static PyTypeObject
-IdentityDictItems_type = {
-    PyVarObject_HEAD_INIT(NULL, 0)
-    "b._collections.IdentityDictItems", /* tp_name */
-    sizeof(IdentityDictView),       /* tp_basicsize */
-    0,                              /* tp_itemsize */
-    IdentityDictView__del__,        /* tp_dealloc */
-    0,                              /* tp_print */
-    0,                              /* tp_getattr */
-    0,                              /* tp_setattr */
-    0,                              /* tp_reserved */
-    0,                              /* tp_repr */
-    0,                              /* tp_as_number */
-    &IdentityDictItems_as_sequence, /* tp_as_sequence */
-    0,                              /* tp_as_mapping */
-    0,                              /* tp_hash  */
-    0,                              /* tp_call */
-    0,                              /* tp_str */
-    PyObject_GenericGetAttr,        /* tp_getattro */
-    0,                              /* tp_setattro */
-    0,                              /* tp_as_buffer */
-    Py_TPFLAGS_DEFAULT,             /* tp_flags */
-    0,                              /* tp_doc */
-    0,                              /* tp_traverse */
-    0,                              /* tp_clear */
-    0,                              /* tp_richcompare */
-    0,                              /* tp_weaklistoffset */
-    IdentityDictItems__iter__,      /* tp_iter */
+PersistentIdentityMap_as_sequence = {
+    0,                                  /* sq_length */
+    0,                                  /* sq_concat */
+    0,                                  /* sq_repeat */
+    0,                                  /* sq_item */
+    0,                                  /* sq_slice */
+    0,                                  /* sq_ass_item */
+    0,                                  /* sq_ass_slice */
+    PersistentIdentityMap__contains__,  /* sq_contains */
+    0,                                  /* sq_inplace_concat */
+    0,                                  /* sq_inplace_repeat */
 };
 
 static PyTypeObject
-IdentityDictValues_type = {
+PersistentIdentityMap_type = {
     PyVarObject_HEAD_INIT(NULL, 0)
-    "b._collections.IdentityDictValues", /* tp_name */
-    sizeof(IdentityDictView),       /* tp_basicsize */
+    "b._collections.PersistentIdentityMap", /* tp_name */
+    sizeof(PersistentIdentityMap),  /* tp_basicsize */
     0,                              /* tp_itemsize */
-    IdentityDictView__del__,        /* tp_dealloc */
+    PersistentIdentityMap__del__,   /* tp_dealloc */
     0,                              /* tp_print */
     0,                              /* tp_getattr */
     0,                              /* tp_setattr */
     0,                              /* tp_reserved */
     0,                              /* tp_repr */
     0,                              /* tp_as_number */
-    &IdentityDictValues_as_sequence,/* tp_as_sequence */
-    0,                              /* tp_as_mapping */
+    &PersistentIdentityMap_as_sequence, /* tp_as_sequence */
+    &PersistentIdentityMap_as_mapping,  /* tp_as_mapping */
     0,                              /* tp_hash  */
     0,                              /* tp_call */
     0,                              /* tp_str */
-    PyObject_GenericGetAttr,        /* tp_getattro */
+    0,                              /* tp_getattro */
     0,                              /* tp_setattro */
     0,                              /* tp_as_buffer */
-    Py_TPFLAGS_DEFAULT,             /* tp_flags */
-    0,                              /* tp_doc */
-    0,                              /* tp_traverse */
-    0,                              /* tp_clear */
+    Py_TPFLAGS_DEFAULT |
+    Py_TPFLAGS_HAVE_GC,             /* tp_flags */
+    PersistentIdentityMap__doc__,   /* tp_doc */
+    PersistentIdentityMap__traverse__, /* tp_traverse */
+    PersistentIdentityMap__clear__, /* tp_clear */
     0,                              /* tp_richcompare */
     0,                              /* tp_weaklistoffset */
-    IdentityDictValues__iter__,     /* tp_iter */
+    PersistentIdentityMap__iter__,  /* tp_iter */
+    0,                              /* tp_iternext */
+    PersistentIdentityMap_methods,  /* tp_methods */
+    0,                              /* tp_members */
+    0,                              /* tp_getset */
+    0,                              /* tp_base */
+    0,                              /* tp_dict */
+    0,                              /* tp_descr_get */
+    0,                              /* tp_descr_set */
+    0,                              /* tp_dictoffset */
+    0,                              /* tp_init */
+    0,                              /* tp_alloc */
+    PersistentIdentityMap__new__,   /* tp_new */
 };
 
 /* NamedTupleField */
@@ -1798,9 +7638,42 @@ NamedTupleMeta_as_sequence = {
     0,                             /* sq_contains */
 };
 
+/* type.__sizeof__() stops at PyHeapTypeObject, so add the rest of
+   NamedTupleMeta, and the tuple of fields that only the class holds */
+PyDoc_STRVAR(NamedTupleMeta__sizeof____doc__,
+"Size of the class in memory, in bytes, its tuple of fields included.\n"
+"\n"
+"NamedTupleMeta.__sizeof__()");
+
+static PyObject *
+NamedTupleMeta__sizeof__(PyObject *cls, PyObject *_)
+{
+    PyObject *fields = ((NamedTupleMeta *)cls)->fields;
+    PyObject *size;
+    Py_ssize_t total;
+
+    size = PyObject_CallMethod((PyObject *)&PyType_Type, "__sizeof__", "O", cls);
+    if (size == NULL)
+        return NULL;
+
+    total = PyLong_AsSsize_t(size);
+    Py_DECREF(size);
+
+    if (total == -1 && PyErr_Occurred())
+        return NULL;
+
+    total += sizeof(NamedTupleMeta) - sizeof(PyHeapTypeObject);
+
+    if (fields != NULL)
+        total += Py_TYPE(fields)->tp_basicsize + Py_SIZE(fields) * Py_TYPE(fields)->tp_itemsize;
+
+    return PyLong_FromSsize_t(total);
+}
+
 static PyMethodDef
 NamedTupleMeta_methods[] = {
     {"__prepare__", NamedTupleMeta__prepare__, METH_VARARGS | METH_CLASS, "TODO"},
+    {"__sizeof__", NamedTupleMeta__sizeof__, METH_NOARGS, NamedTupleMeta__sizeof____doc__},
     {NULL, NULL} /* sentinel */
 };
 
@@ -2082,6 +7955,9 @@ PyInit__collections(void)
     if (module == NULL)
         return NULL;
 
+    /* Not declared Py_MOD_GIL_NOT_USED: only ConcurrentIdentityDict locks,
+       so on a free-threaded build importing this re-enables the GIL. */
+
     /* IdentityDict */
 
     if (PyType_Ready(&IdentityDict_type) < 0)
@@ -2091,6 +7967,94 @@ PyInit__collections(void)
 
     PyModule_AddObject(module, "IdentityDict", (PyObject *)&IdentityDict_type);
 
+    /* IdentityDefaultDict */
+
+    if (PyType_Ready(&IdentityDefaultDict_type) < 0)
+        return NULL;
+
+    Py_INCREF(&IdentityDefaultDict_type);
+
+    PyModule_AddObject(module, "IdentityDefaultDict", (PyObject *)&IdentityDefaultDict_type);
+
+    /* SharedTable */
+
+    if (PyType_Ready(&SharedTable_type) < 0)
+        return NULL;
+
+    /* PersistentIdentityMap */
+
+    if (PyType_Ready(&HamtNode_type) < 0)
+        return NULL;
+
+    if (PyType_Ready(&PersistentIdentityMapIterator_type) < 0)
+        return NULL;
+
+    if (PyType_Ready(&PersistentIdentityMap_type) < 0)
+        return NULL;
+
+    hamt_empty = HamtNode_new(0, 0);
+    if (hamt_empty == NULL)
+        return NULL;
+
+    PyObject_GC_Track(hamt_empty);
+
+    Py_INCREF(&PersistentIdentityMap_type);
+
+    PyModule_AddObject(module, "PersistentIdentityMap", (PyObject *)&PersistentIdentityMap_type);
+
+    /* WeakIdentityDict */
+
+    if (PyType_Ready(&WeakIdentityDict_type) < 0)
+        return NULL;
+
+    Py_INCREF(&WeakIdentityDict_type);
+
+    PyModule_AddObject(module, "WeakIdentityDict", (PyObject *)&WeakIdentityDict_type);
+
+    /* ConcurrentIdentityDict */
+
+    if (PyType_Ready(&ConcurrentIdentityDict_type) < 0)
+        return NULL;
+
+    Py_INCREF(&ConcurrentIdentityDict_type);
+
+    PyModule_AddObject(module, "ConcurrentIdentityDict", (PyObject *)&ConcurrentIdentityDict_type);
+
+    /* Int64Dict */
+
+    if (PyType_Ready(&Int64Dict_type) < 0)
+        return NULL;
+
+    Py_INCREF(&Int64Dict_type);
+
+    PyModule_AddObject(module, "Int64Dict", (PyObject *)&Int64Dict_type);
+
+    if (PyType_Ready(&Int64DictIterator_type) < 0)
+        return NULL;
+
+    /* IdentitySet */
+
+    if (PyType_Ready(&IdentitySet_type) < 0)
+        return NULL;
+
+    Py_INCREF(&IdentitySet_type);
+
+    PyModule_AddObject(module, "IdentitySet", (PyObject *)&IdentitySet_type);
+
+    if (PyType_Ready(&IdentitySetIterator_type) < 0)
+        return NULL;
+
+    /* WeakIdentityRef */
+
+    WeakIdentityRef_type.tp_base = &_PyWeakref_RefType;
+
+    if (PyType_Ready(&WeakIdentityRef_type) < 0)
+        return NULL;
+
+    Py_INCREF(&WeakIdentityRef_type);
+
+    PyModule_AddObject(module, "_WeakIdentityRef", (PyObject *)&WeakIdentityRef_type);
+
     /* IdentityDictKeys */
 
     if (PyType_Ready(&IdentityDictKeys_type) < 0)
@@ -2163,5 +8127,10 @@ PyInit__collections(void)
 
     PyModule_AddObject(module, "NamedTuple", (PyObject *)&NamedTuple_type);
 
+    /* tracemalloc domain of the tables, see hash.h */
+
+    if (PyModule_AddIntConstant(module, "TRACEMALLOC_DOMAIN", TABLE_DOMAIN) < 0)
+        return NULL;
+
     return module;
 };
@@ -1,5 +1,7 @@
 #include "Python.h"
 
+#include <stddef.h>
+
 #include "unicode.h"
 
 #define DEFAULT_SIZE 100
@@ -16,9 +18,11 @@ typedef struct {
     void *data;
 } Symbol;
 
+/* `stack` runs on for `ob_size` Symbols, the object's items, so
+   object.__sizeof__() counts them */
 typedef struct {
     PyObject_VAR_HEAD
-    Symbol (*stack)[1];
+    Symbol stack[1];
 } Parser;
 
 static PyTypeObject Parser_type;
@@ -34,14 +38,25 @@ __new__(PyTypeObject *type, PyObject *args, PyObject *kwargs)
     if (!PyArg_ParseTuple(args, "|n", &size))
         return NULL;
 
-    PyObject *self = PyObject_GC_NewVar(Parser, &Parser_type, size);
+    if (size < 0) {
+        PyErr_SetString(PyExc_ValueError, "Parser() of a negative size");
+        return NULL;
+    }
+
+    if ((size_t)size > (PY_SSIZE_T_MAX - sizeof(Parser)) / sizeof(Symbol))
+        return PyErr_NoMemory();
+
+    Parser *self = PyObject_NewVar(Parser, &Parser_type, size);
 
     if (self == NULL) {
         PyErr_NoMemory();
         return NULL;
     }
 
-    return self;
+    /* All UNDECIDED */
+    memset(self->stack, 0, size * sizeof(Symbol));
+
+    return (PyObject *)self;
 }
 
 static PyObject *
@@ -174,8 +189,8 @@ static PyTypeObject
 Parser_type = {
     PyVarObject_HEAD_INIT(NULL, 0)
     "b._grammar.Parser",       /* tp_name */
-    sizeof(Parser),            /* tp_basicsize */
-    0,                         /* tp_itemsize */
+    offsetof(Parser, stack),   /* tp_basicsize */
+    sizeof(Symbol),            /* tp_itemsize */
     0,                         /* tp_dealloc */
     0,                         /* tp_print */
     0,                         /* tp_getattr */
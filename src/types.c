@@ -12,7 +12,7 @@ typedef struct {
 
 /* Forward */
 static PyObject *
-Memoizer_new(PyObject *);
+Memoizer_new(PyObject *, double, Py_ssize_t);
 
 static PyObject *
 Memoizer__getitem__(PyObject *, PyObject *);
@@ -88,7 +88,7 @@ LazyProperty__get__(PyObject *self, PyObject *instance, PyObject *owner)
     LazyProperty *this = (LazyProperty *)self;
 
     if (this->memoizer == NULL) {
-        this->memoizer = Memoizer_new(this->function);
+        this->memoizer = Memoizer_new(this->function, DEFAULT_MAX_LOAD, DEFAULT_GROWTH_FACTOR);
         if (this->memoizer == NULL)
             return NULL;
     }
@@ -102,7 +102,7 @@ LazyProperty__set__(PyObject *self, PyObject *instance, PyObject *value)
     LazyProperty *this = (LazyProperty *)self;
 
     if (this->memoizer == NULL) {
-        this->memoizer = Memoizer_new(this->function);
+        this->memoizer = Memoizer_new(this->function, DEFAULT_MAX_LOAD, DEFAULT_GROWTH_FACTOR);
         if (this->memoizer == NULL)
             return -1;
     }
@@ -167,122 +167,216 @@ typedef struct {
     PyObject *value;
 } Entry;
 
+/* `ctrl` holds a control byte (see hash.h) per slot, and is followed in
+   the same allocation by the slots themselves, `entries`. */
 typedef struct {
     PyObject_HEAD
     PyObject *function;
     Py_ssize_t size;
     Py_ssize_t usable;
-    Entry (*entries)[1];
+    Py_ssize_t used;
+    int8_t *ctrl;
+    Entry *entries;
+    /* Bumped whenever an entry is added, so that a miss before calling
+       out still holds after if this hasn't changed */
+    Py_ssize_t version;
+    /* The table fills to `max_load` (see hash.h), then grows
+       `growth_factor` times over */
+    double max_load;
+    Py_ssize_t growth_factor;
+#ifdef TABLE_STATS
+    TableStats stats;
+#endif
 } Memoizer;
 
+#define CAPACITY(self) usable_at((self)->size, (self)->max_load)
+
+/* Slots marked CTRL_DELETED: neither live nor available to `usable` */
+#define DELETED(self) (CAPACITY(self) - (self)->usable - (self)->used)
+
 static PyTypeObject Memoizer_type;
 
 PyDoc_STRVAR(Memoizer__doc__,
 "TODO Memoizer __doc__");
 
+static int8_t *
+Memoizer_alloc(Py_ssize_t size)
+{
+    int8_t *ctrl = table_malloc(size + size * sizeof(Entry));
+    if (ctrl == NULL) {
+        PyErr_NoMemory();
+        return NULL;
+    }
+
+    memset(ctrl, CTRL_EMPTY, size);
+
+    return ctrl;
+}
+
+/* Slot holding `key`, else -1 */
+static inline Py_ssize_t
+Memoizer_lookup(Memoizer *self, PyObject *key, Py_hash_t hash)
+{
+    Entry *entries = self->entries;
+    Py_ssize_t slot;
+    size_t groups;
+
+#define MEMOIZER_IS_KEY(i) (entries[i].key == key)
+    GROUP_LOOKUP(slot, self->ctrl, self->size, hash, groups, MEMOIZER_IS_KEY);
+#undef MEMOIZER_IS_KEY
+
+    STATS_LOOKUP(&self->stats, slot >= 0, groups);
+
+    return slot;
+}
+
 static int
 Memoizer_grow(Memoizer *self)
 {
     Py_ssize_t old_size = self->size;
-    Py_ssize_t new_size = old_size * 2;
-
-    Entry *old_entry_0;
-    Entry *new_entry_0;
+    Py_ssize_t new_size = old_size;
 
-    Entry (*old_entries)[old_size] = self->entries;
-    Entry (*new_entries)[new_size] = PyMem_Malloc(new_size * sizeof(Entry));
+    int8_t *old_ctrl = self->ctrl;
+    int8_t *new_ctrl;
 
-    register size_t i, j;
-    register size_t perturb;
-    register size_t mask;
-    register Entry *old_entry, *new_entry;
+    Entry *old_entries = self->entries;
+    Entry *new_entries;
 
-    Py_ssize_t new_usable = USABLE(new_size);
+    register Py_ssize_t i;
+    register size_t j;
 
-    PyObject *key;
     Py_hash_t hash;
 
-    if (new_entries == NULL) {
-        PyErr_NoMemory();
+    /* At a low enough max_load, one step may not make room for another */
+    do {
+        if (new_size > PY_SSIZE_T_MAX / (self->growth_factor * (Py_ssize_t)(1 + sizeof(Entry)))) {
+            PyErr_NoMemory();
+            return -1;
+        }
+
+        new_size *= self->growth_factor;
+    } while (usable_at(new_size, self->max_load) <= self->used);
+
+    new_ctrl = Memoizer_alloc(new_size);
+    if (new_ctrl == NULL)
         return -1;
-    }
 
-    old_entry_0 = (Entry *)&old_entries[0];
-    new_entry_0 = (Entry *)&new_entries[0];
+    new_entries = (Entry *)&new_ctrl[new_size];
+
+    for (i = 0; i < old_size; i++) {
+        if (old_ctrl[i] < 0)
+            continue;
+
+        hash = hash_int(old_entries[i].key);
 
-    for (j = 0; j < new_size; j++) {
-        new_entry_0[j].key = NULL;
-        new_entry_0[j].value = NULL;
+        j = group_find_free(new_ctrl, new_size, hash);
+
+        new_ctrl[j] = H2(hash);
+        new_entries[j] = old_entries[i];
     }
 
-    mask = new_size - 1;
+    table_free(old_ctrl);
 
-    for (i = 0; i < old_size; i++) {
-        old_entry = &old_entry_0[i];
+    self->ctrl = new_ctrl;
+    self->entries = new_entries;
+    self->size = new_size;
+    self->usable = CAPACITY(self) - self->used;
 
-        key = old_entry->key;
+    return 0;
+}
 
-        if (key != NULL) {
-            new_usable--;
+/* Rehash the live entries back into the same table, reclaiming deleted slots. */
+static int
+Memoizer_compact(Memoizer *self)
+{
+    Py_ssize_t size = self->size;
+    Py_ssize_t used = self->used;
 
-            hash = hash_int(key);
+    int8_t *ctrl = self->ctrl;
+    Entry *entries = self->entries;
+    Entry *live = PyMem_Malloc(used * sizeof(Entry));
 
-            j = hash & mask;
+    register Py_ssize_t i, n;
+    register size_t j;
 
-            new_entry = &new_entry_0[j];
+    Py_hash_t hash;
 
-            if (new_entry->key == NULL) {
-                new_entry->key   = key;
-                new_entry->value = old_entry->value;
-            } else {
-                for (perturb = hash; ; perturb >>= PERTURB_SHIFT) {
-                    j = (j << 2) + j + perturb + 1;
+    if (live == NULL) {
+        PyErr_NoMemory();
+        return -1;
+    }
 
-                    new_entry = &new_entry_0[j & mask];
+    for (i = 0, n = 0; i < size; i++) {
+        if (ctrl[i] >= 0)
+            live[n++] = entries[i];
+    }
 
-                    if (new_entry->key == NULL) {
-                        new_entry->key   = key;
-                        new_entry->value = old_entry->value;
-                        break;
-                    }
-                }
-            }
-        }
+    memset(ctrl, CTRL_EMPTY, size);
+
+    for (n = 0; n < used; n++) {
+        hash = hash_int(live[n].key);
+
+        j = group_find_free(ctrl, size, hash);
+
+        ctrl[j] = H2(hash);
+        entries[j] = live[n];
     }
 
-    PyMem_FREE(old_entries);
+    PyMem_FREE(live);
 
-    self->entries = new_entries;
-    self->size = new_size;
-    self->usable = new_usable;
+    self->usable = CAPACITY(self) - used;
 
     return 0;
 }
+
+/* Add `key`, known to be absent */
 static int
-Memoizer_insert(Memoizer *self, Entry *entry, PyObject *key, PyObject *value)
+Memoizer_insert(Memoizer *self, PyObject *key, Py_hash_t hash, PyObject *value)
 {
+    size_t slot = group_find_free(self->ctrl, self->size, hash);
+
+    /* Reusing a deleted slot leaves `usable` alone. */
+    if (self->ctrl[slot] == CTRL_EMPTY) {
+        if (self->usable <= 0) {
+            if (DELETED(self) >= self->used) {
+                if (Memoizer_compact(self) == -1)
+                    return -1;
+            } else {
+                STATS_GROW_BEGIN(start);
+
+                if (Memoizer_grow(self) == -1)
+                    return -1;
+
+                STATS_GROW_END(&self->stats, start);
+            }
+
+            slot = group_find_free(self->ctrl, self->size, hash);
+        }
+
+        self->usable--;
+    }
+
     Py_INCREF(value);
 
-    entry->key = key;
-    entry->value = value;
+    self->ctrl[slot] = H2(hash);
+    self->entries[slot].key = key;
+    self->entries[slot].value = value;
+
+    self->used++;
+    self->version++;
 
-    if (self->usable-- > 0)
-        return 0;
-    else
-        return Memoizer_grow(self);
+    return 0;
 }
 
 static PyObject *
-Memoizer_new(PyObject *function)
+Memoizer_new(PyObject *function, double max_load, Py_ssize_t growth_factor)
 {
     PyObject *self;
 
 #define INITIAL_SIZE 128
     Py_ssize_t size = INITIAL_SIZE;
-    Py_ssize_t i;
 
-    Entry (*entries)[1];
-    Entry *entry_0;
+    int8_t *ctrl;
 
     PyTypeObject *type = &Memoizer_type;
 
@@ -293,27 +387,32 @@ Memoizer_new(PyObject *function)
         return NULL;
     }
 
-    self = type->tp_alloc(type, 0);
-    if (self == NULL)
+    if (check_load_policy(max_load, growth_factor) == -1)
         return NULL;
 
-    entries = PyMem_Malloc(size * sizeof(Entry));
-    if (entries == NULL)
+    ctrl = Memoizer_alloc(size);
+    if (ctrl == NULL)
         return NULL;
 
-    entry_0 = (Entry *)&entries[0];
-
-    for (i = 0; i < size; i++) {
-        entry_0[i].key = NULL;
-        entry_0[i].value = NULL;
+    self = type->tp_alloc(type, 0);
+    if (self == NULL) {
+        table_free(ctrl);
+        return NULL;
     }
 
     Py_INCREF(function);
 
-    ((Memoizer *)self)->entries = entries;
+    ((Memoizer *)self)->ctrl = ctrl;
+    ((Memoizer *)self)->entries = (Entry *)&ctrl[size];
     ((Memoizer *)self)->function = function;
     ((Memoizer *)self)->size = size;
-    ((Memoizer *)self)->usable = USABLE(size);
+    ((Memoizer *)self)->usable = usable_at(size, max_load);
+    ((Memoizer *)self)->used = 0;
+    ((Memoizer *)self)->version = 0;
+    ((Memoizer *)self)->max_load = max_load;
+    ((Memoizer *)self)->growth_factor = growth_factor;
+
+    STATS_CLEAR(&((Memoizer *)self)->stats);
 
     return self;
 }
@@ -321,12 +420,17 @@ Memoizer_new(PyObject *function)
 static PyObject *
 Memoizer__new__(PyTypeObject *type, PyObject *args, PyObject *kwargs)
 {
+    static char *kwlist[] = {"function", "max_load", "growth_factor", NULL};
+
     PyObject *function;
+    double max_load = DEFAULT_MAX_LOAD;
+    Py_ssize_t growth_factor = DEFAULT_GROWTH_FACTOR;
 
-    if (!PyArg_ParseTuple(args, "O", &function))
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O|$dn:Memoizer", kwlist,
+                                     &function, &max_load, &growth_factor))
         return NULL;
 
-    return Memoizer_new(function);
+    return Memoizer_new(function, max_load, growth_factor);
 }
 
 static void
@@ -337,14 +441,18 @@ Memoizer__del__(PyObject *self)
     register Py_ssize_t i;
     register Py_ssize_t size = this->size;
 
-    Entry *entry_0 = (Entry *)&this->entries[0];
+    int8_t *ctrl = this->ctrl;
+    Entry *entries = this->entries;
 
     Py_DECREF(this->function);
 
     for (i = 0; i < size; i++) {
-        Py_XDECREF(entry_0[i].value);
+        if (ctrl[i] >= 0)
+            Py_DECREF(entries[i].value);
     }
 
+    table_free(ctrl);
+
     Py_TYPE(self)->tp_free(self);
 }
 
@@ -357,24 +465,23 @@ Memoizer_reap(PyObject *self, PyObject *_) {
 
     Py_ssize_t count = 0;
 
-    Entry *entry_0 = (Entry *)&this->entries[0];
+    int8_t *ctrl = this->ctrl;
+    Entry *entries = this->entries;
     Py_ssize_t i, n;
-    Entry *curr;
 
     for (i = 0, n = this->size; i < n; i++) {
-        curr = &entry_0[i];
-
-        if (curr->key != NULL) {
+        if (ctrl[i] >= 0) {
             // FIXME: this is very much a giant hack,
             // basically checking if a heap pointer
             // 'appears' to have been freed/reused.
-            if (Py_REFCNT(curr->key) > 100) {
-                Py_DECREF(curr->value);
+            if (Py_REFCNT(entries[i].key) > 100) {
+                Py_DECREF(entries[i].value);
 
-                curr->key = NULL;
-                curr->value = NULL;
+                ctrl[i] = CTRL_DELETED;
+                entries[i].key = NULL;
+                entries[i].value = NULL;
 
-                this->usable++;
+                this->used--;
 
                 count++;
             }
@@ -387,52 +494,13 @@ Memoizer_reap(PyObject *self, PyObject *_) {
 static int
 Memoizer__contains__(PyObject *self, PyObject *key)
 {
-    Memoizer *this = (Memoizer *)self;
-
-    register size_t i;
-    register size_t perturb;
-    register Entry *entry;
-    register size_t mask;
-
-    Entry *entry_0;
-    Py_hash_t hash;
-
-    entry_0 = (Entry *)&this->entries[0];
-
-    mask = this->size - 1;
-
-    hash = hash_int(key);
-
-    i = hash & mask;
-
-    entry = &entry_0[i];
-
-    if (entry->key == key)
-        return 1;
-
-    if (entry->key == NULL)
-        return 0;
-
-    for (perturb = hash; ; perturb >>= PERTURB_SHIFT) {
-        i = (i << 2) + i + perturb + 1;
-
-        entry = &entry_0[i & mask];
-
-        if (entry->key == key)
-            return 1;
-
-        if (entry->key == NULL)
-            return 0;
-    }
-
-    assert(0);
-    return -1;
+    return Memoizer_lookup((Memoizer *)self, key, hash_int(key)) >= 0;
 }
 
 static Py_ssize_t
 Memoizer__len__(PyObject *self)
 {
-    return USABLE(((Memoizer *)self)->size) - ((Memoizer *)self)->usable;
+    return ((Memoizer *)self)->used;
 }
 
 static PyObject *
@@ -441,56 +509,41 @@ Memoizer__getitem__(PyObject *self, PyObject *key)
     Memoizer *this = (Memoizer *)self;
 
     PyObject *value;
+    Py_ssize_t slot, version;
 
-    register size_t i;
-    register size_t perturb;
-    register size_t mask;
-    register Entry *entry;
-    Entry *entry_0; // register-ing this slows by 33%
-    Py_hash_t hash;
-
-    entry_0 = (Entry *)&this->entries[0];
-
-    mask = this->size - 1;
-
-    hash = hash_int(key);
-
-    i = hash & mask;
+    Py_hash_t hash = hash_int(key);
 
-    entry = &entry_0[i];
+    slot = Memoizer_lookup(this, key, hash);
 
-    if (entry->key == key) {
-        value = entry->value;
+    if (slot >= 0) {
+        value = this->entries[slot].value;
         Py_INCREF(value);
         return value;
     }
 
-    if (entry->key == NULL)
-        goto missing;
+    version = this->version;
 
-    for (perturb = hash; ; perturb >>= PERTURB_SHIFT) {
-        i = (i << 2) + i + perturb + 1;
+    value = PyObject_Vectorcall(this->function, &key, 1, NULL);
 
-        entry = &entry_0[i & mask];
+    if (value == NULL)
+        return NULL;
 
-        if (entry->key == key) {
-            value = entry->value;
-            Py_INCREF(value);
-            return value;
-        }
+    /* If the call re-entered to add entries, `key` may be among them;
+       then keep the first value stored, as a dict's setdefault() would. */
+    if (this->version != version)
+        slot = Memoizer_lookup(this, key, hash);
 
-        if (entry->key == NULL)
-            goto missing;
+    if (slot >= 0) {
+        Py_DECREF(value);
+        value = this->entries[slot].value;
+        Py_INCREF(value);
+        return value;
     }
 
-  missing:
-    value = PyObject_CallFunctionObjArgs(this->function, key, NULL);
-
-    if (value == NULL)
-        return NULL;
-
-    if (Memoizer_insert(this, entry, key, value) == -1)
+    if (Memoizer_insert(this, key, hash, value) == -1) {
+        Py_DECREF(value);
         return NULL;
+    }
 
     return value;
 }
@@ -500,60 +553,38 @@ Memoizer_ass_subscript(PyObject *self, PyObject *key, PyObject *value)
 {
     Memoizer *this = (Memoizer *)self;
 
-    register size_t i;
-    register size_t perturb;
-    register size_t mask;
-    Entry *entry_0;
-    register Entry *entry;
+    PyObject *old_value;
+    Py_ssize_t slot;
 
     Py_hash_t hash = hash_int(key);
 
-    mask = this->size - 1;
-
-    entry_0 = (Entry *)&this->entries[0];
-
-    i = (size_t)hash & mask;
-
-    entry = &entry_0[i];
-
-    if (entry->key == key)
-        goto found;
+    slot = Memoizer_lookup(this, key, hash);
 
-    if (entry->key == NULL)
-        goto missing;
-
-    for (perturb = hash; ; perturb >>= PERTURB_SHIFT) {
-        i = (i << 2) + i + perturb + 1;
-
-        entry = &entry_0[i & mask];
-
-        if (entry->key == key)
-            goto found;
+    if (slot < 0) {
+        if (value == NULL) {
+            _PyErr_SetKeyError(key);
+            return -1;
+        }
 
-        if (entry->key == NULL)
-            goto missing;
+        return Memoizer_insert(this, key, hash, value);
     }
 
-  missing:
-    if (value == NULL)
-        return -1;
-
-    return Memoizer_insert(this, entry, key, value);
-
-  found:
-    Py_DECREF(entry->value);
+    old_value = this->entries[slot].value;
 
     if (value == NULL) {
-        entry->key = NULL;
-        entry->value = NULL;
+        this->ctrl[slot] = CTRL_DELETED;
+        this->entries[slot].key = NULL;
+        this->entries[slot].value = NULL;
 
-        this->usable++;
+        this->used--;
     } else {
         Py_INCREF(value);
 
-        entry->value = value;
+        this->entries[slot].value = value;
     }
 
+    Py_DECREF(old_value);
+
     return 0;
 }
 
@@ -578,12 +609,64 @@ Memoizer_as_sequence = {
     0,                          /* sq_inplace_repeat */
 };
 
+PyDoc_STRVAR(Memoizer__sizeof____doc__,
+"Size of the memo in memory, in bytes, its table included.\n"
+"\n"
+"Memoizer.__sizeof__()");
+
+static PyObject *
+Memoizer__sizeof__(PyObject *self, PyObject *_)
+{
+    Memoizer *this = (Memoizer *)self;
+
+    return PyLong_FromSsize_t(Py_TYPE(self)->tp_basicsize +
+                              this->size + this->size * sizeof(Entry));
+}
+
+#ifdef TABLE_STATS
+PyDoc_STRVAR(Memoizer__stats__doc__,
+"Return the lookup and growth statistics of the memo, and the state of its table.\n"
+"\n"
+"Memoizer._stats()");
+
+static PyObject *
+Memoizer__stats(PyObject *self, PyObject *_)
+{
+    Memoizer *this = (Memoizer *)self;
+
+    return stats_dict(&this->stats, this->size, this->used, DELETED(this));
+}
+#endif
+
 static PyMethodDef
 Memoizer_methods[] = {
     {"reap", Memoizer_reap, METH_NOARGS, Memoizer_reap__doc__},
+    {"__sizeof__", Memoizer__sizeof__, METH_NOARGS, Memoizer__sizeof____doc__},
+#ifdef TABLE_STATS
+    {"_stats", Memoizer__stats, METH_NOARGS, Memoizer__stats__doc__},
+#endif
     {NULL, NULL}           /* sentinel */
 };
 
+static PyObject *
+Memoizer_max_load(PyObject *self, void *_)
+{
+    return PyFloat_FromDouble(((Memoizer *)self)->max_load);
+}
+
+static PyObject *
+Memoizer_growth_factor(PyObject *self, void *_)
+{
+    return PyLong_FromSsize_t(((Memoizer *)self)->growth_factor);
+}
+
+static PyGetSetDef
+Memoizer_getset[] = {
+    {"max_load",      Memoizer_max_load},
+    {"growth_factor", Memoizer_growth_factor},
+    {0}
+};
+
 static PyTypeObject
 Memoizer_type = {
     PyVarObject_HEAD_INIT(NULL, 0)
@@ -615,7 +698,7 @@ Memoizer_type = {
     0,                         /* tp_iternext */
     Memoizer_methods,          /* tp_methods */
     0,                         /* tp_members */
-    0,                         /* tp_getset */
+    Memoizer_getset,           /* tp_getset */
     0,                         /* tp_base */
     0,                         /* tp_dict */
     0,                         /* tp_descr_get */
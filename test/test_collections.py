@@ -1,6 +1,11 @@
+import gc
+import sys
+import threading
+import tracemalloc
 import unittest
+import weakref
 
-from b.collections import IdentityDict, NamedTuple
+from b.collections import ConcurrentIdentityDict, IdentityDefaultDict, IdentityDict, IdentitySet, Int64Dict, NamedTuple, PersistentIdentityMap, TRACEMALLOC_DOMAIN, WeakIdentityDict
 
 class ConstantHash:
     def __eq__(self, other):
@@ -71,6 +76,125 @@ class IdentityDictTests(unittest.TestCase):
 
         self.assertEqual(d.get(ConstantHash(), 6), 6)
 
+        with self.assertRaises(TypeError):
+            d.get()
+
+        with self.assertRaises(TypeError):
+            d.get(key, 6, 7)
+
+    def test_setdefault(self):
+        d = IdentityDict()
+
+        key = ConstantHash()
+
+        self.assertIs(d.setdefault(key), None)
+        self.assertIn(key, d)
+
+        d[key] = 5
+
+        self.assertEqual(d.setdefault(key, 6), 5)
+
+        other = ConstantHash()
+
+        self.assertEqual(d.setdefault(other, 6), 6)
+        self.assertEqual(d[other], 6)
+
+        with self.assertRaises(TypeError):
+            d.setdefault()
+
+    def test_get_or_insert(self):
+        d = IdentityDict()
+        key = ConstantHash()
+        calls = 0
+
+        def factory():
+            nonlocal calls
+            calls += 1
+            return []
+
+        value = d.get_or_insert(key, factory)
+
+        self.assertEqual(value, [])
+        self.assertIs(d[key], value)
+        self.assertIs(d.get_or_insert(key, factory), value)
+        self.assertEqual(calls, 1)
+
+        with self.assertRaises(ZeroDivisionError):
+            d.get_or_insert(ConstantHash(), lambda: 1 / 0)
+
+        self.assertEqual(len(d), 1)
+
+        with self.assertRaises(TypeError):
+            d.get_or_insert(key)
+
+    def test_get_or_insert_factory_changes_dict(self):
+        d = IdentityDict()
+        key = ConstantHash()
+        others = [ConstantHash() for _ in range(100)]
+
+        def factory():
+            # Enough to resize, and then some
+            for other in others:
+                d[other] = other
+            d[key] = 'factory'
+            return 'value'
+
+        self.assertEqual(d.get_or_insert(key, factory), 'value')
+        self.assertEqual(d[key], 'value')
+        self.assertEqual(len(d), 101)
+        self.assertEqual(list(d), others + [key])
+
+    def test_get_many(self):
+        keys = [ConstantHash() for _ in range(1000)]
+        absent = [ConstantHash() for _ in range(1000)]
+
+        # Small, then a table, then one with deleted slots
+        for n in (5, 1000):
+            d = IdentityDict()
+            for i, key in enumerate(keys[:n]):
+                d[key] = i
+
+            if n > 5:
+                for key in keys[::3]:
+                    del d[key]
+
+            mixed = [key for pair in zip(keys[:n], absent) for key in pair]
+
+            self.assertEqual(d.get_many(mixed), [d.get(key) for key in mixed])
+            self.assertEqual(d.get_many(iter(mixed), 'x'), [d.get(key, 'x') for key in mixed])
+            self.assertEqual(d.contains_many(tuple(mixed)), [key in d for key in mixed])
+
+        self.assertEqual(d.get_many([]), [])
+        self.assertEqual(d.contains_many([]), [])
+
+        with self.assertRaises(TypeError):
+            d.get_many(1)
+
+        with self.assertRaises(TypeError):
+            d.get_many()
+
+        with self.assertRaises(TypeError):
+            d.contains_many(keys, 1)
+
+    def test_missing(self):
+        d = IdentityDict()
+        key = ConstantHash()
+
+        with self.assertRaises(KeyError):
+            d[key]
+
+        class Missing(IdentityDict):
+            def __missing__(self, key):
+                return 'missing'
+
+        d = Missing()
+
+        self.assertEqual(d[key], 'missing')
+        self.assertNotIn(key, d)
+
+        d[key] = 'present'
+        self.assertEqual(d[key], 'present')
+
     def test_keys_iter(self):
         LENGTH = 5
 
@@ -131,6 +255,97 @@ class IdentityDictTests(unittest.TestCase):
 
         self.assertEqual(count, LENGTH)
 
+    def test_view_contains(self):
+        keys = [ConstantHash() for _ in range(100)]
+        values = [[] for _ in range(100)]
+
+        d = IdentityDict()
+        d.update(zip(keys, values))
+        del d[keys[0]]
+
+        self.assertNotIn(keys[0], d.keys())
+        self.assertTrue(all(key in d.keys() for key in keys[1:]))
+
+        # Identity, not equality, for the values too
+        self.assertIn((keys[1], values[1]), d.items())
+        self.assertNotIn((keys[1], []), d.items())
+        self.assertNotIn((keys[0], values[0]), d.items())
+        self.assertNotIn((keys[1], values[1], None), d.items())
+        self.assertNotIn(keys[1], d.items())
+
+        self.assertIn(values[1], d.values())
+        self.assertNotIn(values[0], d.values())
+        self.assertNotIn([], d.values())
+
+    def test_keys_algebra(self):
+        keys = [ConstantHash() for _ in range(300)]
+
+        # Each way round, so each side gets to be the smaller
+        for left, right in ((range(0, 200), range(100, 300)),
+                            (range(0, 50), range(25, 300)),
+                            (range(0, 275), range(250, 300))):
+            a = IdentityDict()
+            a.update((keys[i], ('a', i)) for i in left)
+            b = IdentityDict()
+            b.update((keys[i], ('b', i)) for i in right)
+
+            def check(result, indices, ops):
+                self.assertIs(type(result), IdentityDict)
+                self.assertEqual(len(result), len(indices))
+                for i in indices:
+                    self.assertEqual(result[keys[i]], (ops(i), i))
+
+            left_set, right_set = set(left), set(right)
+            side = lambda i: 'a' if i in left_set else 'b'
+
+            check(a.keys() & b.keys(), left_set & right_set, side)
+            check(a.keys() | b.keys(), left_set | right_set, side)
+            check(a.keys() - b.keys(), left_set - right_set, side)
+            check(a.keys() ^ b.keys(), left_set ^ right_set, side)
+
+            # The left value wins, so swap sides
+            side = lambda i: 'b' if i in right_set else 'a'
+
+            check(b.keys() & a.keys(), left_set & right_set, side)
+            check(b.keys() | a.keys(), left_set | right_set, side)
+
+        # Other operands: their keys, by identity, valued None if bare
+        a = IdentityDict.fromkeys(keys[:10], 0)
+
+        self.assertEqual(list(a.keys() & IdentityDict.fromkeys(keys[5:15])), keys[5:10])
+        self.assertEqual(list(a.keys() - keys[5:]), keys[:5])
+        union = keys[5:15] | a.keys()
+        self.assertEqual(len(union), 15)
+        self.assertTrue(all(union[key] is None for key in keys[5:15]))
+        self.assertTrue(all(union[key] == 0 for key in keys[:5]))
+        self.assertEqual(len(a.keys() & [ConstantHash()]), 0)
+
+        with self.assertRaises(TypeError):
+            a.keys() & 1
+
+    def test_items_algebra(self):
+        keys = [ConstantHash() for _ in range(10)]
+        values = [[] for _ in range(10)]
+
+        a = IdentityDict()
+        a.update(zip(keys, values))
+        b = IdentityDict()
+        b.update(zip(keys[5:], values[5:]))
+        b[keys[9]] = []
+
+        common = a.items() & b.items()
+        self.assertIs(type(common), IdentityDict)
+        self.assertEqual(list(common.items()), list(zip(keys[5:9], values[5:9])))
+
+        self.assertEqual(list((a.items() - b.items()).items()),
+                         list(zip(keys[:5], values[:5])) + [(keys[9], values[9])])
+        self.assertEqual(list((b.items() - a.items()).keys()), [keys[9]])
+
+        self.assertEqual(len(a.items() & [(keys[0], values[0]), (keys[1], [])]), 1)
+
+        with self.assertRaises(TypeError):
+            a.items() | b.items()
+
     def test_clear(self):
         LENGTH = 5
 
@@ -176,33 +391,1397 @@ class IdentityDictTests(unittest.TestCase):
         with self.assertRaises(KeyError):
             d.pop('no fallback!!!!!')
 
-    def test_resize(self):
+    def test_delitem(self):
         d = IdentityDict()
 
-        # Current implementation detail:
-        # INITIAL_SIZE = 16
-        # resize at ~2/3
+        x = ConstantHash()
 
-        for i in range(30):
-            d[ConstantHash()] = i
+        d[x] = 1
 
-        # Random code snippet which
-        # cause core dump...
-        for _ in d.items():
+        del d[x]
+
+        self.assertNotIn(x, d)
+        self.assertEqual(len(d), 0)
+
+        with self.assertRaises(KeyError):
+            del d[x]
+
+    def test_delete_keeps_probe_chains(self):
+        LENGTH = 1000
+
+        d = IdentityDict()
+        keys = [ConstantHash() for _ in range(LENGTH)]
+
+        for i, key in enumerate(keys):
+            d[key] = i
+
+        # Deleting must not cut the chain for keys probed past it.
+        for key in keys[::2]:
+            del d[key]
+
+        for i, key in enumerate(keys):
+            if i % 2:
+                self.assertEqual(d[key], i)
+            else:
+                self.assertNotIn(key, d)
+
+        self.assertEqual(len(d), LENGTH // 2)
+        self.assertEqual(sum(1 for _ in d), LENGTH // 2)
+
+    def test_churn(self):
+        d = IdentityDict()
+        live = [ConstantHash() for _ in range(8)]
+
+        for key in live:
+            d[key] = key
+
+        for i in range(10000):
+            key = ConstantHash()
+
+            d[key] = i
+            self.assertEqual(d.pop(key), i)
+
+        self.assertEqual(len(d), len(live))
+
+        for key in live:
+            self.assertIs(d[key], key)
+
+    def test_small(self):
+        # Either side of the inline table's size, whatever it is built as
+        for length in range(20):
+            d = IdentityDict()
+            keys = [ConstantHash() for _ in range(length)]
+
+            for i, key in enumerate(keys):
+                d[key] = i
+
+            self.assertEqual(list(d), keys)
+
+            # Deleted from the middle, then squeezed out to make room
+            for key in keys[1::2]:
+                del d[key]
+
+            others = [ConstantHash() for _ in range(length)]
+            for key in others:
+                d[key] = key
+
+            expected = keys[::2] + others
+
+            self.assertEqual(list(d), expected)
+            self.assertEqual(len(d), len(expected))
+
+            for key in keys[1::2]:
+                self.assertNotIn(key, d)
+
+            # Back inline, if it fits
+            for key in others:
+                del d[key]
+
+            d.shrink_to_fit()
+
+            self.assertEqual(list(d), keys[::2])
+            self.assertEqual([d[key] for key in keys[::2]], list(range(0, length, 2)))
+
+            copy = d.copy()
+            snapshot = d.snapshot()
+
+            d.clear()
+            d[ConstantHash()] = None
+
+            self.assertEqual(list(copy), keys[::2])
+            self.assertEqual(list(snapshot), keys[::2])
+            self.assertEqual(len(d), 1)
+
+    @unittest.skipUnless(hasattr(IdentityDict, '_stats'), 'built without B_STATS')
+    def test_stats(self):
+        d = IdentityDict()
+        keys = [ConstantHash() for _ in range(1000)]
+
+        for key in keys:
+            d[key] = key
+
+        for key in keys[::2]:
+            del d[key]
+
+        stats = d._stats()
+
+        # A miss to insert each, a hit to delete half
+        self.assertEqual(sum(stats['misses']), len(keys))
+        self.assertEqual(sum(stats['hits']), len(keys) // 2)
+        self.assertEqual(len(stats['hits']), len(stats['misses']))
+        self.assertGreater(stats['grows'], 0)
+        self.assertEqual(stats['used'], len(keys) // 2)
+        self.assertEqual(stats['tombstones'], len(keys) // 2)
+        self.assertEqual(stats['load'], len(d) / stats['slots'])
+
+        d.clear()
+        stats = d._stats()
+
+        self.assertEqual(stats['slots'], 0)
+        self.assertEqual(stats['load'], 0.0)
+        self.assertEqual(stats['tombstones'], 0)
+
+    def test_insertion_order(self):
+        LENGTH = 100
+
+        d = IdentityDict()
+        keys = [ConstantHash() for _ in range(LENGTH)]
+
+        for i, key in enumerate(keys):
+            d[key] = i
+
+        del d[keys[0]]
+        d.pop(keys[50])
+
+        d[keys[0]] = 0
+
+        expected = keys[1:50] + keys[51:] + keys[:1]
+
+        self.assertEqual(list(d), expected)
+        self.assertEqual(list(d.values()), [d[key] for key in expected])
+        self.assertEqual([key for key, _ in d.items()], expected)
+
+    def test_capacity(self):
+        keys = [ConstantHash() for _ in range(1000)]
+
+        d = IdentityDict(capacity=len(keys))
+
+        for i, key in enumerate(keys):
+            d[key] = i
+
+        self.assertEqual(len(d), len(keys))
+        self.assertEqual([d[key] for key in keys], list(range(len(keys))))
+
+        with self.assertRaises(ValueError):
+            IdentityDict(capacity=-1)
+
+        with self.assertRaises(TypeError):
+            IdentityDict(1000)
+
+    def test_reserve(self):
+        d = IdentityDict()
+        first = ConstantHash()
+
+        d[first] = 'first'
+
+        d.reserve(1000)
+
+        keys = [ConstantHash() for _ in range(999)]
+
+        for i, key in enumerate(keys):
+            d[key] = i
+
+        self.assertEqual(d[first], 'first')
+        self.assertEqual([d[key] for key in keys], list(range(len(keys))))
+
+        # Already has room
+        d.reserve(10)
+
+        self.assertEqual(len(d), 1000)
+
+        with self.assertRaises(ValueError):
+            d.reserve(-1)
+
+    def test_shrink_to_fit(self):
+        d = IdentityDict()
+        keys = [ConstantHash() for _ in range(1000)]
+
+        for i, key in enumerate(keys):
+            d[key] = i
+
+        for key in keys[10:]:
+            del d[key]
+
+        d.shrink_to_fit()
+
+        self.assertEqual(list(d), keys[:10])
+        self.assertEqual([d[key] for key in keys[:10]], list(range(10)))
+
+        for key in keys[10:]:
+            self.assertNotIn(key, d)
+
+        d.clear()
+        d.shrink_to_fit()
+
+        self.assertEqual(len(d), 0)
+
+    def test_shrink_on_delete(self):
+        keys = [ConstantHash() for _ in range(100000)]
+
+        def table_size(min_load):
+            tracemalloc.start()
+            try:
+                d = IdentityDict(min_load=min_load)
+                for key in keys:
+                    d[key] = key
+                full = tracemalloc.get_traced_memory()[0]
+
+                for key in keys[10:]:
+                    del d[key]
+
+                return tracemalloc.get_traced_memory()[0] / full, d
+            finally:
+                tracemalloc.stop()
+
+        shrunk, d = table_size(1 / 12)
+
+        self.assertLess(shrunk, 0.1)
+        self.assertEqual(list(d.items()), [(key, key) for key in keys[:10]])
+
+        for key in keys[10:]:
+            self.assertNotIn(key, d)
+
+        # pop() shrinks alike
+        for key in keys[10:]:
+            d[key] = None
+        for key in keys[10:]:
+            d.pop(key)
+
+        self.assertEqual(list(d), keys[:10])
+
+        # So does clear(), back to the inline table
+        tracemalloc.start()
+        try:
+            d.update((key, key) for key in keys)
+            full = tracemalloc.get_traced_memory()[0]
+            d.clear()
+            self.assertLess(tracemalloc.get_traced_memory()[0], full * 0.01)
+        finally:
+            tracemalloc.stop()
+
+        kept, d = table_size(0)
+
+        self.assertGreater(kept, 0.99)
+        self.assertEqual(list(d), keys[:10])
+
+    def test_sizeof(self):
+        d = IdentityDict()
+        empty = sys.getsizeof(d)
+        keys = [ConstantHash() for _ in range(1000)]
+
+        d.update((key, None) for key in keys)
+
+        # 1000 entries of two pointers, at least
+        self.assertGreater(sys.getsizeof(d), empty + 16000)
+
+        # A table shared with a snapshot counts for neither
+        snapshot = d.snapshot()
+        self.assertEqual(sys.getsizeof(d), empty)
+        self.assertEqual(sys.getsizeof(snapshot), empty)
+
+        d[keys[0]] = 0
+        self.assertGreater(sys.getsizeof(d), empty + 16000)
+
+        d.clear()
+        self.assertEqual(sys.getsizeof(d), empty)
+
+        for cls in WeakIdentityDict, ConcurrentIdentityDict, Int64Dict:
+            d = cls()
+            empty = sys.getsizeof(d)
+            for i in range(1000):
+                d[keys[i] if cls is not Int64Dict else i] = None
+            self.assertGreater(sys.getsizeof(d), empty + 16000, cls)
+
+    def test_tracemalloc_domain(self):
+        keys = [ConstantHash() for _ in range(10000)]
+        tables = tracemalloc.DomainFilter(True, TRACEMALLOC_DOMAIN)
+
+        tracemalloc.start()
+        try:
+            d = IdentityDict()
+            d.update((key, None) for key in keys)
+            traced = tracemalloc.take_snapshot().filter_traces([tables])
+            size = sum(stat.size for stat in traced.statistics('filename'))
+
+            self.assertEqual(size, sys.getsizeof(d) - sys.getsizeof(IdentityDict()))
+
+            del d
+            traced = tracemalloc.take_snapshot().filter_traces([tables])
+            self.assertEqual(traced.statistics('filename'), [])
+        finally:
+            tracemalloc.stop()
+
+    def test_load_policy(self):
+        d = IdentityDict()
+
+        self.assertAlmostEqual(d.max_load, 2 / 3)
+        self.assertEqual(d.growth_factor, 2)
+        self.assertAlmostEqual(d.min_load, 1 / 12)
+
+        for max_load, growth_factor in [(0.01, 2), (0.5, 4), (0.95, 2)]:
+            d = IdentityDict(max_load=max_load, growth_factor=growth_factor)
+            keys = [ConstantHash() for _ in range(1000)]
+
+            for i, key in enumerate(keys):
+                d[key] = i
+
+            for key in keys[::2]:
+                del d[key]
+
+            self.assertEqual([d[key] for key in keys[1::2]], list(range(1, 1000, 2)))
+
+            # Copies and snapshots keep the policy
+            for other in d.copy(), d.snapshot():
+                self.assertEqual(other.max_load, max_load)
+                self.assertEqual(other.growth_factor, growth_factor)
+                self.assertEqual(other.min_load, d.min_load)
+
+            d.shrink_to_fit()
+            d.reserve(2000)
+
+            self.assertEqual(len(d), 500)
+
+        for max_load in 0, 1, -0.5, 1.5:
+            with self.assertRaises(ValueError):
+                IdentityDict(max_load=max_load)
+
+        for growth_factor in -2, 0, 1, 3:
+            with self.assertRaises(ValueError):
+                IdentityDict(growth_factor=growth_factor)
+
+        self.assertEqual(IdentityDict(min_load=0).min_load, 0)
+        self.assertEqual(IdentityDict(max_load=0.5, growth_factor=4, min_load=1 / 16).min_load, 1 / 16)
+
+        for min_load in -0.1, 1 / 6 + 0.01, 0.5:
+            with self.assertRaises(ValueError):
+                IdentityDict(min_load=min_load)
+
+    def test_update(self):
+        keys = [ConstantHash() for _ in range(100)]
+
+        source = IdentityDict()
+        for i, key in enumerate(keys):
+            source[key] = i
+
+        d = IdentityDict()
+        d[keys[0]] = 'replaced'
+        d.update(source)
+
+        self.assertEqual(list(d), keys)
+        self.assertEqual([d[key] for key in keys], list(range(100)))
+
+        d = IdentityDict()
+        d.update(zip(keys, range(100)))
+        self.assertEqual(list(d.items()), list(zip(keys, range(100))))
+
+        d = IdentityDict()
+        d.update({'a': 1}, b=2)
+        self.assertEqual(d['a'], 1)
+        self.assertEqual(d['b'], 2)
+
+        d.update(d)
+        self.assertEqual(len(d), 2)
+
+        with self.assertRaises(ValueError):
+            d.update([(1, 2, 3)])
+
+        with self.assertRaises(TypeError):
+            d.update([1])
+
+        with self.assertRaises(TypeError):
+            d.update(1, 2)
+
+    def test_fromkeys(self):
+        keys = [ConstantHash() for _ in range(100)]
+
+        d = IdentityDict.fromkeys(keys)
+        self.assertEqual(list(d), keys)
+        self.assertEqual(list(d.values()), [None] * 100)
+
+        d = IdentityDict.fromkeys(iter(keys), 0)
+        self.assertEqual(list(d.values()), [0] * 100)
+
+        self.assertEqual(len(IdentityDict.fromkeys(())), 0)
+
+    def test_copy(self):
+        keys = [ConstantHash() for _ in range(100)]
+
+        d = IdentityDict()
+        for i, key in enumerate(keys):
+            d[key] = i
+
+        for key in keys[:60]:
+            del d[key]
+
+        copy = d.copy()
+
+        self.assertIsInstance(copy, IdentityDict)
+        self.assertEqual(list(copy.items()), list(d.items()))
+
+        copy[keys[0]] = 'new'
+        del copy[keys[99]]
+
+        self.assertNotIn(keys[0], d)
+        self.assertEqual(d[keys[99]], 99)
+        self.assertEqual(len(d), 40)
+        self.assertEqual(len(copy), 40)
+
+    def test_snapshot(self):
+        keys = [ConstantHash() for _ in range(100)]
+
+        d = IdentityDict()
+        for i, key in enumerate(keys):
+            d[key] = i
+
+        first = d.snapshot()
+        second = d.snapshot()
+        nested = first.snapshot()
+
+        self.assertEqual(list(first.items()), list(d.items()))
+
+        d[keys[0]] = 'changed'
+        del first[keys[1]]
+        first.pop(keys[2])
+        second.setdefault(ConstantHash(), 'added')
+
+        self.assertEqual(d[keys[0]], 'changed')
+        self.assertEqual(first[keys[0]], 0)
+        self.assertNotIn(keys[1], first)
+        self.assertEqual(len(first), 98)
+        self.assertEqual(len(second), 101)
+        self.assertEqual(len(d), 100)
+
+        self.assertEqual(list(nested.items()), list(zip(keys, range(100))))
+
+        nested.clear()
+        self.assertEqual(len(nested), 0)
+        self.assertEqual(second[keys[1]], 1)
+
+    def test_snapshot_outlives_dict(self):
+        key = ConstantHash()
+        value = ConstantHash()
+        ref = weakref.ref(value)
+
+        d = IdentityDict()
+        d[key] = value
+        snapshot = d.snapshot()
+
+        del d, value
+
+        self.assertIsNotNone(ref())
+        self.assertIs(snapshot[key], ref())
+
+        snapshot[key] = 'replaced'
+
+        self.assertIsNone(ref())
+
+    def test_cycles_collected(self):
+        class Node:
             pass
 
-class NamedTupleMetaTests(unittest.TestCase):
-    def test_new(self):
-        class A(NamedTuple):
-            x = __(str)
-            y = __(str)
+        for make in (lambda d: d, IdentityDict.keys, IdentityDict.items, iter):
+            d = IdentityDict()
+            node = Node()
 
-    def test_len(self):
-        class A(NamedTuple):
-            x = __(str)
-            y = __(str)
+            node.held = make(d)
+            d[node] = node.held
 
-        self.assertEqual(len(A), 2)
+            ref = weakref.ref(node)
+
+            del d, node
+            gc.collect()
+
+            self.assertIsNone(ref())
+
+        # Through a table shared with a snapshot
+        d = IdentityDict()
+        node = Node()
+
+        d[node] = None
+        node.held = d.snapshot()
+
+        ref = weakref.ref(node)
+
+        del d, node
+        gc.collect()
+
+        self.assertIsNone(ref())
+
+    def test_cycles_no_leak(self):
+        class Node:
+            pass
+
+        def churn(count):
+            for _ in range(count):
+                d = IdentityDict()
+                node = Node()
+
+                node.d = d
+                d[node] = d
+                d[d] = node
+
+            gc.collect()
+
+            return tracemalloc.get_traced_memory()[0]
+
+        tracemalloc.start()
+        try:
+            churn(10000)
+            before = churn(10000)
+
+            # A million insertions, all in cycles
+            for _ in range(50):
+                after = churn(10000)
+        finally:
+            tracemalloc.stop()
+
+        self.assertLess(after - before, 64 * 1024)
+
+    def test_resize(self):
+        d = IdentityDict()
+
+        # Current implementation detail:
+        # INITIAL_SIZE = 16
+        # resize at ~2/3
+
+        for i in range(30):
+            d[ConstantHash()] = i
+
+        # Random code snippet which
+        # cause core dump...
+        for _ in d.items():
+            pass
+
+class IdentityDefaultDictTests(unittest.TestCase):
+    def test_sanity(self):
+        d = IdentityDefaultDict(list)
+        keys = [ConstantHash() for _ in range(100)]
+
+        for i, key in enumerate(keys):
+            d[key].append(i)
+            d[key].append(i)
+
+        self.assertIsInstance(d, IdentityDict)
+        self.assertEqual(len(d), len(keys))
+        self.assertEqual([d[key] for key in keys], [[i, i] for i in range(len(keys))])
+        self.assertEqual(list(d), keys)
+
+    def test_no_factory(self):
+        d = IdentityDefaultDict()
+        key = ConstantHash()
+
+        self.assertIsNone(d.default_factory)
+
+        with self.assertRaises(KeyError):
+            d[key]
+
+        d.default_factory = dict
+        self.assertEqual(d[key], {})
+
+        del d.default_factory
+        self.assertIsNone(d.default_factory)
+
+        with self.assertRaises(TypeError):
+            d.default_factory = 1
+
+        with self.assertRaises(TypeError):
+            IdentityDefaultDict(1)
+
+    def test_capacity_copy(self):
+        d = IdentityDefaultDict(list, capacity=100)
+        key = ConstantHash()
+
+        d[key].append(1)
+
+        copy = d.copy()
+
+        self.assertIs(type(copy), IdentityDefaultDict)
+        self.assertIs(copy.default_factory, list)
+        self.assertIs(copy[key], d[key])
+        self.assertEqual(copy[ConstantHash()], [])
+        self.assertEqual(len(d), 1)
+
+    def test_cycles_collected(self):
+        class Node:
+            pass
+
+        d = IdentityDefaultDict()
+        node = Node()
+        node.d = d
+        d.default_factory = lambda: node
+        d[node]
+        ref = weakref.ref(node)
+
+        del d, node
+        gc.collect()
+
+        self.assertIsNone(ref())
+
+class WeakIdentityDictTests(unittest.TestCase):
+    def test_sanity(self):
+        d = WeakIdentityDict()
+
+        x = ConstantHash()
+        y = ConstantHash()
+
+        d[x] = 2
+        d[y] = 3
+
+        self.assertEqual(d[x], 2)
+        self.assertEqual(d[y], 3)
+        self.assertEqual(len(d), 2)
+        self.assertIn(x, d)
+        self.assertNotIn(ConstantHash(), d)
+
+        d[x] = 4
+        self.assertEqual(d[x], 4)
+
+        del d[x]
+        self.assertNotIn(x, d)
+
+        with self.assertRaises(KeyError):
+            d[x]
+
+        with self.assertRaises(KeyError):
+            del d[x]
+
+    def test_get_pop(self):
+        d = WeakIdentityDict()
+        key = ConstantHash()
+
+        self.assertIs(d.get(key), None)
+        self.assertEqual(d.get(key, 6), 6)
+
+        d[key] = 5
+
+        self.assertEqual(d.get(key), 5)
+        self.assertEqual(d.pop(key), 5)
+        self.assertEqual(d.pop(key, 6), 6)
+
+        with self.assertRaises(KeyError):
+            d.pop(key)
+
+    def test_evicts_dead_keys(self):
+        d = WeakIdentityDict()
+        keys = [ConstantHash() for _ in range(1000)]
+
+        for i, key in enumerate(keys):
+            d[key] = i
+
+        del key
+        del keys[::2]
+
+        self.assertEqual(len(d), 500)
+        self.assertEqual(list(d), keys)
+        self.assertEqual(d.values(), list(range(1, 1000, 2)))
+        self.assertEqual(d.items(), list(zip(keys, range(1, 1000, 2))))
+
+        keys.clear()
+
+        self.assertEqual(len(d), 0)
+
+    def test_holds_keys_weakly(self):
+        d = WeakIdentityDict()
+        key = ConstantHash()
+        ref = weakref.ref(key)
+
+        d[key] = 'value'
+
+        del key
+        gc.collect()
+
+        self.assertIsNone(ref())
+        self.assertEqual(len(d), 0)
+
+    def test_dict_dies_first(self):
+        d = WeakIdentityDict()
+        key = ConstantHash()
+        value = ConstantHash()
+        ref = weakref.ref(value)
+
+        d[key] = value
+
+        del d, value
+
+        self.assertIsNone(ref())
+
+        del key
+
+    def test_clear(self):
+        d = WeakIdentityDict()
+        keys = [ConstantHash() for _ in range(10)]
+
+        for key in keys:
+            d[key] = key
+
+        d.clear()
+
+        self.assertEqual(len(d), 0)
+
+        d[keys[0]] = 1
+        self.assertEqual(d[keys[0]], 1)
+
+    def test_unreferenceable_key(self):
+        d = WeakIdentityDict()
+
+        with self.assertRaises(TypeError):
+            d[1] = 2
+
+        self.assertEqual(len(d), 0)
+
+class ConcurrentIdentityDictTests(unittest.TestCase):
+    def test_sanity(self):
+        d = ConcurrentIdentityDict()
+        keys = [ConstantHash() for _ in range(1000)]
+
+        for i, key in enumerate(keys):
+            d[key] = i
+
+        self.assertEqual(len(d), len(keys))
+        self.assertEqual([d[key] for key in keys], list(range(len(keys))))
+        self.assertNotIn(ConstantHash(), d)
+
+        for key in keys[::2]:
+            del d[key]
+
+        for i, key in enumerate(keys):
+            if i % 2:
+                self.assertIn(key, d)
+            else:
+                self.assertNotIn(key, d)
+
+        with self.assertRaises(KeyError):
+            d[keys[0]]
+
+        with self.assertRaises(KeyError):
+            del d[keys[0]]
+
+    def test_shard_spread(self):
+        for make in object, list:
+            d = ConcurrentIdentityDict()
+            keys = [make() for _ in range(10000)]
+
+            for key in keys:
+                d[key] = None
+
+            lens = d._shard_lens()
+
+            self.assertEqual(sum(lens), len(keys))
+            # 625 each, if even
+            self.assertGreater(min(lens), len(keys) / len(lens) / 2, lens)
+
+    def test_get_setdefault_pop(self):
+        d = ConcurrentIdentityDict()
+        key = ConstantHash()
+
+        self.assertIs(d.get(key), None)
+        self.assertEqual(d.get(key, 6), 6)
+
+        self.assertEqual(d.setdefault(key, 5), 5)
+        self.assertEqual(d.setdefault(key, 6), 5)
+
+        self.assertEqual(d.pop(key), 5)
+        self.assertEqual(d.pop(key, 6), 6)
+
+        with self.assertRaises(KeyError):
+            d.pop(key)
+
+        with self.assertRaises(TypeError):
+            d.get()
+
+    def test_lists(self):
+        d = ConcurrentIdentityDict()
+        keys = [ConstantHash() for _ in range(100)]
+
+        for i, key in enumerate(keys):
+            d[key] = i
+
+        ids = {id(key): i for i, key in enumerate(keys)}
+
+        # Ordered by shard, so only as sets
+        self.assertEqual(sorted(ids[id(key)] for key in d), list(range(100)))
+        self.assertEqual(sorted(d.values()), list(range(100)))
+        self.assertTrue(all(ids[id(key)] == value for key, value in d.items()))
+        self.assertEqual(len(d.keys()), 100)
+
+        d.clear()
+
+        self.assertEqual(len(d), 0)
+        self.assertEqual(list(d), [])
+
+    def test_cycles_collected(self):
+        class Node:
+            pass
+
+        d = ConcurrentIdentityDict()
+        node = Node()
+        node.d = d
+        d[node] = node
+        ref = weakref.ref(node)
+
+        del d, node
+        gc.collect()
+
+        self.assertIsNone(ref())
+
+    def test_threads(self):
+        THREADS = 8
+        ROUNDS = 2000
+
+        d = ConcurrentIdentityDict()
+        shared = [ConstantHash() for _ in range(64)]
+        winners = [[] for _ in range(THREADS)]
+
+        def work(n):
+            for i in range(ROUNDS):
+                own = ConstantHash()
+                d[own] = n
+                winners[n].append(d.setdefault(shared[i % len(shared)], n))
+                if d.pop(own) != n:
+                    raise AssertionError(own)
+
+        # Switch often, to interleave with the GIL too
+        interval = sys.getswitchinterval()
+        sys.setswitchinterval(1e-6)
+
+        try:
+            threads = [threading.Thread(target=work, args=(n,)) for n in range(THREADS)]
+            for thread in threads:
+                thread.start()
+            for thread in threads:
+                thread.join()
+        finally:
+            sys.setswitchinterval(interval)
+
+        # Only the shared keys are left, each with the one value every
+        # thread saw for it.
+        self.assertEqual(len(d), len(shared))
+
+        for n in range(THREADS):
+            for i, value in enumerate(winners[n]):
+                self.assertEqual(value, d[shared[i % len(shared)]])
+
+class Int64DictTests(unittest.TestCase):
+    def test_sanity(self):
+        d = Int64Dict()
+        keys = [i * 7919 - 5000000 for i in range(1000)] + [2**63 - 1, -2**63]
+
+        for key in keys:
+            d[key] = str(key)
+
+        self.assertEqual(len(d), len(keys))
+        self.assertEqual([d[key] for key in keys], [str(key) for key in keys])
+        self.assertEqual(sorted(d), sorted(keys))
+
+        for key in keys[::2]:
+            del d[key]
+
+        for i, key in enumerate(keys):
+            if i % 2:
+                self.assertIn(key, d)
+            else:
+                self.assertNotIn(key, d)
+
+        with self.assertRaises(KeyError):
+            d[keys[0]]
+
+        with self.assertRaises(KeyError):
+            del d[keys[0]]
+
+        d[keys[1]] = 'replaced'
+
+        self.assertEqual(d[keys[1]], 'replaced')
+        self.assertEqual(len(d), len(keys) // 2)
+
+    def test_keys(self):
+        d = Int64Dict()
+
+        # Equal ints are the same key, however made
+        d[10**6] = 'a'
+        self.assertEqual(d[int('1000000')], 'a')
+        d[True] = 'b'
+        self.assertEqual(d[1], 'b')
+
+        class Index:
+            def __index__(self):
+                return 5
+
+        d[Index()] = 'c'
+        self.assertEqual(d[5], 'c')
+
+        # Out of range: never there, and can't be set
+        self.assertNotIn(2**63, d)
+        self.assertIs(d.get(-2**63 - 1), None)
+
+        with self.assertRaises(KeyError):
+            d[2**64]
+
+        with self.assertRaises(OverflowError):
+            d[2**63] = None
+
+        for key in 1.0, '1', None:
+            with self.assertRaises(TypeError):
+                d[key]
+            with self.assertRaises(TypeError):
+                d[key] = None
+            with self.assertRaises(TypeError):
+                key in d
+
+    def test_get_setdefault_pop(self):
+        d = Int64Dict()
+
+        self.assertIs(d.get(1), None)
+        self.assertEqual(d.get(1, 6), 6)
+
+        self.assertEqual(d.setdefault(1, 5), 5)
+        self.assertEqual(d.setdefault(1, 6), 5)
+
+        self.assertEqual(d.pop(1), 5)
+        self.assertEqual(d.pop(1, 6), 6)
+
+        with self.assertRaises(KeyError):
+            d.pop(1)
+
+        with self.assertRaises(TypeError):
+            d.get()
+
+    def test_lists(self):
+        d = Int64Dict(capacity=100)
+
+        for i in range(100):
+            d[i] = -i
+
+        self.assertEqual(sorted(d.keys()), list(range(100)))
+        self.assertEqual(sorted(d.values()), list(range(-99, 1)))
+        self.assertEqual(sorted(d.items()), [(i, -i) for i in range(100)])
+
+        d.clear()
+
+        self.assertEqual(len(d), 0)
+        self.assertEqual(list(d), [])
+
+        with self.assertRaises(ValueError):
+            Int64Dict(capacity=-1)
+
+    def test_churn(self):
+        d = Int64Dict()
+
+        # Steady size: deleted slots are reclaimed, not grown past
+        for i in range(100000):
+            d[i] = None
+            if i >= 10:
+                del d[i - 10]
+
+        self.assertEqual(sorted(d), list(range(99990, 100000)))
+
+    def test_memory(self):
+        count = 80000
+
+        def traced(make):
+            tracemalloc.start()
+            try:
+                made = make()
+                return tracemalloc.get_traced_memory()[0], made
+            finally:
+                tracemalloc.stop()
+
+        def fill(d):
+            for i in range(count):
+                d[2**40 + i] = None
+            return d
+
+        unboxed, _ = traced(lambda: fill(Int64Dict()))
+        boxed, _ = traced(lambda: fill({}))
+
+        self.assertLess(unboxed, boxed * 0.6)
+
+    def test_cycles_collected(self):
+        class Node:
+            pass
+
+        d = Int64Dict()
+        node = Node()
+        node.d = d
+        d[1] = node
+        ref = weakref.ref(node)
+
+        del d, node
+        gc.collect()
+
+        self.assertIsNone(ref())
+
+class IdentitySetTests(unittest.TestCase):
+    def test_sanity(self):
+        s = IdentitySet()
+        keys = [ConstantHash() for _ in range(1000)]
+
+        for key in keys:
+            s.add(key)
+        s.add(keys[0])
+
+        self.assertEqual(len(s), len(keys))
+        self.assertEqual(set(map(id, s)), set(map(id, keys)))
+
+        for key in keys[::2]:
+            s.discard(key)
+        s.discard(keys[0])
+
+        for i, key in enumerate(keys):
+            if i % 2:
+                self.assertIn(key, s)
+            else:
+                self.assertNotIn(key, s)
+
+        with self.assertRaises(KeyError):
+            s.remove(keys[0])
+
+        s.remove(keys[1])
+        self.assertNotIn(keys[1], s)
+        self.assertEqual(len(s), len(keys) // 2 - 1)
+
+        s.clear()
+        self.assertEqual(len(s), 0)
+        self.assertEqual(list(s), [])
+
+    def test_identity(self):
+        # Equal objects are distinct keys, and unhashable ones are keys too
+        a, b = [1], [1]
+        s = IdentitySet([a, a, b])
+
+        self.assertEqual(len(s), 2)
+        self.assertIn(a, s)
+        self.assertNotIn([1], s)
+
+        s.discard([1])
+        self.assertEqual(len(s), 2)
+
+    def test_new(self):
+        keys = [object() for _ in range(100)]
+
+        self.assertEqual(len(IdentitySet(keys)), 100)
+        self.assertEqual(len(IdentitySet(iter(keys), capacity=1000)), 100)
+        self.assertEqual(len(IdentitySet(IdentitySet(keys))), 100)
+
+        with self.assertRaises(ValueError):
+            IdentitySet(capacity=-1)
+
+        with self.assertRaises(TypeError):
+            IdentitySet(1)
+
+    def test_algebra(self):
+        keys = [object() for _ in range(300)]
+        a = IdentitySet(keys[:200])
+        b = IdentitySet(keys[100:])
+
+        def ids(s):
+            self.assertIsInstance(s, IdentitySet)
+            return set(map(id, s))
+
+        self.assertEqual(ids(a & b), set(map(id, keys[100:200])))
+        self.assertEqual(ids(a | b), set(map(id, keys)))
+        self.assertEqual(ids(a - b), set(map(id, keys[:100])))
+        self.assertEqual(ids(b - a), set(map(id, keys[200:])))
+        self.assertEqual(ids(a ^ b), set(map(id, keys[:100] + keys[200:])))
+
+        # Larger on either side
+        c = IdentitySet(keys[:10])
+        self.assertEqual(ids(c | a), ids(a))
+        self.assertEqual(ids(c & a), ids(c))
+        self.assertEqual(ids(c ^ a), set(map(id, keys[10:200])))
+
+        # Operands left alone
+        self.assertEqual(len(a), 200)
+        self.assertEqual(len(b), 200)
+
+        with self.assertRaises(TypeError):
+            a | keys
+
+    def test_copy_update(self):
+        keys = [object() for _ in range(100)]
+        s = IdentitySet(keys[:50])
+        copy = s.copy()
+
+        copy.update(keys)
+
+        self.assertEqual(len(s), 50)
+        self.assertEqual(len(copy), 100)
+
+    def test_iter(self):
+        keys = [object() for _ in range(100)]
+        s = IdentitySet(keys)
+
+        self.assertEqual(set(map(id, s)), set(map(id, keys)))
+
+        # Deleting as it goes
+        for key in s:
+            s.discard(key)
+
+        self.assertEqual(len(s), 0)
+
+    def test_churn(self):
+        s = IdentitySet()
+        keys = [object() for _ in range(100000)]
+
+        # Steady size: deleted slots are reclaimed, not grown past
+        for i, key in enumerate(keys):
+            s.add(key)
+            if i >= 10:
+                s.discard(keys[i - 10])
+
+        self.assertEqual(set(map(id, s)), set(map(id, keys[-10:])))
+
+    def test_memory(self):
+        keys = [object() for _ in range(100000)]
+        d = IdentityDict()
+        d.update((key, None) for key in keys)
+
+        self.assertLess(sys.getsizeof(IdentitySet(keys)), sys.getsizeof(d) * 0.6)
+
+    def test_load_policy(self):
+        s = IdentitySet()
+
+        self.assertAlmostEqual(s.max_load, 2 / 3)
+        self.assertEqual(s.growth_factor, 2)
+        self.assertAlmostEqual(s.min_load, 1 / 12)
+
+        for max_load, growth_factor in [(0.01, 2), (0.5, 4), (0.95, 2)]:
+            s = IdentitySet(max_load=max_load, growth_factor=growth_factor)
+            keys = [object() for _ in range(1000)]
+
+            s.update(keys)
+            for key in keys[::2]:
+                s.discard(key)
+
+            self.assertEqual(set(map(id, s)), set(map(id, keys[1::2])))
+
+            # Copies and set algebra keep the policy
+            for other in s.copy(), s | IdentitySet(), s - IdentitySet():
+                self.assertEqual(other.max_load, max_load)
+                self.assertEqual(other.growth_factor, growth_factor)
+                self.assertEqual(other.min_load, s.min_load)
+
+        for max_load in 0, 1, -0.5, 1.5:
+            with self.assertRaises(ValueError):
+                IdentitySet(max_load=max_load)
+
+        for growth_factor in -2, 0, 1, 3:
+            with self.assertRaises(ValueError):
+                IdentitySet(growth_factor=growth_factor)
+
+        for min_load in -0.1, 1 / 6 + 0.01, 0.5:
+            with self.assertRaises(ValueError):
+                IdentitySet(min_load=min_load)
+
+    def test_shrink_on_delete(self):
+        keys = [object() for _ in range(100000)]
+
+        for min_load in 1 / 12, 0:
+            s = IdentitySet(keys, min_load=min_load)
+            full = sys.getsizeof(s)
+
+            for key in keys[10:]:
+                s.discard(key)
+
+            if min_load:
+                self.assertLess(sys.getsizeof(s), full * 0.01)
+            else:
+                self.assertEqual(sys.getsizeof(s), full)
+
+            self.assertEqual(set(map(id, s)), set(map(id, keys[:10])))
+
+        # Not while iterating, which would skip keys that moved
+        s = IdentitySet(keys)
+        full = sys.getsizeof(s)
+
+        for key in s:
+            s.discard(key)
+            self.assertEqual(sys.getsizeof(s), full)
+
+        self.assertEqual(len(s), 0)
+
+        s.update(keys)
+        s.clear()
+
+        self.assertLess(sys.getsizeof(s), full * 0.01)
+
+    @unittest.skipUnless(hasattr(IdentitySet, '_stats'), 'built without B_STATS')
+    def test_stats(self):
+        keys = [object() for _ in range(1000)]
+        s = IdentitySet()
+
+        for key in keys:
+            s.add(key)
+        for key in keys[::2]:
+            s.remove(key)
+
+        stats = s._stats()
+
+        # A miss to add each, a hit to remove half
+        self.assertEqual(sum(stats['misses']), len(keys))
+        self.assertEqual(sum(stats['hits']), len(keys) // 2)
+        self.assertGreater(stats['grows'], 0)
+        self.assertEqual(stats['used'], len(keys) // 2)
+        self.assertEqual(stats['load'], len(s) / stats['slots'])
+
+    def test_cycles_collected(self):
+        class Node:
+            pass
+
+        s = IdentitySet()
+        node = Node()
+        node.s = s
+        s.add(node)
+        ref = weakref.ref(node)
+
+        del s, node
+        gc.collect()
+
+        self.assertIsNone(ref())
+
+class PersistentIdentityMapTests(unittest.TestCase):
+    def test_sanity(self):
+        empty = PersistentIdentityMap()
+
+        x = ConstantHash()
+        y = ConstantHash()
+
+        m = empty.set(x, 2).set(y, 3)
+
+        self.assertEqual(m[x], 2)
+        self.assertEqual(m[y], 3)
+        self.assertEqual(len(m), 2)
+        self.assertIn(x, m)
+        self.assertNotIn(ConstantHash(), m)
+
+        self.assertEqual(len(empty), 0)
+        self.assertNotIn(x, empty)
+
+        with self.assertRaises(KeyError):
+            empty[x]
+
+        with self.assertRaises(TypeError):
+            m[x] = 4
+
+    def test_versions(self):
+        keys = [ConstantHash() for _ in range(1000)]
+        versions = [PersistentIdentityMap()]
+
+        for i, key in enumerate(keys):
+            versions.append(versions[-1].set(key, i))
+
+        for n, m in enumerate(versions):
+            self.assertEqual(len(m), n)
+            self.assertEqual(set(m.values()), set(range(n)))
+
+        last = versions[-1]
+        changed = last.set(keys[0], 'changed')
+
+        self.assertEqual(changed[keys[0]], 'changed')
+        self.assertEqual(last[keys[0]], 0)
+
+        # Unchanged
+        self.assertIs(last.set(keys[0], 0), last)
+
+    def test_delete(self):
+        keys = [ConstantHash() for _ in range(1000)]
+
+        m = PersistentIdentityMap()
+        for i, key in enumerate(keys):
+            m = m.set(key, i)
+
+        full = m
+
+        for key in keys[::2]:
+            m = m.delete(key)
+
+        self.assertEqual(len(m), 500)
+        self.assertEqual(sorted(m.values()), list(range(1, 1000, 2)))
+        self.assertEqual(len(full), 1000)
+
+        with self.assertRaises(KeyError):
+            m.delete(keys[0])
+
+        for key in keys[1::2]:
+            m = m.delete(key)
+
+        self.assertEqual(len(m), 0)
+        self.assertEqual(list(m), [])
+
+    def test_get_iter(self):
+        keys = [ConstantHash() for _ in range(100)]
+
+        m = PersistentIdentityMap()
+        for i, key in enumerate(keys):
+            m = m.set(key, i)
+
+        self.assertEqual(m.get(keys[5]), 5)
+        self.assertIs(m.get(ConstantHash()), None)
+        self.assertEqual(m.get(ConstantHash(), 6), 6)
+
+        self.assertEqual(set(map(id, m)), set(map(id, keys)))
+        index = {id(key): i for i, key in enumerate(keys)}
+
+        self.assertEqual(sorted((index[id(k)], v) for k, v in m.items()),
+                         list(zip(range(100), range(100))))
+
+    # Exercises the collision nodes only when built with a degenerate
+    # B_HAMT_HASH, e.g. B_HAMT_HASH=0 or B_HAMT_HASH='hash_int(key) & 0xf'
+    def test_collisions(self):
+        keys = [ConstantHash() for _ in range(200)]
+
+        m = PersistentIdentityMap()
+        for i, key in enumerate(keys):
+            m = m.set(key, i)
+
+        replaced = m
+        for key in keys[::3]:
+            replaced = replaced.set(key, 'replaced')
+
+        self.assertEqual(len(replaced), len(keys))
+        for i, key in enumerate(keys):
+            self.assertEqual(replaced[key], 'replaced' if i % 3 == 0 else i)
+            self.assertEqual(m[key], i)
+
+        # Down to one key, and so out of any collision node
+        for key in keys[1:]:
+            m = m.delete(key)
+            self.assertNotIn(key, m)
+
+        self.assertEqual(list(m.items()), [(keys[0], 0)])
+        self.assertEqual(m.set(keys[1], 1)[keys[1]], 1)
+
+    def test_cycles_collected(self):
+        class Node:
+            pass
+
+        node = Node()
+        node.held = PersistentIdentityMap().set(node, None)
+
+        ref = weakref.ref(node)
+
+        del node
+        gc.collect()
+
+        self.assertIsNone(ref())
+
+class NamedTupleMetaTests(unittest.TestCase):
+    def test_new(self):
+        class A(NamedTuple):
+            x = __(str)
+            y = __(str)
+
+    def test_len(self):
+        class A(NamedTuple):
+            x = __(str)
+            y = __(str)
+
+        self.assertEqual(len(A), 2)
+
+    def test_sizeof(self):
+        class A(NamedTuple):
+            x = __(str)
+
+        class B(NamedTuple):
+            x = __(str)
+            y = __(str)
+            z = __(str)
+
+        def extra(cls):
+            return type(cls).__sizeof__(cls) - type.__sizeof__(cls)
+
+        # The tail of NamedTupleMeta and the fields tuple, over type's own
+        self.assertGreater(extra(A), 0)
+        self.assertEqual(extra(B) - extra(A), 2 * 8)
 
     def test_getitem(self):
         class A(NamedTuple):
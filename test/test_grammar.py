@@ -1,8 +1,19 @@
+import sys
 import unittest
 
 from b.grammar import Parser
 
 class ParserTests(unittest.TestCase):
+    def test_sizeof(self):
+        self.assertGreater(sys.getsizeof(Parser(1000)), sys.getsizeof(Parser(0)) + 1000 * 8)
+
+    def test_bad_size(self):
+        with self.assertRaises(ValueError):
+            Parser(-1)
+
+        with self.assertRaises(MemoryError):
+            Parser(sys.maxsize // 4)
+
     def test_parse(self):
         p = Parser()
 
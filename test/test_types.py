@@ -1,3 +1,4 @@
+import sys
 import unittest
 
 from b.types import lazyproperty, Memoizer
@@ -207,6 +208,111 @@ class MemoizerTests(unittest.TestCase):
 
         self.assertEqual(count, 128)
 
+    def test_sizeof(self):
+        m = Memoizer(str)
+        empty = sys.getsizeof(m)
+
+        # Current implementation detail: INITIAL_SIZE slots of a control
+        # byte and two pointers each
+        self.assertGreater(empty, 128 * 17)
+
+        keys = [A(i) for i in range(1000)]
+        for key in keys:
+            m[key]
+
+        self.assertGreater(sys.getsizeof(m), empty * 8)
+
+    def test_load_policy(self):
+        m = Memoizer(str)
+
+        self.assertAlmostEqual(m.max_load, 2 / 3)
+        self.assertEqual(m.growth_factor, 2)
+
+        for max_load, growth_factor in [(0.01, 2), (0.5, 4), (0.95, 2)]:
+            m = Memoizer(str, max_load=max_load, growth_factor=growth_factor)
+            keys = [A(i) for i in range(1000)]
+
+            for key in keys:
+                m[key]
+
+            for key in keys[::2]:
+                del m[key]
+
+            self.assertEqual(len(m), 500)
+            self.assertEqual([m[key] for key in keys[1::2]], [str(key) for key in keys[1::2]])
+
+        with self.assertRaises(ValueError):
+            Memoizer(str, max_load=1)
+
+        with self.assertRaises(ValueError):
+            Memoizer(str, growth_factor=3)
+
+    def test_delete_keeps_probe_chains(self):
+        def plus_two(x):
+            return x + 2
+
+        m = Memoizer(plus_two)
+
+        keys = list(range(1000))
+
+        for key in keys:
+            m[key]
+
+        for key in keys[::2]:
+            del m[key]
+
+        for key in keys[1::2]:
+            self.assertIn(key, m)
+
+        self.assertEqual(len(m), 500)
+
+    def test_reentrant_grow(self):
+        # Each miss recurses into further misses, growing
+        # the table while outer lookups are still pending.
+        keys = [object() for _ in range(1000)]
+        index = {id(key): i for i, key in enumerate(keys)}
+
+        def depth(key):
+            i = index[id(key)]
+            return 0 if i == 0 else m[keys[i - 1]] + 1
+
+        m = Memoizer(depth)
+
+        for i in range(0, 1000, 100):
+            m[keys[i]]
+
+        for i, key in enumerate(keys):
+            self.assertEqual(m[key], i)
+
+        self.assertEqual(len(m), 1000)
+
+    def test_reentrant_same_key(self):
+        # The inner miss memoizes the key before the outer one
+        # returns; the outer result is dropped for it.
+        calls = []
+
+        def f(key):
+            calls.append(key)
+            return len(calls) if len(calls) > 1 else m[key] + 100
+
+        m = Memoizer(f)
+        key = object()
+
+        self.assertEqual(m[key], 2)
+        self.assertEqual(len(m), 1)
+        self.assertEqual(m[key], 2)
+
+        del m[key]
+
+        self.assertNotIn(key, m)
+        self.assertEqual(len(m), 0)
+
+    def test_delete_missing(self):
+        m = Memoizer(lambda x: x)
+
+        with self.assertRaises(KeyError):
+            del m[object()]
+
     def test_contains(self):
         def plus_two(x):
             return x + 2
@@ -268,3 +374,22 @@ class MemoizerTests(unittest.TestCase):
 
         self.assertEqual(deletions, reaps)
         self.assertEqual(len(m), 10 - reaps)
+
+    @unittest.skipUnless(hasattr(Memoizer, '_stats'), 'built without B_STATS')
+    def test_stats(self):
+        m = Memoizer(lambda x: x)
+        keys = [object() for _ in range(1000)]
+
+        for key in keys:
+            m[key]
+            m[key]
+
+        stats = m._stats()
+
+        self.assertEqual(sum(stats['misses']), len(keys))
+        self.assertEqual(sum(stats['hits']), len(keys))
+        self.assertGreater(stats['grows'], 0)
+        self.assertGreaterEqual(stats['grow_seconds'], 0)
+        self.assertEqual(stats['used'], len(keys))
+        self.assertEqual(stats['load'], len(keys) / stats['slots'])
+        self.assertEqual(stats['tombstones'], 0)